@@ -0,0 +1,378 @@
+/**
+ * Benchmark driver that runs the planner on a set of instances.
+ *
+ * Usage: pgp_bench [-bin=<planner binary>] [-p=<planners>] [-t=<thread counts>]
+ *                  [-r=<repetitions>] [-w=<warm-up runs>] [-timeout=<seconds>]
+ *                  [-args=<further planner arguments>] [-csv=<file>] [-json=<file>]
+ *                  [<directory or list file>]
+ *
+ * Planners and thread counts are comma separated lists (default: all
+ * planners with 1, 2 and 4 threads). The instances are all files in the given
+ * directory, the given SAS file or the files listed line by line in the given
+ * file (default: data/sas). Every run is a separate process of the planner
+ * binary (default: parallel_graphplan next to pgp_bench), so runs don't share
+ * any state and the peak memory of a run is that of its process. A run is
+ * killed once it exceeds the timeout.
+ *
+ * For every run, the time spent in each phase (parse, expand, encode, solve,
+ * as reported by the planner with -times), the wall time, the peak RSS and the
+ * plan length are written to the CSV and JSON files. Warm-up runs are
+ * executed first and not recorded. At the end, the median wall time of each
+ * configuration is printed.
+ *
+ * Author: Patrick Hegemann
+ */
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "Logger.h"
+#include "ParameterProcessor.h"
+#include "PhaseTimes.h"
+
+
+// Result of one run of the planner
+struct Run {
+    std::string instance;
+    std::string planner;
+    int threads;
+    int repetition;
+    std::string status;
+    double wallTime = 0;
+    double phaseTimes[PHASE_COUNT] = {};
+    long peakMemoryKB = 0;
+    int planLength = -1;
+    int planLayers = -1;
+};
+
+
+// Splits a string at the given separator, leaving out empty parts
+static std::vector<std::string> split(const std::string& s, char separator) {
+    std::vector<std::string> parts;
+    std::string part;
+    std::istringstream stream(s);
+    while (std::getline(stream, part, separator)) {
+        if (!part.empty()) parts.push_back(part);
+    }
+    return parts;
+}
+
+// Returns all regular files in a directory (sorted by name), the given file
+// if it is a SAS file or else the files listed in it
+static std::vector<std::string> listInstances(const std::string& path) {
+    std::vector<std::string> files;
+    struct stat pathStat;
+    if (stat(path.c_str(), &pathStat) != 0) {
+        exitError("Could not open %s\n", path.c_str());
+    }
+
+    if (S_ISREG(pathStat.st_mode)) {
+        std::ifstream list(path);
+        std::string line;
+        // A single SAS file is an instance by itself
+        if (std::getline(list, line) && line == "begin_version") {
+            files.push_back(path);
+            return files;
+        }
+        list.seekg(0);
+        while (std::getline(list, line)) {
+            if (!line.empty() && line[0] != '#') files.push_back(line);
+        }
+        return files;
+    }
+
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        exitError("Could not open directory %s\n", path.c_str());
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        std::string file = path + "/" + entry->d_name;
+        struct stat fileStat;
+        if (stat(file.c_str(), &fileStat) == 0 && S_ISREG(fileStat.st_mode)) {
+            files.push_back(file);
+        }
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Path of the planner binary in the same directory as this program
+static std::string defaultBinary() {
+    char path[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length <= 0) return "./parallel_graphplan";
+    path[length] = 0;
+    std::string self(path);
+    return self.substr(0, self.rfind('/') + 1) + "parallel_graphplan";
+}
+
+// Reads the plan and the phase times from the output of the planner
+static void parseOutput(const std::string& output, Run& run) {
+    std::istringstream stream(output);
+    std::string line;
+    bool inPlan = false;
+    bool noPlan = false;
+    while (std::getline(stream, line)) {
+        // Skip the time stamp of the logger
+        size_t start = line.find("] ");
+        std::string text = (line[0] == '[' && start != std::string::npos) ? line.substr(start + 2) : line;
+
+        if (text == "BEGIN PLAN") {
+            inPlan = true;
+            run.planLength = 0;
+            run.planLayers = 0;
+        } else if (text == "END PLAN") {
+            inPlan = false;
+        } else if (inPlan) {
+            int layer, step;
+            if (sscanf(text.c_str(), "%d\t%d", &layer, &step) == 2) {
+                run.planLength = step;
+                run.planLayers = layer;
+            }
+        } else if (text == "No plan found") {
+            noPlan = true;
+        } else if (text.compare(0, 12, "Phase times:") == 0) {
+            for (int i = 0; i < PHASE_COUNT; i++) {
+                std::string key = std::string(getPhaseName((Phase) i)) + "=";
+                size_t pos = text.find(key);
+                if (pos != std::string::npos) {
+                    run.phaseTimes[i] = atof(text.c_str() + pos + key.size());
+                }
+            }
+        }
+    }
+
+    if (run.planLength >= 0) {
+        run.status = "solved";
+    } else if (noPlan) {
+        run.status = "no plan";
+    }
+}
+
+// Runs the planner once and fills in the result
+static void runPlanner(const std::string& binary, const std::vector<std::string>& arguments,
+        double timeout, Run& run) {
+    int pipeFds[2];
+    if (pipe(pipeFds) != 0) {
+        exitError("Could not create pipe\n");
+    }
+
+    double start = getTime();
+    pid_t pid = fork();
+    if (pid < 0) {
+        exitError("Could not start %s\n", binary.c_str());
+    }
+    if (pid == 0) {
+        // Planner process: output goes to the pipe
+        dup2(pipeFds[1], STDOUT_FILENO);
+        dup2(pipeFds[1], STDERR_FILENO);
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(binary.c_str()));
+        for (const std::string& argument : arguments) {
+            argv.push_back(const_cast<char*>(argument.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(binary.c_str(), argv.data());
+        _exit(127);
+    }
+    close(pipeFds[1]);
+
+    // Collect the output until the planner is done or the time is up
+    std::string output;
+    bool timedOut = false;
+    char buffer[65536];
+    while (true) {
+        int remaining = (int) ((timeout - (getTime() - start)) * 1000);
+        if (remaining <= 0) {
+            timedOut = true;
+            break;
+        }
+        struct pollfd pollFd = {pipeFds[0], POLLIN, 0};
+        int ready = poll(&pollFd, 1, remaining);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready <= 0) {
+            timedOut = true;
+            break;
+        }
+        ssize_t count = read(pipeFds[0], buffer, sizeof(buffer));
+        if (count <= 0) break;
+        output.append(buffer, count);
+    }
+    if (timedOut) {
+        kill(pid, SIGKILL);
+    }
+    close(pipeFds[0]);
+
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    run.wallTime = getTime() - start;
+    run.peakMemoryKB = usage.ru_maxrss;
+
+    parseOutput(output, run);
+    if (timedOut) {
+        run.status = "timeout";
+    } else if (run.status.empty() || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        run.status = "error";
+    }
+}
+
+static void writeCSV(const std::string& file, const std::vector<Run>& runs) {
+    FILE *out = fopen(file.c_str(), "w");
+    if (out == nullptr) {
+        exitError("Could not write %s\n", file.c_str());
+    }
+    fprintf(out, "instance,planner,threads,repetition,status,wall");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(out, ",%s", getPhaseName((Phase) i));
+    }
+    fprintf(out, ",peak_rss_kb,plan_length,plan_layers\n");
+    for (const Run& run : runs) {
+        fprintf(out, "%s,%s,%d,%d,%s,%.6f", run.instance.c_str(), run.planner.c_str(),
+                run.threads, run.repetition, run.status.c_str(), run.wallTime);
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            fprintf(out, ",%.6f", run.phaseTimes[i]);
+        }
+        fprintf(out, ",%ld,%d,%d\n", run.peakMemoryKB, run.planLength, run.planLayers);
+    }
+    fclose(out);
+}
+
+// Escapes a string for JSON (instance paths may contain anything)
+static std::string jsonString(const std::string& s) {
+    std::string escaped = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if ((unsigned char) c < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped + "\"";
+}
+
+static void writeJSON(const std::string& file, const std::string& binary, const std::string& extraArguments,
+        int repetitions, int warmups, double timeout, const std::vector<Run>& runs) {
+    FILE *out = fopen(file.c_str(), "w");
+    if (out == nullptr) {
+        exitError("Could not write %s\n", file.c_str());
+    }
+    fprintf(out, "{\n  \"config\": {\"binary\": %s, \"args\": %s, \"repetitions\": %d, "
+            "\"warmups\": %d, \"timeout\": %.1f},\n  \"runs\": [\n",
+            jsonString(binary).c_str(), jsonString(extraArguments).c_str(), repetitions, warmups, timeout);
+    for (size_t r = 0; r < runs.size(); r++) {
+        const Run& run = runs[r];
+        fprintf(out, "    {\"instance\": %s, \"planner\": %s, \"threads\": %d, \"repetition\": %d, "
+                "\"status\": %s, \"wall\": %.6f",
+                jsonString(run.instance).c_str(), jsonString(run.planner).c_str(), run.threads,
+                run.repetition, jsonString(run.status).c_str(), run.wallTime);
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            fprintf(out, ", \"%s\": %.6f", getPhaseName((Phase) i), run.phaseTimes[i]);
+        }
+        fprintf(out, ", \"peak_rss_kb\": %ld, \"plan_length\": %d, \"plan_layers\": %d}%s\n",
+                run.peakMemoryKB, run.planLength, run.planLayers, r + 1 < runs.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+}
+
+int main(int argc, char *argv[]) {
+    ParameterProcessor pp;
+    pp.init(argc, argv);
+
+    std::string binary = pp.getParam("bin", defaultBinary());
+    std::vector<std::string> planners = split(pp.getParam("p", "standard,satex,sppsat,lpepe"), ',');
+    std::vector<std::string> threadCounts = split(pp.getParam("t", "1,2,4"), ',');
+    int repetitions = pp.getIntParam("r", 3);
+    int warmups = pp.getIntParam("w", 1);
+    double timeout = atof(pp.getParam("timeout", "60").c_str());
+    std::string extraArguments = pp.getParam("args", "");
+    std::string csvFile = pp.getParam("csv", "");
+    std::string jsonFile = pp.getParam("json", "");
+    std::vector<std::string> instances = listInstances(pp.getFilename() ? pp.getFilename() : "data/sas");
+
+    if (access(binary.c_str(), X_OK) != 0) {
+        exitError("Planner binary %s not found (set it with -bin)\n", binary.c_str());
+    }
+
+    std::vector<Run> runs;
+    log(0, "INSTANCE\tPLANNER\tTHREADS\tREP\tSTATUS\tWALL\tRSS_KB\tLENGTH\n");
+    for (const std::string& instance : instances) {
+        for (const std::string& planner : planners) {
+            for (const std::string& threads : threadCounts) {
+                std::vector<std::string> arguments = {"-p=" + planner, "-t=" + threads, "-times"};
+                for (const std::string& argument : split(extraArguments, ' ')) {
+                    arguments.push_back(argument);
+                }
+                arguments.push_back(instance);
+
+                for (int i = -warmups; i < repetitions; i++) {
+                    Run run;
+                    run.instance = instance;
+                    run.planner = planner;
+                    run.threads = atoi(threads.c_str());
+                    run.repetition = i;
+                    runPlanner(binary, arguments, timeout, run);
+                    if (i < 0) continue;
+
+                    log(0, "%s\t%s\t%d\t%d\t%s\t%.3f\t%ld\t%d\n", instance.c_str(), planner.c_str(),
+                            run.threads, i, run.status.c_str(), run.wallTime, run.peakMemoryKB,
+                            run.planLength);
+                    runs.push_back(run);
+                }
+            }
+        }
+    }
+
+    if (!csvFile.empty()) writeCSV(csvFile, runs);
+    if (!jsonFile.empty()) writeJSON(jsonFile, binary, extraArguments, repetitions, warmups, timeout, runs);
+
+    // Median wall time of each configuration (runs that didn't finish count
+    // as the timeout)
+    log(0, "SUMMARY (median wall time)\n");
+    log(0, "INSTANCE\tPLANNER\tTHREADS\tSOLVED\tMEDIAN\n");
+    std::map<std::string, std::vector<double>> times;
+    std::map<std::string, int> solved;
+    std::vector<std::string> order;
+    for (const Run& run : runs) {
+        std::string key = run.instance + "\t" + run.planner + "\t" + std::to_string(run.threads);
+        if (!times.count(key)) order.push_back(key);
+        times[key].push_back(run.status == "timeout" ? timeout : run.wallTime);
+        solved[key] += run.status == "solved";
+    }
+    for (const std::string& key : order) {
+        std::vector<double>& values = times[key];
+        std::sort(values.begin(), values.end());
+        size_t n = values.size();
+        double median = n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+        log(0, "%s\t%d/%zu\t%.3f\n", key.c_str(), solved[key], n, median);
+    }
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * Microbenchmarks for single components of the planner.
+ *
+ * Usage: pgp_microbench [-b=parse|expand|all] [-r=<repetitions>] [-t=<threads>] [-pin] [<directory>]
+ *
+ * parse:  Parses every SAS file in the directory (default: data/sas) several
+ *         times and reports the parse throughput per file, using the given
+ *         amount of threads for the operator section (pinned to CPUs with
+ *         -pin).
+ * expand: Expands the planning graph of every SAS file up to its fixed point
+ *         with three instantiations of the expansion kernel and reports their
+ *         times: through the virtual IPlanningProblem interface, on
+ *         PlanningProblem with the branches for conditional effects and
+ *         axioms, and on PlanningProblem without them. The first two differ
+ *         only in devirtualization, the last two only in the left out
+ *         branches. The last one is skipped for problems that need the
+ *         branches.
+ *
+ * Author: Patrick Hegemann
+ */
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "Logger.h"
+#include "ParameterProcessor.h"
+#include "PlanningProblem.h"
+#include "Parser.h"
+#include "Settings.h"
+#include "Planners/Planner.h"
+
+
+Settings *settings;
+
+
+// Returns all regular files in a directory, sorted by name
+static std::vector<std::string> listFiles(const std::string& directory) {
+    std::vector<std::string> files;
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        exitError("Could not open directory %s\n", directory.c_str());
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        std::string path = directory + "/" + entry->d_name;
+        struct stat fileStat;
+        if (stat(path.c_str(), &fileStat) == 0 && S_ISREG(fileStat.st_mode)) {
+            files.push_back(path);
+        }
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Parses each file the given amount of times and reports the throughput
+static void benchParse(const std::vector<std::string>& files, int repetitions, int threads) {
+    log(0, "BENCH parse (%d threads)\n", threads);
+    log(0, "FILE\tMB\tSECONDS\tMB/S\n");
+    for (const std::string& file : files) {
+        struct stat fileStat;
+        stat(file.c_str(), &fileStat);
+        double megabytes = fileStat.st_size / (1024.0 * 1024.0);
+
+        // Take the fastest run, the others are disturbed by caches or noise
+        double best = -1;
+        for (int i = 0; i < repetitions; i++) {
+            double start = getTime();
+            SASParser parser;
+            PlanningProblem::Builder builder;
+            parser.setProblemBuilder(&builder);
+            parser.setThreadCount(threads);
+            parser.setPinThreads(settings->getPinThreads());
+            parser.parse(file.c_str());
+            double elapsed = getTime() - start;
+            if (best < 0 || elapsed < best) best = elapsed;
+        }
+
+        log(0, "%s\t%.2f\t%.4f\t%.1f\n", file.c_str(), megabytes, best, megabytes / best);
+    }
+}
+
+// Instantiations of the expansion kernel
+enum Kernel {
+    KERNEL_VIRTUAL,         // IPlanningProblem, General = true
+    KERNEL_CONCRETE,        // PlanningProblem, General = true
+    KERNEL_SPECIALIZED,     // PlanningProblem, General = false
+    KERNEL_COUNT
+};
+
+// Planner that only expands the graph with the given kernel
+class ExpansionBench : public Planner {
+    public:
+        ExpansionBench(IPlanningProblem *problem) : Planner(problem) {}
+
+        void expandToFixedPoint(Kernel kernel) {
+            PlanningProblem *concrete = static_cast<PlanningProblem*>(problem);
+            while (!fixedPoint) {
+                if (kernel == KERNEL_SPECIALIZED) {
+                    expandLayer<PlanningProblem, false>(concrete);
+                } else if (kernel == KERNEL_CONCRETE) {
+                    expandLayer<PlanningProblem, true>(concrete);
+                } else {
+                    expandLayer<IPlanningProblem, true>(problem);
+                }
+                fixedPoint = checkFixedPoint();
+            }
+        }
+};
+
+// Expands the graph of a freshly parsed problem and returns the time it took
+// (or -1 if the kernel doesn't fit the problem)
+static double timeExpansion(const std::string& file, Kernel kernel) {
+    SASParser parser;
+    PlanningProblem::Builder builder;
+    parser.setProblemBuilder(&builder);
+    IPlanningProblem *problem = parser.parse(file.c_str());
+
+    double elapsed = -1;
+    if (kernel != KERNEL_SPECIALIZED || (!problem->hasConditionalEffects() && !problem->hasAxioms())) {
+        ExpansionBench planner(problem);
+        double start = getTime();
+        planner.expandToFixedPoint(kernel);
+        elapsed = getTime() - start;
+    }
+
+    delete static_cast<PlanningProblem*>(problem);
+    return elapsed;
+}
+
+// Expands each graph the given amount of times with each kernel
+static void benchExpand(const std::vector<std::string>& files, int repetitions) {
+    log(0, "BENCH expand\n");
+    log(0, "FILE\tVIRTUAL\tCONCRETE\tSPECIALIZED\tDEVIRTUALIZATION\tSPECIALIZATION\n");
+    for (const std::string& file : files) {
+        double best[KERNEL_COUNT];
+        std::fill(best, best + KERNEL_COUNT, -1);
+        for (int i = 0; i < repetitions; i++) {
+            // The expansion logs every layer, which would dominate the time
+            setVerbosityLevel(-1);
+            for (int k = 0; k < KERNEL_COUNT; k++) {
+                double time = timeExpansion(file, (Kernel) k);
+                if (best[k] < 0 || (time >= 0 && time < best[k])) best[k] = time;
+            }
+            setVerbosityLevel(settings->getVerbosityLevel());
+        }
+
+        // Speedups of the concrete over the virtual kernel and of the
+        // specialized over the concrete one
+        if (best[KERNEL_SPECIALIZED] < 0) {
+            log(0, "%s\t%.4f\t%.4f\t-\t%.2f\t-\n", file.c_str(), best[KERNEL_VIRTUAL],
+                    best[KERNEL_CONCRETE], best[KERNEL_VIRTUAL] / best[KERNEL_CONCRETE]);
+        } else {
+            log(0, "%s\t%.4f\t%.4f\t%.4f\t%.2f\t%.2f\n", file.c_str(), best[KERNEL_VIRTUAL],
+                    best[KERNEL_CONCRETE], best[KERNEL_SPECIALIZED],
+                    best[KERNEL_VIRTUAL] / best[KERNEL_CONCRETE],
+                    best[KERNEL_CONCRETE] / best[KERNEL_SPECIALIZED]);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    ParameterProcessor pp;
+    pp.init(argc, argv);
+
+    int repetitions = pp.getIntParam("r", 5);
+    int threads = pp.getIntParam("t", 1);
+    std::string bench = pp.getParam("b", "all");
+    std::string directory = pp.getFilename() ? pp.getFilename() : "data/sas";
+    settings = new Settings(argc, argv);
+
+    std::vector<std::string> files = listFiles(directory);
+    if (bench == "parse" || bench == "all") {
+        benchParse(files, repetitions, threads);
+    }
+    if (bench == "expand" || bench == "all") {
+        benchExpand(files, repetitions);
+    }
+
+    return 0;
+}
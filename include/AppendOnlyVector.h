@@ -0,0 +1,93 @@
+#ifndef _APPEND_ONLY_VECTOR_H
+#define _APPEND_ONLY_VECTOR_H
+
+#include <atomic>
+#include <cstddef>
+
+
+/**
+ * A vector that can only grow at the end and whose elements never move in
+ * memory. Elements are stored in segments of doubling size, so appending never
+ * invalidates references to existing elements. There may be one writer that
+ * appends and any number of readers on other threads that access elements
+ * below size() without locking.
+ *
+ * Author: Patrick Hegemann
+ */
+template<typename T>
+class AppendOnlyVector {
+    public:
+        AppendOnlyVector() : count(0) {
+            for (int i = 0; i < SEGMENT_COUNT; i++) {
+                segments[i] = nullptr;
+            }
+        }
+
+        ~AppendOnlyVector() {
+            for (int i = 0; i < SEGMENT_COUNT; i++) {
+                delete[] segments[i].load(std::memory_order_relaxed);
+            }
+        }
+
+        AppendOnlyVector(const AppendOnlyVector&) = delete;
+        AppendOnlyVector& operator=(const AppendOnlyVector&) = delete;
+
+        // Appends an element. Must only be called by the writer.
+        void push_back(const T& value) {
+            size_t n = count.load(std::memory_order_relaxed);
+            int segment = segmentOf(n);
+            if (segments[segment].load(std::memory_order_relaxed) == nullptr) {
+                segments[segment].store(new T[segmentSize(segment)], std::memory_order_relaxed);
+            }
+            at(n) = value;
+            // Publish the new element
+            count.store(n + 1, std::memory_order_release);
+        }
+
+        size_t size() const {
+            return count.load(std::memory_order_acquire);
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+        T& operator[](size_t i) {
+            return at(i);
+        }
+
+        const T& operator[](size_t i) const {
+            return const_cast<AppendOnlyVector*>(this)->at(i);
+        }
+
+        T& back() {
+            return at(count.load(std::memory_order_relaxed) - 1);
+        }
+
+    private:
+        // The first segment holds BASE_SIZE elements, every following segment
+        // twice as many as the one before
+        static const size_t BASE_SIZE = 16;
+        static const int SEGMENT_COUNT = 48;
+
+        std::atomic<T*> segments[SEGMENT_COUNT];
+        std::atomic<size_t> count;
+
+        static size_t segmentSize(int segment) {
+            return BASE_SIZE << segment;
+        }
+
+        // Segment k holds the elements from BASE_SIZE*(2^k - 1) on
+        static int segmentOf(size_t i) {
+            size_t j = i / BASE_SIZE + 1;
+            return 63 - __builtin_clzll(j);
+        }
+
+        T& at(size_t i) {
+            int segment = segmentOf(i);
+            size_t offset = i - BASE_SIZE * ((((size_t) 1) << segment) - 1);
+            return segments[segment].load(std::memory_order_relaxed)[offset];
+        }
+};
+
+#endif /* _APPEND_ONLY_VECTOR_H */
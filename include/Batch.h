@@ -0,0 +1,22 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+
+/**
+ * Batch mode (-batch or -socket=path): solves many problems in one process,
+ * keeping the worker threads across problems.
+ *
+ * Each request is one line: the path of a SAS file, or "sas" followed by the
+ * SAS text and a line "end_sas". "quit" ends the batch. The result of each
+ * request is written as a single line of JSON. With -batch, requests are read
+ * from stdin and results are written to stdout, where they can be told apart
+ * from log lines by the leading "{". With -socket, a unix socket is created at
+ * the given path and each connection is served in turn.
+ *
+ * Author: Patrick Hegemann
+ */
+
+// Runs the batch until the input ends or "quit" is received
+int runBatch();
+
+#endif /* _BATCH_H */
@@ -2,10 +2,36 @@
 #define _IPLANNING_PROBLEM_H
 
 #include <list>
+#include <vector>
 #include <utility>
 #include <string>
+#include <stdexcept>
 
 #include "common.h"
+#include "LayerView.h"
+
+
+// An effect of an action that only occurs if all of its conditions hold in the
+// state the action is applied in
+struct ConditionalEffect {
+    std::list<Proposition> conditions;
+    std::list<Proposition> posEffects;
+    std::list<Proposition> negEffects;
+};
+
+// A rule that derives its head in every state in which its whole body holds
+struct Axiom {
+    std::list<Proposition> body;
+    Proposition head;
+};
+
+// A problem that can't be read, built or planned for with the chosen planner
+// and memory budget. Thrown instead of exiting, so that batch mode can go on
+// with the next problem.
+class ProblemError : public std::runtime_error {
+    public:
+        ProblemError(const std::string& message) : std::runtime_error(message) {}
+};
 
 
 /**
@@ -15,7 +41,7 @@
  */
 class IPlanningProblem {
     public:
-        //virtual ~IPlanningProblem() {}
+        virtual ~IPlanningProblem() {}
 
         // An builder interface for the planning problem class
         class Builder {
@@ -55,6 +81,15 @@ class IPlanningProblem {
                 virtual void addActionPosEffect(Action a, Proposition p) =0;
                 // Adds a negative effect to an action
                 virtual void addActionNegEffect(Action a, Proposition p) =0;
+                // Adds an effect to an action that only occurs if all conditions hold
+                virtual void addActionConditionalEffect(Action a, const std::list<Proposition>& conditions,
+                        const std::list<Proposition>& posEffects, const std::list<Proposition>& negEffects) =0;
+
+                // Marks a variable as derived, i.e. its value is determined by
+                // the axioms of the given axiom layer
+                virtual void setVariableAxiomLayer(Variable v, int layer) =0;
+                // Adds an axiom that derives the head proposition from the body
+                virtual void addAxiom(const std::list<Proposition>& body, Proposition head) =0;
         };
         
         // Gets amount of variables in this problem
@@ -78,6 +113,33 @@ class IPlanningProblem {
         virtual std::list<Proposition>& getActionNegEffects(Action a) =0;
         // Gets a list of actions that have the proposition as a positive effect
         virtual std::list<Action>& getPropPosActions(Proposition p) =0;
+        // Minimal amount of steps in which an action/proposition can contribute
+        // to the goal (INT_MAX if it is irrelevant for the goal)
+        virtual int getActionGoalDistance(Action a) =0;
+        virtual int getPropGoalDistance(Proposition p) =0;
+
+        // Conditional effects
+        // Whether any action has conditional effects
+        virtual int hasConditionalEffects() =0;
+        // Gets the conditional effects of an action
+        virtual std::vector<ConditionalEffect>& getActionConditionalEffects(Action a) =0;
+        // Gets the actions (and the index of their effect) that have the
+        // proposition as a conditional positive effect
+        virtual std::list<std::pair<Action, int>>& getPropConditionalActions(Proposition p) =0;
+
+        // Axioms
+        // Whether the problem has derived variables
+        virtual int hasAxioms() =0;
+        // Gets all axioms, ordered by axiom layer
+        virtual std::vector<Axiom>& getAxioms() =0;
+        // Gets all derived variables
+        virtual std::vector<Variable>& getDerivedVariables() =0;
+        // Whether the proposition belongs to a derived variable
+        virtual int isDerivedProposition(Proposition p) =0;
+        // Gets the value a derived variable has if no axiom derives the other one
+        virtual VariableValue getDerivedDefaultValue(Variable v) =0;
+        // Whether derived propositions depend positively on themselves
+        virtual int hasRecursiveAxioms() =0;
 
         // Gets the number of the first proposition layer
         virtual int getFirstLayer() =0;
@@ -91,6 +153,18 @@ class IPlanningProblem {
         virtual int addPropositionLayer() =0;
         // Adds a action layer to the planning graph and returns its number
         virtual int addActionLayer() =0;
+        // Marks all layers up to the last action layer as complete. Committed
+        // layers don't change anymore and may be read concurrently by other
+        // threads while the graph is expanded further.
+        virtual void commitLayers() =0;
+        // Gets the number of the last committed action layer
+        virtual int getCommittedActionLayer() =0;
+        // Marks the given proposition layer as the one where the graph has
+        // leveled off. All layers added afterwards are equal to it (and the
+        // action layer before it), so they are not stored anymore.
+        virtual void setFixedPointLayer(int layer) =0;
+        // Gets the layer where the graph has leveled off (0 if it hasn't yet)
+        virtual int getFixedPointLayer() =0;
 
         // Propositions and actions in the planning graph
         // Whether the given proposition is enabled in the given layer
@@ -105,16 +179,20 @@ class IPlanningProblem {
         // Activates the given proposition in the given layer
         virtual void activateProposition(Proposition p, int layer) =0;
 
-        // Gets a list of propositions in a given layer
-        virtual std::list<Proposition> getLayerPropositions(int layer) =0;
-        // Gets a list of actions in a given layer
-        virtual std::list<Action>& getLayerActions(int layer) =0;
+        // Gets the propositions in a given layer (in the order they were
+        // activated, without copying them)
+        virtual LayerView<Proposition> getLayerPropositions(int layer) =0;
+        // Gets the actions in a given layer
+        virtual LayerView<Action> getLayerActions(int layer) =0;
 
         // Mutex Handling
         // Checks if two propositions are mutex in a given layer
         virtual int isMutexProp(Proposition p, Proposition q, int layer) =0;
         // Checks if two actions are mutex in a given layer
         virtual int isMutexAction(Action a, Action b, int layer) =0;
+        // Gets the last layer in which two actions are mutex (INT_MAX if they
+        // are mutex in every layer)
+        virtual int getActionMutexLastLayer(Action a, Action b) =0;
         // Sets two propositions mutex in a given layer
         virtual void setMutexProp(Proposition p, Proposition q, int layer) =0;
         // Sets two actions mutex in a given layer
@@ -141,6 +219,11 @@ class IPlanningProblem {
         // Outputs the whole current planning graph
         virtual void dumpPlanningGraph() =0;
 
+        // Gets the memory used by the problem and its planning graph in bytes
+        virtual long long getMemoryUsage() =0;
+        // Logs the memory used by each part of the problem
+        virtual void printMemoryUsage() =0;
+
 };
 
 #endif /* _IPLANNING_PROBLEM_H */
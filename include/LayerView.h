@@ -0,0 +1,45 @@
+#ifndef _LAYER_VIEW_H
+#define _LAYER_VIEW_H
+
+#include <cstddef>
+
+
+/**
+ * Read-only view of the nodes of one layer in the planning graph.
+ *
+ * Layers are nested, i.e. each layer contains all nodes of the previous one,
+ * so the nodes are stored once in the order they were activated and every
+ * layer is a prefix of that array. A view only points into the array and is
+ * cheap to create and copy. The array never moves, so views of committed
+ * layers stay valid and may be used by other threads while the graph is
+ * expanded further.
+ *
+ * Author: Patrick Hegemann
+ */
+template<typename T>
+class LayerView {
+    public:
+        LayerView(const T *first, const T *last) : first(first), last(last) {}
+
+        const T* begin() const {
+            return first;
+        }
+
+        const T* end() const {
+            return last;
+        }
+
+        size_t size() const {
+            return last - first;
+        }
+
+        bool empty() const {
+            return first == last;
+        }
+
+    private:
+        const T *first;
+        const T *last;
+};
+
+#endif /* _LAYER_VIEW_H */
@@ -8,11 +8,49 @@
 #ifndef LOGGER_H_
 #define LOGGER_H_
 
+#include <stdarg.h>
+
+// Messages with a higher level than this are removed at compile time
+#ifndef PGP_MAX_LOG_LEVEL
+#define PGP_MAX_LOG_LEVEL 1000
+#endif
+
 double getTime();
 double getAbsoluteTimeLP();
 void setVerbosityLevel(int level);
-void log(int verbosityLevel, const char* fmt, ...);
-void exitError(const char* fmt, ...);
+void logMessage(int verbosityLevel, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+void logMessageV(int verbosityLevel, const char* fmt, va_list args);
+void exitError(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// With asynchronous logging, messages are formatted by the calling thread
+// and written to stdout by a background thread, so threads don't wait for
+// each other or for the output. Messages of one thread keep their order,
+// messages of different threads are ordered by their time stamps.
+void startAsyncLogging();
+void stopAsyncLogging();
+// Writes all pending messages (before writing to stdout directly)
+void flushLog();
+
+#if defined(__GNUC__) && !defined(__clang__)
+// Always inlined, so the arguments are checked like for printf and messages
+// above the limit are removed
+__attribute__((always_inline, format(printf, 2, 3)))
+inline void log(int verbosityLevel, const char* fmt, ...) {
+	if (verbosityLevel > PGP_MAX_LOG_LEVEL) return;
+	logMessage(verbosityLevel, fmt, __builtin_va_arg_pack());
+}
+#else
+// Checked like printf, but messages above the limit are only removed if the
+// call is inlined
+__attribute__((format(printf, 2, 3)))
+inline void log(int verbosityLevel, const char* fmt, ...) {
+	if (verbosityLevel > PGP_MAX_LOG_LEVEL) return;
+	va_list args;
+	va_start(args, fmt);
+	logMessageV(verbosityLevel, fmt, args);
+	va_end(args);
+}
+#endif
 
 
 #endif /* LOGGER_H_ */
@@ -0,0 +1,50 @@
+#ifndef _MEMORY_H
+#define _MEMORY_H
+
+#include <string>
+
+
+// Rough memory a SAT solver needs per clause and per literal added to it,
+// including watch lists and learnt clauses
+#define SOLVER_BYTES_PER_CLAUSE 64
+#define SOLVER_BYTES_PER_LITERAL 16
+
+
+/**
+ * Accounting of the memory used by the planning graph and the SAT solvers,
+ * and the memory budget (-mem) the planner has to stay within.
+ *
+ * The planning graph reports the exact size of its data structures. SAT
+ * solvers can't be asked, so their size is estimated from the clauses that
+ * were added to them.
+ *
+ * Author: Patrick Hegemann
+ */
+
+// Sets the memory budget in bytes (0 for no budget)
+void setMemoryBudget(long long bytes);
+long long getMemoryBudget();
+// Throws a ProblemError if an allocation of the given size can't fit into the
+// budget. Used before large allocations that would otherwise get the process
+// killed.
+void checkMemoryBudget(long long bytes, const char *what);
+
+// Adds clauses to the estimate of a solver
+void addSolverMemory(void *solver, long long clauses, long long literals);
+// Removes a solver from the accounting when it is released
+void releaseSolverMemory(void *solver);
+// Estimated memory of all solvers and amount of solvers that have clauses
+long long getSolverMemory();
+int getSolverCount();
+// Highest estimate of all solvers together, since the start or the last reset
+// (the solvers are usually released before the statistics are printed)
+long long getPeakSolverMemory();
+void resetPeakSolverMemory();
+
+// Resident memory of the whole process, as seen by the operating system
+long long getResidentMemory();
+
+// Formats an amount of bytes in KB or MB
+std::string formatMemory(long long bytes);
+
+#endif /* _MEMORY_H */
@@ -0,0 +1,124 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <atomic>
+#include <string>
+
+#include "Logger.h"
+
+
+// Counters of events in the planner. Times are counted in microseconds.
+enum Metric {
+    METRIC_LAYERS_EXPANDED,
+    METRIC_EXPAND_MICROSECONDS,
+    METRIC_MUTEX_CHECKS,
+    METRIC_NOGOOD_HITS,
+    METRIC_NOGOOD_MISSES,
+    METRIC_CLAUSES,
+    METRIC_SOLVER_CALLS,
+    METRIC_SOLVE_MICROSECONDS,
+    METRIC_QUEUED_JOBS,
+    METRIC_QUEUE_WAIT_MICROSECONDS,
+    METRIC_COUNT
+};
+
+// Counters that are kept separately for each layer of the planning graph (or
+// step of the encoding)
+enum LayerMetric {
+    LAYER_METRIC_EXPAND_MICROSECONDS,
+    LAYER_METRIC_CLAUSES,
+    LAYER_METRIC_COUNT
+};
+
+// Layers beyond this are counted in the last one
+#define METRICS_MAX_LAYERS 1024
+
+
+/**
+ * Counters of one thread. Each thread only writes its own counters, so they
+ * are updated without any locking or atomic read-modify-write; they are only
+ * atomic so that the report can read them while other threads still run.
+ * The counters of a thread are kept after it ended, until the report.
+ *
+ * With PGP_NOMETRICS defined, all counting compiles to nothing.
+ *
+ * Author: Patrick Hegemann
+ */
+struct ThreadMetrics {
+    std::atomic<long long> values[METRIC_COUNT];
+    std::atomic<long long> layerValues[LAYER_METRIC_COUNT][METRICS_MAX_LAYERS];
+};
+
+extern thread_local ThreadMetrics *threadMetrics;
+// Creates the counters of the calling thread
+ThreadMetrics* registerMetricsThread();
+
+inline void countMetric(Metric metric, long long amount = 1) {
+#ifndef PGP_NOMETRICS
+    if (!threadMetrics) threadMetrics = registerMetricsThread();
+    std::atomic<long long>& value = threadMetrics->values[metric];
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+#else
+    (void) metric;
+    (void) amount;
+#endif
+}
+
+inline void countLayerMetric(LayerMetric metric, int layer, long long amount = 1) {
+#ifndef PGP_NOMETRICS
+    if (!threadMetrics) threadMetrics = registerMetricsThread();
+    if (layer >= METRICS_MAX_LAYERS) layer = METRICS_MAX_LAYERS - 1;
+    std::atomic<long long>& value = threadMetrics->layerValues[metric][layer];
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+#else
+    (void) metric;
+    (void) layer;
+    (void) amount;
+#endif
+}
+
+// Sum of a counter over all threads
+long long getMetric(Metric metric);
+long long getLayerMetric(LayerMetric metric, int layer);
+
+// Sets the counters of all threads to zero (before the next problem of a
+// batch, while no other thread counts)
+void resetMetrics();
+// Prints the summed counters of all threads
+void printMetrics();
+// Writes the summed counters of all threads to a JSON file
+void writeMetrics(std::string file);
+
+
+/**
+ * Measures the time from its construction to its destruction and counts it
+ * (in microseconds) for the given metric.
+ */
+class MetricTimer {
+    public:
+#ifndef PGP_NOMETRICS
+        MetricTimer(Metric metric) : metric(metric), start(getTime()) {}
+
+        ~MetricTimer() {
+            countMetric(metric, elapsedMicroseconds());
+        }
+
+        long long elapsedMicroseconds() {
+            return (long long) ((getTime() - start) * 1e6);
+        }
+
+    private:
+        Metric metric;
+        double start;
+#else
+        MetricTimer(Metric metric) {
+            (void) metric;
+        }
+
+        long long elapsedMicroseconds() {
+            return 0;
+        }
+#endif
+};
+
+#endif /* _METRICS_H */
@@ -1,9 +1,15 @@
 #ifndef _PARALLELGP_H
 #define _PARALLELGP_H
 
+#include "IPlanningProblem.h"
+#include "Plan.h"
+
+IPlanningProblem* loadProblem(const char *file, int& unsolvable);
 int findPlan(IPlanningProblem *problem, Plan& plan);
 int verifyPlan(IPlanningProblem *problem, Plan plan);
-void printPlan(IPlanningProblem *problem, Plan plan);
+void printStatistics(IPlanningProblem *problem);
+// Stops the workers that were kept for the problems of a batch
+void releaseBatchPools();
 
 #endif
 
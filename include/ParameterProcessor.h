@@ -42,7 +42,8 @@ public:
 	void init(int argc, char** argv) {
 		for (int i = 1; i < argc; i++) {
 			char* arg = argv[i];
-			if (arg[0] != '-') {
+			// A single "-" is a filename (stdin)
+			if (arg[0] != '-' || arg[1] == 0) {
 				filename = arg;
 				continue;
 			}
@@ -2,15 +2,19 @@
 #define _PARSER_H
 
 #include <string>
-#include <sstream>
-#include <fstream>
 #include <vector>
 
 #include "PlanningProblem.h"
+#include "StreamBuffer.h"
 
 /**
  * Recursive descent parser for SAS as output by FastDownward translator
  *
+ * The input file is memory-mapped (or, for stdin and pipes, read into a
+ * growing stream buffer) and scanned in place. Lines and tokens are only
+ * pointers into the buffer, strings are copied only where the problem builder
+ * needs them (names). Errors in the input are thrown as ProblemError.
+ *
  * Author: Patrick Hegemann
  */
 class SASParser {
@@ -18,28 +22,47 @@ class SASParser {
         SASParser();
         IPlanningProblem* parse(const char *filename);
         void setProblemBuilder(IPlanningProblem::Builder *builder);
+        // Sets the amount of threads that decode the operator section
+        void setThreadCount(int count);
+        // Pins these threads to CPUs, grouped by NUMA node
+        void setPinThreads(bool pin);
         
     private:
         // State
         IPlanningProblem::Builder *problemBuilder;
         int countVariables;
+        int threadCount;
+        bool pinThreads;
         std::vector<int> variableDomainSizes;
         std::vector<std::string> variableNames;
 
         // I/O
-        std::ifstream file;
-        std::string curLine;    // Current line
+        const char *buffer;         // Start of the input buffer
+        const char *bufferEnd;      // End of the input that is available
+        const char *position;       // Start of the next line
+        bool endOfInput;            // Whether the last line has been read
+        int fd;
+        void *mapped;               // Mapped input file (or nullptr)
+        size_t mappedSize;
+        StreamBuffer *stream;       // Input that is still arriving (or nullptr)
+
+        const char *lineBegin;      // Current line
+        const char *lineEnd;
 
-        std::vector<std::string> lineVector;
-        unsigned int currentTokenIndex;
-        std::string curToken;   // Current token (if a line contains multiple ints)
+        const char *tokenPosition;  // Rest of the tokenized line
+        const char *tokenLineEnd;
+        const char *tokenBegin;     // Current token (if a line contains multiple ints)
+        const char *tokenEnd;
 
         // Basic Parser functions
         void nextLine();
-        void error(std::string err);
+        bool fillBuffer();
+        void closeInput();
+        // Throws a ProblemError
+        [[noreturn]] void error(std::string err);
         
-        int accept(std::string line);
-        int expect(std::string line);
+        int accept(const char *line);
+        int expect(const char *line);
 
         // Some extra parser functions
         int acceptAnyInt();
@@ -53,6 +76,9 @@ class SASParser {
         int expectIntTokenRange(int min, int max);
         int expectVarValuePair(int *variable, int *value);
 
+        // Converts the characters in [begin, end) to an integer
+        int parseInt(const char *begin, const char *end);
+
         // Sections
         void version();
         void metric();
@@ -63,8 +89,25 @@ class SASParser {
         void operators();
         void axioms();
 
+        // An operator as it is read from the file, before it is added to the
+        // problem builder
+        struct OperatorData {
+            std::string name;
+            std::vector<Proposition> precs;
+            std::vector<Proposition> posEffs;
+            std::vector<Proposition> negEffs;
+            std::vector<ConditionalEffect> condEffs;
+        };
+
         // Methods for operator details
-        void operatorEffect(int operatorNumber);
+        void operatorBlock(OperatorData& op);
+        void operatorEffect(OperatorData& op);
+        void addOperator(const OperatorData& op);
+        // Finds the start of the next operator block and skips it
+        const char* skipOperatorBlock();
+
+        // Parses an axiom (rule) block and adds it to the problem
+        void axiomBlock();
 };
 
 #endif
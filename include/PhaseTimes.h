@@ -0,0 +1,47 @@
+#ifndef _PHASE_TIMES_H
+#define _PHASE_TIMES_H
+
+#include "Logger.h"
+
+
+// Phases of planning whose time is measured
+enum Phase {
+    PHASE_PARSE,
+    PHASE_EXPAND,
+    PHASE_ENCODE,
+    PHASE_SOLVE,
+    PHASE_COUNT
+};
+
+// Adds time (in seconds) to a phase. May be called from any thread.
+void addPhaseTime(Phase phase, double seconds);
+// Total time spent in a phase. Phases that run on several threads at once
+// (e.g. encoding and solving in SPPSAT) report the sum over all threads.
+double getPhaseTime(Phase phase);
+const char* getPhaseName(Phase phase);
+// Sets the times of all phases to zero (before the next problem of a batch)
+void resetPhaseTimes();
+// Prints the times of all phases in one line (read by pgp_bench)
+void printPhaseTimes();
+
+
+/**
+ * Measures the time from its construction to its destruction and adds it to
+ * the given phase.
+ *
+ * Author: Patrick Hegemann
+ */
+class PhaseTimer {
+    public:
+        PhaseTimer(Phase phase) : phase(phase), start(getTime()) {}
+
+        ~PhaseTimer() {
+            addPhaseTime(phase, getTime() - start);
+        }
+
+    private:
+        Phase phase;
+        double start;
+};
+
+#endif /* _PHASE_TIMES_H */
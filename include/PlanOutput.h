@@ -0,0 +1,46 @@
+#ifndef _PLAN_OUTPUT_H
+#define _PLAN_OUTPUT_H
+
+#include <string>
+#include <cstdio>
+
+#include "IPlanningProblem.h"
+#include "Plan.h"
+
+
+/**
+ * Output of the found plan: to the log, and to the plan file (-plan) either
+ * as JSON with solve statistics or in the IPC plan format.
+ *
+ * Only the first emitted plan is output. With -earlyplan the parallel planners
+ * emit the plan from the worker that found it, so it is available before the
+ * remaining workers are stopped and joined. In anytime mode, every better plan
+ * is emitted as soon as it is found.
+ *
+ * Author: Patrick Hegemann
+ */
+
+// Prints the plan and writes the plan file, unless a plan was emitted before
+void emitPlan(IPlanningProblem *problem, Plan plan);
+// Outputs a plan that is better than the ones emitted before (anytime mode).
+// The plan file is replaced with each improvement.
+void emitImprovedPlan(IPlanningProblem *problem, Plan plan);
+// Writes that no plan was found to the plan file (JSON only)
+void emitNoPlan();
+// Starts the output for another problem (batch mode)
+void resetPlanOutput();
+// Whether a plan was emitted for the current problem
+bool isPlanEmitted();
+
+// Prints the plan to the log
+void printPlan(IPlanningProblem *problem, Plan plan);
+// Writes the plan (nullptr if none was found) to the given file. The file is
+// written under a temporary name first and then renamed, so readers never
+// see a partial file.
+void writePlanFile(IPlanningProblem *problem, Plan *plan, std::string file);
+
+// Write the result of a batch request as a single line of JSON
+void writePlanResult(FILE *out, const char *file, IPlanningProblem *problem, Plan *plan);
+void writeErrorResult(FILE *out, const char *file, std::string message);
+
+#endif /* _PLAN_OUTPUT_H */
@@ -0,0 +1,73 @@
+#ifndef _PLAN_POSTPROCESSOR_H
+#define _PLAN_POSTPROCESSOR_H
+
+#include <list>
+#include <vector>
+
+#include "common.h"
+#include "IPlanningProblem.h"
+#include "Plan.h"
+
+
+/**
+ * Checks found plans against the semantics of the planning problem and
+ * improves them.
+ *
+ * A plan is valid if the preconditions of all actions of a step hold in the
+ * state before the step, no two actions of a step set a variable to different
+ * values, no action of a step changes a variable that another one reads (so
+ * the actions can be executed in the order they are written) and the goal
+ * holds after the last step. Trivial actions are ignored.
+ *
+ * The SAT encoding doesn't forbid actions that aren't needed, so plans often
+ * contain some. They are removed by greedy action elimination: each action is
+ * removed together with all later actions that become inapplicable, and the
+ * removal is kept if the rest still reaches the goal. The remaining actions
+ * are then scheduled as early as possible, where an action has to come after
+ * every earlier action that writes a variable it reads or writes, or reads a
+ * variable it writes. This gives the fewest steps for the order of the plan.
+ *
+ * Author: Patrick Hegemann
+ */
+class PlanPostprocessor {
+    public:
+        PlanPostprocessor(IPlanningProblem *problem);
+
+        // Checks if the plan is valid
+        bool isValid(Plan& plan);
+        // Returns the plan without redundant actions in as few steps as
+        // possible (or the plan itself if it can't be improved)
+        Plan improve(Plan& plan);
+
+    private:
+        IPlanningProblem *problem;
+
+        // Value of each variable
+        typedef std::vector<VariableValue> State;
+        State initialState;
+        std::list<Proposition> goal;
+
+        // Variables that the values of derived variables depend on
+        std::vector<Variable> axiomVariables;
+
+        bool holds(State& state, std::list<Proposition>& propositions);
+        // Sets the derived variables according to the axioms
+        void deriveVariables(State& state);
+        // Applies an action in sequence (its precondition has to hold)
+        void apply(State& state, Action a);
+        // Checks if the actions are applicable in sequence and reach the goal
+        bool isValidSequence(std::vector<Action>& actions);
+
+        // Non-trivial actions of the plan, step by step
+        std::vector<Action> linearize(Plan& plan);
+        // Greedy action elimination. Returns which actions were removed.
+        std::vector<char> eliminateActions(std::vector<Action>& actions);
+        // Schedules the actions in as few steps as possible
+        Plan parallelize(std::vector<Action>& actions);
+        // Variables that an action reads and writes
+        void getActionVariables(Action a, std::vector<Variable>& reads, std::vector<Variable>& writes);
+        // Adds the variables of the axioms if a derived variable is read
+        void addAxiomReads(std::vector<Variable>& reads);
+};
+
+#endif /* _PLAN_POSTPROCESSOR_H */
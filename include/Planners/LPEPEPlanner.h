@@ -5,6 +5,8 @@
 #include <list>
 #include <mutex>
 #include <map>
+#include <atomic>
+#include <condition_variable>
 
 #include "common.h"
 #include "IPlanningProblem.h"
@@ -13,10 +15,28 @@
 #include "SATPriorityThreadPool.h"
 
 
-
+/**
+ * Planner class that implements the Graphplan algorithm in parallel, using a
+ * layer-pack encoding for SAT based extraction.
+ *
+ * The planning graph is expanded up to its fixed point first. Each worker then
+ * keeps one SAT solver in which the layers are encoded backwards from the
+ * goal: position 0 is the goal layer, step j is the j-th action layer before
+ * the goal. Which horizon is solved is selected with assumptions only (goal at
+ * position 0, initial state at the position of the horizon), so one solver is
+ * reused for arbitrarily many horizons. Steps are encoded in packs of
+ * packSize steps. Mutexes that hold in every layer beyond the fixed point are
+ * added as plain clauses, the others (i.e. those that change between layers)
+ * are guarded by horizon literals that activate them only for the horizons
+ * in which they hold.
+ *
+ * Author: Patrick Hegemann
+ */
 class LPEPEPlanner : public PlannerWithSATExtraction {
     public:
-        LPEPEPlanner(IPlanningProblem *problem);
+        // Uses the workers of the given pool if one is given, otherwise
+        // creates its own
+        LPEPEPlanner(IPlanningProblem *problem, SATPriorityThreadPool *pool = nullptr);
         ~LPEPEPlanner();
         int graphplan(Plan& plan);
 
@@ -25,17 +45,31 @@ class LPEPEPlanner : public PlannerWithSATExtraction {
         static void* extractionThread(void* solver, void *args);
 
     protected:
+        bool isTerminated();
+
         // A thread pool
         SATPriorityThreadPool *threadPool;
+        bool ownsThreadPool;
 
-        // Indicates which layers have been added to a solver
+        // Indicates how many steps have been added to a solver
         std::map<void*, int> solversLastLayer;
-
-        void expand();
-        void addClausesToSolver(void *solver, int actionLayer);
-        void addNewMutexesToSolver(void *solver, int actionLayer);
+        // Mutex for solversLastLayer
+        std::mutex solversLastLayerMutex;
+
+        // Adds the clauses of one step (counted from the goal) to the solver
+        void addClausesToSolver(void *solver, int step);
+        // Adds the mutexes of one step that only hold for some horizons
+        void addNewMutexesToSolver(void *solver, int step);
+        // Adds implications between horizon literals up to the given one
+        void addHorizonChainToSolver(void *solver, int from, int to);
         int extract(void* solver, std::list<Proposition> goal, int layer, Plan& plan);
 
+        // Variable numbers in the backwards encoding
+        int propositionAtPosition(Proposition p, int position);
+        int actionAtStep(Action a, int step);
+        // Literal that is true iff the horizon is at most the given one
+        int horizonAtMost(int horizon);
+
     private:
         // Struct that is given as a parameter to each thread
         struct ThreadParameters {
@@ -43,6 +77,30 @@ class LPEPEPlanner : public PlannerWithSATExtraction {
             int layer;
         };
 
+        // A pair of actions that is mutex up to (and including) lastLayer
+        struct ActionMutex {
+            Action a;
+            Action b;
+            int lastLayer;
+        };
+
+        // Actions that are enabled in the leveled-off planning graph
+        std::vector<Action> reachableActions;
+        // Mutexes that hold in every layer from the fixed point on
+        std::vector<ActionMutex> permanentMutexes;
+        // Mutexes that disappear at some layer before the fixed point
+        std::vector<ActionMutex> layeredMutexes;
+        // Propositions that are enabled in the leveled-off planning graph
+        std::list<Proposition> reachablePropositions;
+        // Last action layer of the leveled-off graph
+        int fixedActionLayer;
+
+        // Collects the graph data that the encoding is built from
+        void prepareEncoding();
+
+        // Retires a worker if the memory budget is exceeded
+        void enforceMemoryBudget();
+
         // Method for threads to signal that they solved the problem
         void markProblemSolved(Plan plan);
         // A mutex for the plan
@@ -50,17 +108,20 @@ class LPEPEPlanner : public PlannerWithSATExtraction {
         // Plan for the solved problem
         Plan solution;
         // Indicates whether the problem has been solved
-        bool problemSolved;
+        std::atomic<bool> problemSolved;
+        // Indicates whether the planner gave up because of the memory budget
+        std::atomic<bool> outOfMemory;
 
         // The last layer where extraction has failed
-        int lastFailedLayer;
+        std::atomic<int> lastFailedLayer;
         // Mutex for lastFailedLayer
         std::mutex lastFailedLayerMutex;
-
-        // Mutex for the problem/planning graph
-        std::mutex graphMutex;
+        // Amount of finished jobs, guarded by lastFailedLayerMutex. The main
+        // loop waits for it to change when all threads have work.
+        int finishedJobs = 0;
+        std::condition_variable jobFinished;
+        void notifyJobFinished();
 };
 
 
 #endif
-
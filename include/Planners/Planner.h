@@ -33,10 +33,8 @@ class Planner {
     protected:
         IPlanningProblem *problem;
 
-        // Is the fixed point reached?
+        // Is the fixed point reached? The graph then stores no further layers.
         int fixedPoint = 0;
-        // TODO: Only needed if expanding beyond fixed point
-        //int fixedMutexes = 0;
 
         // Nogoods
         // Count of nogoods per Layer
@@ -50,19 +48,60 @@ class Planner {
         int checkFixedPoint();
         // Check if the goal is unreachable or goal propositions are mutex
         int checkGoalUnreachable();
+        // Check if the planning graph, the nogoods and the SAT solvers
+        // together use more memory than the budget allows
+        int isOverMemoryBudget();
+        // Memory of the planning graph and the nogoods, without the solvers
+        long long getGraphMemory();
+
+        // Check if an action or proposition can contribute to the goal at all,
+        // or within the given amount of steps (always true with -norel)
+        int isActionRelevant(Action a);
+        int isActionRelevant(Action a, int steps);
+        int isPropRelevant(Proposition p, int steps);
+
+        // Possible interactions of actions through their conditional effects:
+        // preconditions and conditions, all positive and all negative effects
+        // (only filled if the problem has conditional effects)
+        std::vector<std::list<Proposition>> possibleReads;
+        std::vector<std::list<Proposition>> possibleAdds;
+        std::vector<std::list<Proposition>> possibleDeletes;
+        void initConditionalInteractions();
 
         // Expand the planning graph by one (action & proposition) layer
         void expand();
+        // Adds the effects of conditional effects whose conditions are present
+        void activateConditionalEffects(int prevPropLayer, int actionLayer);
+        // Adds the derived propositions of a proposition layer
+        void activateDerivedPropositions(int propLayer);
+
+        // The expansion kernel is templated on the problem class, so that the
+        // graph accesses in its inner loops are resolved at compile time and
+        // inlined for PlanningProblem. General = false leaves out everything
+        // that is only needed for conditional effects and axioms. expand()
+        // picks the fastest instantiation that fits the problem.
+        template <class Problem, bool General>
+        void expandLayer(Problem *graph);
         // Updates the action mutexes of a layer
-        void updateActionLayerMutexes(int prevPropLayer, int actionLayer);
+        template <class Problem>
+        void updateActionLayerMutexes(Problem *graph, int prevPropLayer, int actionLayer);
         // Updates the proposition mutexes of a layer
-        void updatePropLayerMutexes(int newPropLayer, int actionLayer);
+        template <class Problem, bool General>
+        void updatePropLayerMutexes(Problem *graph, int newPropLayer, int actionLayer);
         // Checks if two propositions will be mutex in the given layer
-        int checkPropsMutex(Proposition p, Proposition q, int actionLayer);
+        template <class Problem, bool General>
+        int checkPropsMutex(Problem *graph, Proposition p, Proposition q, int actionLayer);
+        // Same, including actions that provide the propositions through
+        // conditional effects
+        int checkConditionalPropsMutex(Proposition p, Proposition q, int actionLayer);
         // Checks if effects of two actions collide
-        int checkActionsMutex(Action a, Action b);
+        template <class Problem, bool General>
+        int checkActionsMutex(Problem *graph, Action a, Action b);
+        // Checks if conditional effects of two actions may collide
+        int checkConditionalActionsMutex(Action a, Action b);
         // Checks if preconditions of actions are mutex in the given layer
-        int checkActionPrecsMutex(Action a, Action b, int propLayer);
+        template <class Problem>
+        int checkActionPrecsMutex(Problem *graph, Action a, Action b, int propLayer);
 
         // Compares when two actions were added to the graph
         bool compareActionAddTime(const Action& a, const Action& b);
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <list>
+#include <mutex>
 
 #include "common.h"
 #include "IPlanningProblem.h"
@@ -13,11 +14,26 @@
 #define IPASIR_IS_SAT 10
 #define IPASIR_IS_UNSAT 20
 
+// Amount of clauses added to a solver between two termination checks
+#define TERMINATION_CHECK_INTERVAL 1024
+
 
 /**
  * Planner class that implements the Graphplan algorithm using SAT Solving for
  * the extraction step.
  *
+ * Each proposition layer has an activation literal that, if true, requires the
+ * goal to hold in that layer. Extraction only assumes this literal, so one
+ * solver can be queried for any number of layers while keeping everything it
+ * learned. If the layer is proven unreachable, the negated literal is added
+ * as a unit clause. With -anygoal the goal may be reached in any layer up to
+ * the extraction layer and the plan ends at the earliest such layer.
+ *
+ * Conditional effects get one variable per action layer that is true iff the
+ * action is applied and the conditions hold. Derived propositions are defined
+ * by the completion of their axioms (one variable per axiom and layer), which
+ * requires the axioms to be non-recursive.
+ *
  * Author: Patrick Hegemann
  */
 class PlannerWithSATExtraction : public Planner {
@@ -31,12 +47,48 @@ class PlannerWithSATExtraction : public Planner {
         int countPropositions;
         int countActions;
 
+        // Amount of variables per layer: actions, propositions, goal literals,
+        // conditional effects and axioms
+        int layerVariableCount;
+        int countConditionalEffects;
+        // Index of the first conditional effect of each action
+        std::vector<int> conditionalEffectOffset;
+        // Axioms (indices) that derive a value of each variable
+        std::vector<std::vector<int>> variableAxioms;
+        void initVariableLayout();
+
+        // Checks if the solvers aren't needed any more, e.g. because another
+        // thread found a plan. Interrupts adding clauses to a solver.
+        virtual bool isTerminated() { return false; }
+
         void expand();
         void addClausesToSolver(void *solver, int actionLayer);
-        int extract(void *solver, std::list<Proposition> goal, int layer, Plan& plan);
+        void addLayerClauses(std::vector<int>& clauses, int actionLayer);
+        void addConditionalEffectClauses(std::vector<int>& clauses, int actionLayer);
+        void addAxiomClauses(std::vector<int>& clauses, int propLayer);
+        void addVariableValueClauses(std::vector<int>& clauses, int propLayer);
+
+        // Clauses of the first layer beyond the fixed point, which all later
+        // layers share (with shifted variables)
+        std::mutex leveledClausesMutex;
+        int leveledClauseLayer = 0;
+        std::vector<int> leveledClauses;
+        // Extracts a plan with the goal in the given layer. An additional
+        // literal can be assumed, e.g. to bound the amount of actions; then
+        // a failed extraction doesn't rule out the layer.
+        int extract(void *solver, int layer, Plan& plan, int assumption = 0);
         
         int propositionAtLayer(Proposition p, int layer);
         int actionAtLayer(Action a, int layer);
+        // Literal that activates the goal in the given proposition layer
+        int goalAtLayer(int layer);
+        // Literal that activates the goal in some proposition layer up to
+        // the given one
+        int goalUpToLayer(int layer);
+        // Literal of a conditional effect occurring in the given action layer
+        int effectAtLayer(Action a, int effect, int layer);
+        // Literal of an axiom firing in the given proposition layer
+        int axiomAtLayer(int axiom, int layer);
 
         // Offset of the horizon (i.e. the layer that is reached before the
         // main loop is started)
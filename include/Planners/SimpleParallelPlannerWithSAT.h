@@ -5,6 +5,9 @@
 #include <list>
 #include <mutex>
 #include <map>
+#include <set>
+#include <atomic>
+#include <condition_variable>
 
 #include "common.h"
 #include "IPlanningProblem.h"
@@ -13,16 +16,28 @@
 #include "SATSolverThreadPool.h"
 
 
+// Largest sequential counter (actions times bound) used to minimize the
+// actions of a plan
+#define MINIMIZATION_MAX_COUNTER_VARIABLES 50000000LL
+
 
 /**
  * Planner class that implements the Graphplan algorithm in parallel, using SAT
  * Solving for the extraction step.
  *
+ * In anytime mode (-anytime) the planner goes on after the first plan: the
+ * layers below it that were skipped by the horizon are solved to find plans
+ * with fewer layers, and then the amount of actions at the shortest layer is
+ * minimized with a cardinality constraint. Each better plan is output as soon
+ * as it is found. -deadline ends the search after the given time.
+ *
  * Author: Patrick Hegemann
  */
 class SimpleParallelPlannerWithSAT : public PlannerWithSATExtraction {
     public:
-        SimpleParallelPlannerWithSAT(IPlanningProblem *problem);
+        // Uses the workers of the given pool if one is given, otherwise
+        // creates its own
+        SimpleParallelPlannerWithSAT(IPlanningProblem *problem, SATSolverThreadPool *pool = nullptr);
         ~SimpleParallelPlannerWithSAT();
         int graphplan(Plan& plan);
 
@@ -31,39 +46,80 @@ class SimpleParallelPlannerWithSAT : public PlannerWithSATExtraction {
         static void* extractionThread(void* solver, void *args);
 
     protected:
+        bool isTerminated();
+
         // A thread pool
         SATSolverThreadPool *threadPool;
+        bool ownsThreadPool;
 
         // Indicates which layers have been added to a solver
         std::map<void*, int> solversLastLayer;
-
-        void expand();
-        void addClausesToSolver(void *solver, int actionLayer);
-        //int extract(void* solver, std::list<Proposition> goal, int layer, Plan& plan);
+        // First unused variable of each solver (after the minimization
+        // counters), guarded by solversLastLayerMutex
+        std::map<void*, int> solversFreeVariable;
+        // Mutex for solversLastLayer
+        std::mutex solversLastLayerMutex;
+
+        // Adds the clauses up to the given action layer to a solver. Returns
+        // false if the planner was terminated meanwhile.
+        int addLayersToSolver(void *solver, int layer);
+
+        // Anytime mode: searches for better plans after the first one
+        void improvePlan(std::set<int>& queuedLayers);
+        // Minimizes the amount of actions of a plan in the given layer
+        void minimizeActions(void *solver, int layer);
+        // Amount of non-trivial actions in a plan
+        int countPlanActions(Plan& plan);
+        // Checks if the deadline (-deadline) has passed
+        bool isDeadlineReached();
+        // Time at which the search ends (0 for none)
+        double deadlineTime;
 
     private:
         // Struct that is given as a parameter to each thread
         struct ThreadParameters {
             SimpleParallelPlannerWithSAT *planner;
             int layer;
+            bool minimize;      // Minimize the actions instead of extracting
         };
 
-        // Method for threads to signal that they solved the problem
-        void markProblemSolved(Plan plan);
+        // Queues a job for the given layer
+        void queueJob(int layer, bool minimize);
+
+        // Retires a worker if the memory budget is exceeded
+        void enforceMemoryBudget();
+
+        // Method for threads to signal that they found a plan in the given
+        // layer. In anytime mode, the plan replaces the solution if it is
+        // better.
+        void markProblemSolved(Plan plan, int layer);
         // A mutex for the plan
         std::mutex solvedMutex;
         // Plan for the solved problem
         Plan solution;
         // Indicates whether the problem has been solved
-        bool problemSolved;
+        std::atomic<bool> problemSolved;
+        // Layer and amount of actions of the best plan so far
+        std::atomic<int> bestLayer;
+        int bestActionCount;
+        // Indicates whether the anytime search is over (deadline or optimal)
+        std::atomic<bool> anytimeStopped;
+        // Indicates whether the action minimization has finished
+        std::atomic<bool> minimizationDone;
+        // Indicates whether the planner gave up because of the memory budget
+        std::atomic<bool> outOfMemory;
 
         // The last layer where extraction has failed
-        int lastFailedLayer;
+        std::atomic<int> lastFailedLayer;
         // Mutex for lastFailedLayer
         std::mutex lastFailedLayerMutex;
-
-        // Mutex for the problem/planning graph
-        std::mutex graphMutex;
+        // Amount of finished jobs, guarded by lastFailedLayerMutex. The main
+        // loop waits for it to change when all threads have work.
+        int finishedJobs = 0;
+        std::condition_variable jobFinished;
+        void notifyJobFinished();
+        // Waits for a job to finish (or a timeout)
+        void waitForJob(int seenFinishedJobs);
 };
 
 
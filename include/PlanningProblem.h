@@ -6,19 +6,29 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <atomic>
+#include <climits>
+#include <algorithm>
 
 #include "IPlanningProblem.h"
+#include "AppendOnlyVector.h"
 
 
 /**
  * Class representing a planning problem instance and its planning graph
  *
+ * The class is final and its accessors for the graph are defined inline
+ * below, so that the planner kernels, which are instantiated for this class,
+ * don't pay for virtual calls in their inner loops.
+ *
  * Author: Patrick Hegemann
  */
-class PlanningProblem : public IPlanningProblem {
+class PlanningProblem final : public IPlanningProblem {
     public:
         class Builder;
 
+        ~PlanningProblem();
+
         int getVariableCount();
         int getActionCount();
         int getPropositionCount();
@@ -31,6 +41,19 @@ class PlanningProblem : public IPlanningProblem {
         std::list<Proposition>& getActionPosEffects(Action a);
         std::list<Proposition>& getActionNegEffects(Action a);
         std::list<Action>& getPropPosActions(Proposition p);
+        int getActionGoalDistance(Action a);
+        int getPropGoalDistance(Proposition p);
+
+        int hasConditionalEffects();
+        std::vector<ConditionalEffect>& getActionConditionalEffects(Action a);
+        std::list<std::pair<Action, int>>& getPropConditionalActions(Proposition p);
+
+        int hasAxioms();
+        std::vector<Axiom>& getAxioms();
+        std::vector<Variable>& getDerivedVariables();
+        int isDerivedProposition(Proposition p);
+        VariableValue getDerivedDefaultValue(Variable v);
+        int hasRecursiveAxioms();
         
         int getFirstLayer();
         int getLastLayer();
@@ -38,6 +61,10 @@ class PlanningProblem : public IPlanningProblem {
         int getLastActionLayer();
         int addPropositionLayer();
         int addActionLayer();
+        void commitLayers();
+        int getCommittedActionLayer();
+        void setFixedPointLayer(int layer);
+        int getFixedPointLayer();
 
         // Propositions and actions in the planning graph
         int isPropEnabled(Proposition p, int layer);
@@ -47,12 +74,13 @@ class PlanningProblem : public IPlanningProblem {
         void activateAction(Action a, int layer);
         void activateProposition(Proposition p, int layer);
 
-        std::list<Proposition> getLayerPropositions(int layer);
-        std::list<Action>& getLayerActions(int layer);
+        LayerView<Proposition> getLayerPropositions(int layer);
+        LayerView<Action> getLayerActions(int layer);
 
         // Mutex Handling
         int isMutexProp(Proposition p, Proposition q, int layer);
         int isMutexAction(Action a, Action b, int layer);
+        int getActionMutexLastLayer(Action a, Action b);
         void setMutexProp(Proposition p, Proposition q, int layer);
         void setMutexAction(Action a, Action b, int layer);
         int getPropMutexCount(int layer);
@@ -68,6 +96,9 @@ class PlanningProblem : public IPlanningProblem {
 
         void dumpPlanningGraph();
 
+        long long getMemoryUsage();
+        void printMemoryUsage();
+
     private:
         // Amount of variables in the problem
         int countVariables;
@@ -87,19 +118,62 @@ class PlanningProblem : public IPlanningProblem {
         std::vector<std::list<Proposition>> actionPosEffs;
         std::vector<std::list<Proposition>> actionNegEffs;
 
-        // Positive effect edges from positive effects to actions
-        // This is needed when determining proposition mutexes
-        std::map<Proposition, std::list<Action>> propPosActions;
+        // Positive effect edges from positive effects to actions, indexed by
+        // proposition number. This is needed when determining proposition mutexes
+        std::vector<std::list<Action>> propPosActions;
+
+        // Conditional effects of each action and, indexed by proposition number,
+        // the actions with a conditional effect that adds the proposition
+        int countConditionalEffects = 0;
+        std::vector<std::vector<ConditionalEffect>> actionCondEffs;
+        std::vector<std::list<std::pair<Action, int>>> propCondActions;
+
+        // Axioms and derived variables. Every derived variable is binary, its
+        // default value holds unless an axiom derives the other value.
+        std::vector<Axiom> axioms;
+        std::vector<Variable> derivedVariables;
+        // Axiom layer of each variable (-1 if the variable is not derived)
+        std::vector<int> variableAxiomLayer;
+        std::vector<VariableValue> derivedDefaultValue;
+        int recursiveAxioms = 0;
+        // Evaluates the axioms in the initial state
+        std::list<Proposition> evaluateAxioms(std::vector<VariableValue> state);
+        // Checks if a derived proposition depends positively on itself
+        int checkRecursiveAxioms();
+
+        // Backward relevance: the minimal amount of steps in which an action
+        // (proposition, indexed by number) can contribute to the goal
+        std::vector<int> actionGoalDistance;
+        std::vector<int> propGoalDistance;
+        // Computes the goal distances, starting from the goal propositions
+        void computeGoalDistances();
 
         // Number of last proposition layer
         int lastPropLayer;
         // Number of last action layer
         int lastActionLayer;
+        // Number of the last action layer that is complete and will not change
+        // anymore. Readers on other threads may access all layers up to here.
+        std::atomic<int> committedActionLayer;
+
+        // Layer where the graph has leveled off (0 if it hasn't yet). Later
+        // layers aren't stored, accesses to them go to the last stored layers.
+        std::atomic<int> fixedPointLayer{0};
+        std::atomic<int> storedPropLayerLimit{INT_MAX};
+        std::atomic<int> storedActionLayerLimit{INT_MAX};
+        int storedPropLayer(int layer) {
+            return std::min(layer, storedPropLayerLimit.load(std::memory_order_relaxed));
+        }
+        int storedActionLayer(int layer) {
+            return std::min(layer, storedActionLayerLimit.load(std::memory_order_relaxed));
+        }
 
         // Mutexes, here implemented as matrixes. The matrix entries specify the
-        // *last* layer in which the propositions/actions are mutex with each other
-        int *propMutexes;
-        int *actionMutexes;
+        // *last* layer in which the propositions/actions are mutex with each other.
+        // Entries are atomic so that they can be read while the graph is expanded;
+        // for a committed layer the result of a mutex check never changes.
+        std::atomic<int> *propMutexes = nullptr;
+        std::atomic<int> *actionMutexes = nullptr;
 
         // Each proposition needs to have a unique number that can be used to check
         // mutexes. Each variable has its "starting number", that the value of the
@@ -109,27 +183,30 @@ class PlanningProblem : public IPlanningProblem {
         std::vector<int> variableMutexIndex;
 
         // Arrays that indicate in which layer a proposition/action first shows up
-        std::map<Proposition, int> propFirstLayer;
-        std::vector<int> actionFirstLayer;
+        // (propositions are indexed by their number)
+        std::atomic<int> *propFirstLayer = nullptr;
+        std::atomic<int> *actionFirstLayer = nullptr;
 
-        // Arrays that store propositions/actions that are already used in some layer
+        // Arrays that store propositions/actions that are already used in some layer.
+        // Both are allocated in full size up front, so they never move in memory.
         std::vector<Proposition> layerProps;
         std::vector<Action> layerActions;
 
-        std::vector<std::list<Action>> layerActionsLists;
-
         // Lists that hold an index for each layer, indicating the point up to which a
         // layer contains propositions/actions from the layerProps/layerActions arrays
-        std::vector<int> lastPropIndices;
-        std::vector<int> lastActionIndices;
+        AppendOnlyVector<int> lastPropIndices;
+        AppendOnlyVector<int> lastActionIndices;
 
         // Array indicating the amount of proposition mutexes in each proposition layer
         // for calculating if a fixed-point level is reached
-        std::vector<int> layerPropMutexCount;
+        AppendOnlyVector<int> layerPropMutexCount;
 
         // Names
         std::vector<std::string> actionNames;
         std::map<Proposition, std::string> propNames;
+
+        // Memory used by each part of the problem
+        std::vector<std::pair<std::string, long long>> getMemoryParts();
 };
 
 
@@ -137,7 +214,8 @@ class PlanningProblem : public IPlanningProblem {
 class PlanningProblem::Builder : public IPlanningProblem::Builder {
     public:
         Builder();
-        ~Builder() {}
+        // Deletes the problem if it wasn't built
+        ~Builder() { delete problem; }
         PlanningProblem* build();
         void setVariableCount(int count);
         Variable addVariable();
@@ -154,9 +232,18 @@ class PlanningProblem::Builder : public IPlanningProblem::Builder {
         void addActionPrecondition(Action a, Proposition p);
         void addActionPosEffect(Action a, Proposition p);
         void addActionNegEffect(Action a, Proposition p);
+        void addActionConditionalEffect(Action a, const std::list<Proposition>& conditions,
+                const std::list<Proposition>& posEffects, const std::list<Proposition>& negEffects);
+
+        void setVariableAxiomLayer(Variable v, int layer);
+        void addAxiom(const std::list<Proposition>& body, Proposition head);
 
     private:
         PlanningProblem* problem;
+        // Initial values of derived variables, which only become part of the
+        // initial layer once the axioms have been evaluated
+        std::vector<Proposition> derivedInitialValues;
+        void finalizeAxioms();
         int nextVariable = 0;
         int nextAction = 0;
 
@@ -165,4 +252,131 @@ class PlanningProblem::Builder : public IPlanningProblem::Builder {
 };
 
 
+// Inline accessors
+
+inline int PlanningProblem::getActionCount() {
+    return countActions;
+}
+
+inline int PlanningProblem::getPropositionCount() {
+    return totalPropositionCount;
+}
+
+inline int PlanningProblem::getPropositionNumber(Proposition p) {
+    return variableMutexIndex[p.first] + p.second;
+}
+
+inline std::list<Proposition>& PlanningProblem::getActionPreconditions(Action a) {
+    return actionPrecs[a];
+}
+
+inline std::list<Proposition>& PlanningProblem::getActionPosEffects(Action a) {
+    return actionPosEffs[a];
+}
+
+inline std::list<Proposition>& PlanningProblem::getActionNegEffects(Action a) {
+    return actionNegEffs[a];
+}
+
+inline std::list<Action>& PlanningProblem::getPropPosActions(Proposition p) {
+    return propPosActions[getPropositionNumber(p)];
+}
+
+inline int PlanningProblem::getActionGoalDistance(Action a) {
+    return actionGoalDistance[a];
+}
+
+inline int PlanningProblem::getPropGoalDistance(Proposition p) {
+    return propGoalDistance[getPropositionNumber(p)];
+}
+
+inline int PlanningProblem::hasConditionalEffects() {
+    return countConditionalEffects > 0;
+}
+
+inline int PlanningProblem::hasAxioms() {
+    return !derivedVariables.empty();
+}
+
+inline int PlanningProblem::isDerivedProposition(Proposition p) {
+    return variableAxiomLayer[p.first] != -1;
+}
+
+inline int PlanningProblem::getFirstLayer() {
+    return 1;
+}
+
+inline int PlanningProblem::getLastLayer() {
+    return lastPropLayer;
+}
+
+inline int PlanningProblem::getFirstActionLayer() {
+    return 1;
+}
+
+inline int PlanningProblem::getLastActionLayer() {
+    return lastActionLayer;
+}
+
+inline int PlanningProblem::isPropEnabled(Proposition p, int layer) {
+    int first = propFirstLayer[getPropositionNumber(p)].load(std::memory_order_relaxed);
+    return (first <= layer && first > 0);
+}
+
+inline int PlanningProblem::isActionEnabled(Action a, int layer) {
+    int first = actionFirstLayer[a].load(std::memory_order_relaxed);
+    return (first <= layer && first > 0);
+}
+
+inline int PlanningProblem::getActionFirstLayer(Action a) {
+    return actionFirstLayer[a].load(std::memory_order_relaxed);
+}
+
+inline LayerView<Proposition> PlanningProblem::getLayerPropositions(int layer) {
+    // + 1 because the last proposition needs to be included here
+    const Proposition *first = layerProps.data();
+    return LayerView<Proposition>(first, first + lastPropIndices[storedPropLayer(layer)] + 1);
+}
+
+inline LayerView<Action> PlanningProblem::getLayerActions(int layer) {
+    const Action *first = layerActions.data();
+    return LayerView<Action>(first, first + lastActionIndices[storedActionLayer(layer)] + 1);
+}
+
+inline int PlanningProblem::isMutexProp(Proposition p, Proposition q, int layer) {
+    int pMutexNumber = variableMutexIndex[p.first]+p.second;
+    int qMutexNumber = variableMutexIndex[q.first]+q.second;
+    if (p == q) return false;
+    return (propMutexes[pMutexNumber*totalPropositionCount + qMutexNumber].load(std::memory_order_relaxed) >= storedPropLayer(layer) ||
+        p.first == q.first);
+}
+
+inline int PlanningProblem::isMutexAction(Action a, Action b, int layer) {
+    if (a == b) return false;
+    return actionMutexes[a*countActions + b].load(std::memory_order_relaxed) >= storedActionLayer(layer);
+}
+
+inline void PlanningProblem::setMutexAction(Action a, Action b, int layer) {
+    if (a == b) return;
+    actionMutexes[a*countActions + b].store(layer, std::memory_order_relaxed);
+    actionMutexes[b*countActions + a].store(layer, std::memory_order_relaxed);
+}
+
+inline int PlanningProblem::isTrivialAction(Action a) {
+    return (a < totalPropositionCount);
+}
+
+inline int PlanningProblem::getPropLayerAfterActionLayer(int actionLayer) {
+    return actionLayer + 1;
+}
+
+inline int PlanningProblem::getActionLayerBeforePropLayer(int propLayer) {
+    return propLayer - 1;
+}
+
+inline int PlanningProblem::getPropLayerBeforeActionLayer(int actionLayer) {
+    return actionLayer;
+}
+
+
 #endif /* _PLANNING_PROBLEM_H */
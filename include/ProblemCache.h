@@ -0,0 +1,112 @@
+#ifndef _PROBLEM_CACHE_H
+#define _PROBLEM_CACHE_H
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "IPlanningProblem.h"
+
+
+/**
+ * Binary cache of a parsed planning problem.
+ *
+ * While a SAS file is parsed, a recording builder stores all calls to the
+ * actual problem builder. These are written to the cache file as flat arrays
+ * (preconditions and effects in CSR form, i.e. one offset array per kind and
+ * one array holding the propositions of all actions). Conditional effects and
+ * axioms, which most problems don't have, are stored as plain records. Later runs map the
+ * cache file and replay it through the builder without any parsing. A cache
+ * is only used if it has the right version and was written for a source file
+ * of the same size and modification time.
+ *
+ * Author: Patrick Hegemann
+ */
+class ProblemCache {
+    public:
+        ProblemCache(std::string cacheFile, std::string sourceFile);
+        ~ProblemCache();
+
+        // Builds the problem from the cache file if it is valid for the source
+        // file. Returns nullptr if it isn't.
+        IPlanningProblem* load(IPlanningProblem::Builder *builder);
+
+        // Returns a builder that forwards every call to the given builder and
+        // records it, so the problem can be written with write() afterwards
+        IPlanningProblem::Builder* record(IPlanningProblem::Builder *builder);
+
+        // Writes the recorded problem to the cache file
+        void write();
+
+    private:
+        class Recorder;
+
+        std::string cacheFile;
+        std::string sourceFile;
+        Recorder *recorder;
+
+        // Identification of the source file
+        long long sourceSize;
+        long long sourceModificationTime;
+        void readSourceStat();
+};
+
+
+/**
+ * Builder that forwards every call to another builder and keeps a copy of
+ * the problem data.
+ */
+class ProblemCache::Recorder : public IPlanningProblem::Builder {
+    public:
+        Recorder(IPlanningProblem::Builder *builder);
+        ~Recorder() {}
+        IPlanningProblem* build();
+        void setVariableCount(int count);
+        Variable addVariable();
+        void setVariableDomainSize(Variable v, int size);
+        void setPropositionName(Proposition p, std::string name);
+        void finalizeVariables();
+        void setGlobalPropMutex(Proposition p, Proposition q);
+        void addIntialProposition(Proposition p);
+        void addGoalProposition(Proposition p);
+
+        void setActionCount(int count);
+        Action addAction();
+        void setActionName(Action a, std::string name);
+        void addActionPrecondition(Action a, Proposition p);
+        void addActionPosEffect(Action a, Proposition p);
+        void addActionNegEffect(Action a, Proposition p);
+        void addActionConditionalEffect(Action a, const std::list<Proposition>& conditions,
+                const std::list<Proposition>& posEffects, const std::list<Proposition>& negEffects);
+
+        void setVariableAxiomLayer(Variable v, int layer);
+        void addAxiom(const std::list<Proposition>& body, Proposition head);
+
+    private:
+        friend class ProblemCache;
+
+        IPlanningProblem::Builder *builder;
+
+        std::vector<int> domainSizes;
+        std::vector<int> axiomLayers;
+        std::vector<Proposition> propositions;
+        std::vector<std::string> propositionNames;
+        std::vector<Proposition> mutexes;
+        std::vector<Proposition> initialState;
+        std::vector<Proposition> goal;
+
+        std::vector<std::string> actionNames;
+        // Start of each action's propositions in the arrays below
+        std::vector<int> precOffsets;
+        std::vector<int> posOffsets;
+        std::vector<int> negOffsets;
+        std::vector<Proposition> precs;
+        std::vector<Proposition> posEffs;
+        std::vector<Proposition> negEffs;
+
+        std::vector<Action> condEffActions;
+        std::vector<ConditionalEffect> condEffs;
+        std::vector<Axiom> axioms;
+};
+
+#endif /* _PROBLEM_CACHE_H */
@@ -0,0 +1,121 @@
+#ifndef _PROBLEM_SIMPLIFIER_H
+#define _PROBLEM_SIMPLIFIER_H
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "IPlanningProblem.h"
+
+
+/**
+ * Builder that collects a parsed problem, reduces it and passes the reduced
+ * problem on to the actual problem builder.
+ *
+ * The reductions are based on a relaxed reachability analysis from the
+ * initial state:
+ *  - Actions that can never be applied are removed, as well as actions that
+ *    change nothing or are exact duplicates of another action.
+ *  - Values of a variable that can never be reached are removed.
+ *  - Variables that never change their initial value (and are not part of
+ *    the goal) are removed together with all conditions on them.
+ * Additionally, pairs of propositions that can't hold at the same time
+ * according to the h^2 heuristic are made global mutexes.
+ *
+ * Problems with conditional effects or axioms are passed on unchanged.
+ *
+ * The same analyses show early if a problem is unsolvable: if the goal isn't
+ * relaxed reachable or if goal propositions are h^2 mutex, there is no plan
+ * and the planning graph doesn't have to be leveled to find that out.
+ *
+ * Author: Patrick Hegemann
+ */
+class ProblemSimplifier : public IPlanningProblem::Builder {
+    public:
+        ProblemSimplifier(IPlanningProblem::Builder *builder);
+        ~ProblemSimplifier() {}
+        IPlanningProblem* build();
+        void setVariableCount(int count);
+        Variable addVariable();
+        void setVariableDomainSize(Variable v, int size);
+        void setPropositionName(Proposition p, std::string name);
+        void finalizeVariables();
+        void setGlobalPropMutex(Proposition p, Proposition q);
+        void addIntialProposition(Proposition p);
+        void addGoalProposition(Proposition p);
+
+        void setActionCount(int count);
+        Action addAction();
+        void setActionName(Action a, std::string name);
+        void addActionPrecondition(Action a, Proposition p);
+        void addActionPosEffect(Action a, Proposition p);
+        void addActionNegEffect(Action a, Proposition p);
+        void addActionConditionalEffect(Action a, const std::list<Proposition>& conditions,
+                const std::list<Proposition>& posEffects, const std::list<Proposition>& negEffects);
+
+        void setVariableAxiomLayer(Variable v, int layer);
+        void addAxiom(const std::list<Proposition>& body, Proposition head);
+
+        // Whether the built problem was found to have no plan
+        bool isUnsolvable() {
+            return unsolvable;
+        }
+
+    private:
+        IPlanningProblem::Builder *builder;
+
+        // Collected problem
+        std::vector<int> axiomLayers;
+        std::vector<std::vector<std::string>> propositionNames;
+        // Offset of each variable's first value in the proposition numbering
+        std::vector<int> propositionOffsets;
+        int propositionCount = 0;
+        std::vector<std::pair<Proposition, Proposition>> mutexes;
+        std::vector<Proposition> initialState;
+        std::vector<Proposition> goal;
+
+        std::vector<std::string> actionNames;
+        std::vector<std::vector<Proposition>> actionPrecs;
+        std::vector<std::vector<Proposition>> actionPosEffs;
+        std::vector<std::vector<Proposition>> actionNegEffs;
+        std::vector<std::pair<Action, ConditionalEffect>> condEffs;
+        std::vector<Axiom> axioms;
+
+        // Result of the reductions: new variable of each variable, new value
+        // of each proposition (both -1 if removed) and kept actions
+        std::vector<Variable> variableMap;
+        std::vector<std::vector<VariableValue>> valueMap;
+        std::vector<char> keepAction;
+        // Pairs of propositions (by number) that were found to be mutex
+        std::vector<std::pair<int, int>> h2Mutexes;
+        bool unsolvable = false;
+
+        int getPropositionNumber(Proposition p) {
+            return propositionOffsets[p.first] + p.second;
+        }
+
+        // Keeps the whole problem as it is
+        void keepAll();
+        // Computes which propositions and actions are reachable (values of
+        // derived variables are all taken as reachable). Returns false if the
+        // goal isn't reachable.
+        bool computeReachability(std::vector<char>& reachable);
+        // Removes variables whose only reachable value is the initial one
+        void removeStaticVariables(const std::vector<char>& reachable);
+        // Removes actions without effect and duplicates of other actions
+        int removeUselessActions();
+        // Computes pairs of propositions that are unreachable under h^2.
+        // Returns false if the goal isn't reachable.
+        bool computeH2Mutexes(const std::vector<char>& reachable);
+        // Passes the reduced problem on to the builder
+        void replay();
+
+        Proposition map(Proposition p) {
+            return Proposition(variableMap[p.first], valueMap[p.first][p.second]);
+        }
+        bool isKept(Proposition p) {
+            return variableMap[p.first] >= 0 && valueMap[p.first][p.second] >= 0;
+        }
+};
+
+#endif /* _PROBLEM_SIMPLIFIER_H */
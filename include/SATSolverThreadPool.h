@@ -30,6 +30,7 @@ class SATSolverThreadPool {
         struct WorkerThreadArguments {
             SATSolverThreadPool* pool;  // Reference to the thread pool
             int tag;                    // This thread's tag
+            int index;                  // Number of this worker in its tag
             void* solver;               // Reference to the SAT solver
         };
 
@@ -39,11 +40,27 @@ class SATSolverThreadPool {
             // Second argument is the arguments member of this struct.
             void*(*func)(void*, void*);
             void* arguments;               // Arguments for the function
+            double enqueueTime = 0;        // Set by the pool, for metrics
         };
 
         void enqueueJob(int tag, Job job);
         bool isDone();
 
+        // Limits the amount of workers of a tag that take jobs. Workers
+        // beyond the limit stop after their current job and release their
+        // SAT solver, e.g. to save memory.
+        void setWorkerLimit(int tag, int limit);
+        int getWorkerLimit(int tag);
+        // Amount of workers of a tag that haven't released their SAT solver
+        int getRunningWorkerCount(int tag);
+
+        // Waits until all jobs of a tag are done
+        void waitIdle(int tag);
+        // Replaces the SAT solvers of all workers of a tag with new ones, so
+        // the workers can be reused for another problem. The tag has to be
+        // idle.
+        void resetSolvers(int tag, void*(*solverInit)(void*), void *initArgs);
+
     private:
         // Amount of tags in this pool
         int tagCount;
@@ -51,6 +68,14 @@ class SATSolverThreadPool {
         // A vector of vectors of worker threads
         // One vector for each tag
         std::vector<std::vector<std::thread>> workers;
+        // Arguments of all workers of each tag
+        std::vector<std::vector<WorkerThreadArguments*>> workerArgs;
+        // Amount of workers of each tag that may take jobs
+        std::vector<int> workerLimits;
+        // Amount of workers of each tag that are running a job
+        std::vector<int> busyWorkers;
+        // Amount of workers of each tag that stopped and released their solver
+        std::vector<int> releasedWorkers;
         // A queue for jobs of each tag
         std::vector<std::queue<Job>> jobs;
 
@@ -58,12 +83,15 @@ class SATSolverThreadPool {
         std::mutex **queueMutexes;
         // Condition variables that are used to notify workers
         std::condition_variable **queueConditions;
+        // Condition variables that are used to notify waitIdle
+        std::condition_variable **idleConditions;
 
         // Indicates whether the pool was force stopped
         bool stopped;
 
         static void* workerThread(void *args);
-        Job* getNextJob(int tag);
+        Job* getNextJob(int tag, int index);
+        void finishJob(int tag);
 };
 
 #endif
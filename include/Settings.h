@@ -12,21 +12,55 @@
 #define HORIZON_LINEAR 1
 #define HORIZON_EXPONENTIAL 2
 
+#define PLAN_FORMAT_IPC 1
+#define PLAN_FORMAT_JSON 2
+
 
 class Settings {
     private:
         int verbosityLevel;
+        int asyncLogging;
         const char *inputFile;
+        std::string cacheFile;
         int dumpPlanningGraph = 0;
 
+        std::string planFile;
+        int planFormat;
+        int earlyPlan;
+        int fastExit;
+
+        int anytime;
+        double deadline;
+
+        int batchMode;
+        std::string socketPath;
+
         std::string plannerName;
         int threadCount;
+        int pinThreads;
+
+        int memoryBudget;
 
         int horizonType;
         double horizonFactor;
 
         int layerPackSize;
 
+        int anyGoalLayer;
+
+        int relevancePruning;
+
+        int simplification;
+
+        int postprocessing;
+
+        int phaseTimes;
+
+        int metrics;
+        std::string metricsFile;
+
+        std::string traceFile;
+
     public:
         Settings();
         Settings(int argc, char **argv) {
@@ -34,11 +68,45 @@ class Settings {
             pp.init(argc, argv);
 
             inputFile = pp.getFilename();
+            cacheFile = pp.getParam("cache", "");
             verbosityLevel = pp.getIntParam("v", 0);
+            asyncLogging = pp.isSet("asynclog");
             dumpPlanningGraph = pp.isSet("dump");
 
+            // Write the plan to this file, as JSON if it ends with .json or
+            // if -planformat=json is given, otherwise in the IPC format
+            planFile = pp.getParam("plan", "");
+            std::string pf = pp.getParam("planformat", "");
+            if (pf == "json" || (pf.empty() && planFile.size() >= 5
+                        && planFile.compare(planFile.size() - 5, 5, ".json") == 0)) {
+                planFormat = PLAN_FORMAT_JSON;
+            } else {
+                planFormat = PLAN_FORMAT_IPC;
+            }
+            // Output the plan as soon as a worker finds it
+            earlyPlan = pp.isSet("earlyplan");
+            // Exit without stopping the workers and releasing the solvers
+            fastExit = pp.isSet("fastexit");
+
+            // Keep searching for better plans after the first one (sppsat),
+            // until the given amount of seconds has passed (0 for no limit)
+            anytime = pp.isSet("anytime");
+            std::string dl = pp.getParam("deadline", "0");
+            deadline = atof(dl.c_str());
+
+            // Solve the problems given on stdin, or sent to a unix socket,
+            // one after another in the same process
+            socketPath = pp.getParam("socket", "");
+            batchMode = pp.isSet("batch") || !socketPath.empty();
+
             plannerName = pp.getParam("p", "sppsat");
             threadCount = pp.getIntParam("t", 2);
+            // Pin the threads that parse the operators to one CPU each,
+            // filling one NUMA node after the other
+            pinThreads = pp.isSet("pin");
+
+            // Memory budget in MB (0 for no budget)
+            memoryBudget = pp.getIntParam("mem", 0);
 
             // Set the type of horizon accordingly as an int to save runtime
             std::string ht = pp.getParam("h", "lin");
@@ -54,6 +122,28 @@ class Settings {
 
             layerPackSize = pp.getIntParam("lps", 4);
 
+            // Allow SAT extraction to reach the goal before the extraction layer
+            anyGoalLayer = pp.isSet("anygoal");
+
+            // Exclude actions that can't contribute to the goal
+            relevancePruning = !pp.isSet("norel");
+
+            // Reduce the problem before planning
+            simplification = !pp.isSet("nosimp");
+
+            // Remove redundant actions from found plans and reschedule them
+            postprocessing = !pp.isSet("nopost");
+
+            // Report the time spent in each phase at the end
+            phaseTimes = pp.isSet("times");
+
+            // Report the metrics at the end, to a JSON file if one is given
+            metrics = pp.isSet("metrics");
+            metricsFile = metrics ? pp.getParam("metrics", "") : "";
+
+            // Record a timeline of all threads to this file
+            traceFile = pp.getParam("trace", "");
+
             log(0, "Parameters: ");
             pp.printParams();
         }
@@ -62,14 +152,54 @@ class Settings {
             return verbosityLevel;
         }
 
+        int getAsyncLogging() {
+            return asyncLogging;
+        }
+
         const char* getInputFile() {
             return inputFile;
         }
 
+        std::string getCacheFile() {
+            return cacheFile;
+        }
+
         int getDumpPlanningGraph() {
             return dumpPlanningGraph;
         }
 
+        std::string getPlanFile() {
+            return planFile;
+        }
+
+        int getPlanFormat() {
+            return planFormat;
+        }
+
+        int getEarlyPlan() {
+            return earlyPlan;
+        }
+
+        int getFastExit() {
+            return fastExit;
+        }
+
+        int getAnytime() {
+            return anytime;
+        }
+
+        double getDeadline() {
+            return deadline;
+        }
+
+        int getBatchMode() {
+            return batchMode;
+        }
+
+        std::string getSocketPath() {
+            return socketPath;
+        }
+
         std::string getPlannerName() {
             return plannerName;
         }
@@ -78,6 +208,14 @@ class Settings {
             return threadCount;
         }
 
+        int getPinThreads() {
+            return pinThreads;
+        }
+
+        int getMemoryBudget() {
+            return memoryBudget;
+        }
+
         int getHorizonType() {
             return horizonType;
         }
@@ -89,6 +227,38 @@ class Settings {
         int getLayerPackSize() {
             return layerPackSize;
         }
+
+        int getAnyGoalLayer() {
+            return anyGoalLayer;
+        }
+
+        int getRelevancePruning() {
+            return relevancePruning;
+        }
+
+        int getSimplification() {
+            return simplification;
+        }
+
+        int getPostprocessing() {
+            return postprocessing;
+        }
+
+        int getPhaseTimes() {
+            return phaseTimes;
+        }
+
+        int getMetrics() {
+            return metrics;
+        }
+
+        std::string getMetricsFile() {
+            return metricsFile;
+        }
+
+        std::string getTraceFile() {
+            return traceFile;
+        }
 };
 
 extern Settings *settings;
@@ -0,0 +1,60 @@
+#ifndef _STREAM_BUFFER_H
+#define _STREAM_BUFFER_H
+
+#include <cstddef>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+/**
+ * Buffer that is filled from a file descriptor (e.g. stdin or a pipe) by a
+ * background thread, while the data that has arrived so far can already be
+ * read.
+ *
+ * The buffer is a large reserved range of address space, of which only the
+ * part that holds data is actually allocated. Data therefore never moves and
+ * pointers into the buffer stay valid for the lifetime of the buffer.
+ *
+ * The reservation is sized to fit the address space limit (RLIMIT_AS). If no
+ * range can be reserved, the input is read into a growing heap buffer, which
+ * is only made available once the whole input has arrived.
+ *
+ * Author: Patrick Hegemann
+ */
+class StreamBuffer {
+    public:
+        StreamBuffer(int fd);
+        ~StreamBuffer();
+
+        // Start of the buffer (waits for the whole input if it is read into
+        // the heap)
+        const char* data();
+
+        // Waits until more than the given amount of bytes is available or the
+        // input has ended. Returns the amount of available bytes.
+        size_t waitFor(size_t size);
+
+    private:
+        int fd;
+        char *buffer;
+        // Size of the reserved address range (0 for a heap buffer) and of its
+        // usable part
+        size_t reservedSize;
+        size_t committedSize;
+
+        // Amount of bytes that have been read
+        std::atomic<size_t> available;
+        // Whether the input has ended
+        std::atomic<bool> complete;
+
+        std::mutex mutex;
+        std::condition_variable dataArrived;
+        std::thread reader;
+
+        // Function of the reader thread
+        void readInput();
+};
+
+#endif /* _STREAM_BUFFER_H */
@@ -1,7 +1,13 @@
 #ifndef THREADPOOL_H_
 #define THREADPOOL_H_
 
-#include <queue>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <future>
+#include <type_traits>
+#include <utility>
+#include <atomic>
 
 #include <thread>
 #include <mutex>
@@ -9,40 +15,106 @@
 
 
 /**
- * A simple thread pool.
+ * A work-stealing thread pool.
+ * Each worker has its own double-ended task queue. Workers take tasks from the
+ * back of their own queue and, if it is empty, steal from the front of the
+ * queues of other workers (preferring workers on the same NUMA node). Tasks
+ * can be any callable, including move-only ones, and submit() returns a future
+ * for the result of a task.
  *
  * Author: Patrick Hegemann
  */
 class ThreadPool {
     public:
-        ThreadPool(int workerCount);
+        ThreadPool(int workerCount, bool pinWorkers = false);
         ~ThreadPool();
 
+        // C-style job, kept for code that passes function pointers around
         struct Job {
             void*(*func)(void*);    // Function for this job
             void* arguments;        // Arguments for the function
         };
 
+        // A type-erased, move-only task
+        class Task {
+            public:
+                Task() {}
+                template<typename F, typename = typename std::enable_if<
+                    !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+                Task(F&& f) : callable(new Callable<typename std::decay<F>::type>(std::forward<F>(f))) {}
+
+                Task(Task&& other) = default;
+                Task& operator=(Task&& other) = default;
+
+                void operator()() { callable->call(); }
+                explicit operator bool() const { return (bool) callable; }
+
+            private:
+                struct CallableBase {
+                    virtual ~CallableBase() {}
+                    virtual void call() =0;
+                };
+                template<typename F>
+                struct Callable : CallableBase {
+                    F f;
+                    template<typename G>
+                    Callable(G&& g) : f(std::forward<G>(g)) {}
+                    void call() { f(); }
+                };
+                std::unique_ptr<CallableBase> callable;
+        };
+
         void enqueueJob(Job job);
+        void enqueue(Task task);
+
+        // Enqueues a callable and returns a future for its result
+        template<typename F>
+        auto submit(F f) -> std::future<decltype(f())> {
+            typedef decltype(f()) Result;
+            std::packaged_task<Result()> task(std::move(f));
+            std::future<Result> result = task.get_future();
+            enqueue(Task(std::move(task)));
+            return result;
+        }
+
         bool isDone();
+        int getWorkerCount();
+        // Returns the index of the calling worker thread, or -1 if the caller
+        // is not a worker of this pool
+        int getCurrentWorker();
 
     private:
+        // Task queue of a single worker
+        struct WorkerQueue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+            // NUMA node of the CPU the worker is pinned to (0 if not pinned)
+            int node = 0;
+            // Other workers in the order in which this worker steals from them
+            std::vector<int> victims;
+        };
+
         // An array of worker threads
         std::vector<std::thread> workers;
-        // A queue for the jobs
-        std::queue<Job> jobs;
+        // One queue per worker
+        std::vector<std::unique_ptr<WorkerQueue>> queues;
 
-        // A mutex for the job queue
-        std::mutex queueMutex;
-        // Condition variable that is used to notify workers when there is work
-        std::condition_variable queueCondition;
+        // Amount of tasks that are enqueued but not yet taken by a worker
+        std::atomic<int> pendingTasks;
+        // Worker that receives the next task enqueued from outside the pool
+        std::atomic<unsigned int> nextQueue;
+
+        // Mutex and condition variable that are used to put idle workers to sleep
+        std::mutex idleMutex;
+        std::condition_variable idleCondition;
 
         // Indicates whether the pool was force stopped
         bool stopped;
 
-        static void* workerThread(void *args);
-        Job* getNextJob();
+        static void workerThread(ThreadPool *pool, int index);
+        bool getNextTask(int index, Task& task);
+        bool popTask(int index, Task& task);
+        bool stealTask(int victim, Task& task);
 };
 
 #endif
-
@@ -0,0 +1,56 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <string>
+
+#include "Logger.h"
+
+
+/**
+ * Timeline of what each thread does, written in the Chrome trace event format
+ * (viewable with chrome://tracing or Perfetto).
+ *
+ * Tracing is off unless startTrace() is called. While it is off, recording an
+ * event is only a check of a flag. Each thread records its events into its
+ * own buffer, so threads don't wait for each other; the buffers are merged
+ * when the trace is written.
+ *
+ * Author: Patrick Hegemann
+ */
+
+extern bool traceEnabled;
+
+// Enables tracing. Has to be called before any other thread is started.
+void startTrace();
+// Names the calling thread in the trace
+void setTraceThreadName(const char *name);
+// Records a span that started at the given time (from getTime()) and ends
+// now, or a single point in time. The layer is shown as an argument if it
+// isn't negative. Names have to be string literals.
+void traceSpan(const char *name, double start, int layer);
+void traceInstant(const char *name, int layer);
+// Writes all recorded events to a JSON file
+void writeTrace(std::string file);
+// Drops all recorded events (before the next problem of a batch)
+void resetTrace();
+
+
+/**
+ * Records a span from its construction to its destruction.
+ */
+class TraceScope {
+    public:
+        TraceScope(const char *name, int layer = -1)
+            : name(name), layer(layer), start(traceEnabled ? getTime() : 0) {}
+
+        ~TraceScope() {
+            if (traceEnabled) traceSpan(name, start, layer);
+        }
+
+    private:
+        const char *name;
+        int layer;
+        double start;
+};
+
+#endif /* _TRACE_H */
@@ -0,0 +1,170 @@
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "Batch.h"
+#include "ParallelGP.h"
+#include "PlanOutput.h"
+#include "PhaseTimes.h"
+#include "Memory.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Settings.h"
+#include "Logger.h"
+
+
+/**
+ * Solves one problem and writes its result. The name identifies the problem
+ * in the result.
+ */
+static void solveRequest(const char *file, const char *name, FILE *out) {
+    if (access(file, R_OK) != 0) {
+        writeErrorResult(out, name, "Could not read file");
+        return;
+    }
+    log(0, "Solving %s\n", name);
+
+    // Statistics are given per problem
+    resetPlanOutput();
+    resetPhaseTimes();
+    resetPeakSolverMemory();
+    resetMetrics();
+    resetTrace();
+
+    int unsolvable = 0;
+    IPlanningProblem *problem = nullptr;
+    Plan plan;
+    int success = 0;
+    try {
+        problem = loadProblem(file, unsolvable);
+        success = !unsolvable && findPlan(problem, plan);
+    } catch (ProblemError& e) {
+        // A request that can't be solved must not end the batch
+        log(0, "%s\n", e.what());
+        writeErrorResult(out, name, e.what());
+        delete problem;
+        return;
+    }
+    if (success) {
+        emitPlan(problem, plan);
+    }
+    writePlanResult(out, name, problem, success ? &plan : nullptr);
+    printStatistics(problem);
+
+    delete problem;
+}
+
+/**
+ * Copies SAS text up to the line "end_sas" into a temporary file and solves
+ * it.
+ */
+static void solveTextRequest(FILE *in, FILE *out) {
+    char path[] = "/tmp/pgp-request-XXXXXX";
+    int fd = mkstemp(path);
+    FILE *sas = fd >= 0 ? fdopen(fd, "w") : nullptr;
+
+    char *line = nullptr;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, in) != -1) {
+        if (strcmp(line, "end_sas\n") == 0 || strcmp(line, "end_sas") == 0) break;
+        if (sas) fputs(line, sas);
+    }
+    free(line);
+
+    if (sas == nullptr) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(path);
+        }
+        writeErrorResult(out, "sas", "Could not create temporary file");
+        return;
+    }
+    if (fclose(sas) != 0) {
+        unlink(path);
+        writeErrorResult(out, "sas", "Could not write temporary file");
+        return;
+    }
+    solveRequest(path, "sas", out);
+    unlink(path);
+}
+
+/**
+ * Answers the requests read from in. Returns false if "quit" was received.
+ */
+static bool processRequests(FILE *in, FILE *out) {
+    char *line = nullptr;
+    size_t capacity = 0;
+    bool running = true;
+    while (running && getline(&line, &capacity, in) != -1) {
+        std::string request(line);
+        while (!request.empty() && (request.back() == '\n' || request.back() == '\r')) {
+            request.pop_back();
+        }
+
+        if (request.empty()) {
+            continue;
+        } else if (request == "quit") {
+            running = false;
+        } else if (request == "sas") {
+            solveTextRequest(in, out);
+        } else {
+            solveRequest(request.c_str(), request.c_str(), out);
+        }
+    }
+    free(line);
+    return running;
+}
+
+/**
+ * Serves the connections to a unix socket one after another.
+ */
+static void serveSocket(std::string path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        exitError("Socket path too long: %s\n", path.c_str());
+    }
+    strcpy(address.sun_path, path.c_str());
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (server < 0 || bind(server, (sockaddr*) &address, sizeof(address)) != 0 || listen(server, 8) != 0) {
+        exitError("Could not listen on %s\n", path.c_str());
+    }
+    // A client that disconnects early must not end the process
+    signal(SIGPIPE, SIG_IGN);
+    log(0, "Waiting for requests on %s\n", path.c_str());
+
+    bool running = true;
+    while (running) {
+        int connection = accept(server, nullptr, nullptr);
+        if (connection < 0) continue;
+
+        FILE *in = fdopen(connection, "r");
+        FILE *out = fdopen(dup(connection), "w");
+        running = processRequests(in, out);
+        fclose(in);
+        fclose(out);
+    }
+
+    close(server);
+    unlink(path.c_str());
+}
+
+int runBatch() {
+    if (settings->getSocketPath().empty()) {
+        processRequests(stdin, stdout);
+    } else {
+        serveSocket(settings->getSocketPath());
+    }
+
+    releaseBatchPools();
+    return 0;
+}
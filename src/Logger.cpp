@@ -10,10 +10,46 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
 
 static int verbosityLevelSetting = 0;
 static double start = getAbsoluteTimeLP();
 
+// Messages are split into slots of this size
+#define LOG_SLOT_SIZE 256
+#define LOG_RING_SLOTS 1024
+
+struct LogSlot {
+	double time;
+	int length;
+	bool last;		// Last slot of a message
+	char text[LOG_SLOT_SIZE];
+};
+
+// Messages of one thread. Only the thread itself adds messages (at head),
+// only the flushing side removes them (at tail).
+struct LogRing {
+	std::atomic<unsigned long> head{0};
+	std::atomic<unsigned long> tail{0};
+	LogSlot slots[LOG_RING_SLOTS];
+};
+
+static std::atomic<bool> asyncLogging(false);
+static std::atomic<bool> flusherRunning(false);
+static std::thread flusher;
+static thread_local LogRing *threadRing = nullptr;
+// Guards the list of rings and the removal of messages from them
+static std::mutex ringsMutex;
+static std::vector<LogRing*> rings;
+
 double getAbsoluteTimeLP() {
 	timeval time;
 	gettimeofday(&time, nullptr);
@@ -28,18 +64,136 @@ void setVerbosityLevel(int level) {
 	verbosityLevelSetting = level;
 }
 
-void log(int verbosityLevel, const char* fmt, ...) {
+static LogRing* getThreadRing() {
+	if (!threadRing) {
+		threadRing = new LogRing();
+		std::unique_lock<std::mutex> lck(ringsMutex);
+		rings.push_back(threadRing);
+	}
+	return threadRing;
+}
+
+// Adds a message to the ring of the calling thread, waiting if it is full
+static void enqueueMessage(double time, const char *text, int length) {
+	LogRing *ring = getThreadRing();
+	int slotCount = std::max(1, (length + LOG_SLOT_SIZE - 1) / LOG_SLOT_SIZE);
+	if (slotCount > LOG_RING_SLOTS) {
+		slotCount = LOG_RING_SLOTS;
+		length = LOG_RING_SLOTS * LOG_SLOT_SIZE;
+	}
+
+	unsigned long head = ring->head.load(std::memory_order_relaxed);
+	while (head + slotCount - ring->tail.load(std::memory_order_acquire) > LOG_RING_SLOTS) {
+		std::this_thread::yield();
+	}
+
+	for (int i = 0; i < slotCount; i++) {
+		LogSlot& slot = ring->slots[(head + i) % LOG_RING_SLOTS];
+		slot.time = time;
+		slot.length = std::min(LOG_SLOT_SIZE, length - i * LOG_SLOT_SIZE);
+		slot.last = (i == slotCount - 1);
+		memcpy(slot.text, text + i * LOG_SLOT_SIZE, slot.length);
+	}
+	// The whole message becomes visible at once
+	ring->head.store(head + slotCount, std::memory_order_release);
+}
+
+// Writes the messages of all rings to stdout, ordered by time
+static void drainRings() {
+	std::unique_lock<std::mutex> lck(ringsMutex);
+
+	std::vector<std::pair<double, std::string>> messages;
+	for (LogRing *ring : rings) {
+		unsigned long tail = ring->tail.load(std::memory_order_relaxed);
+		unsigned long head = ring->head.load(std::memory_order_acquire);
+		std::string text;
+		for (unsigned long i = tail; i < head; i++) {
+			LogSlot& slot = ring->slots[i % LOG_RING_SLOTS];
+			text.append(slot.text, slot.length);
+			if (slot.last) {
+				messages.push_back(std::make_pair(slot.time, text));
+				text.clear();
+			}
+		}
+		ring->tail.store(head, std::memory_order_release);
+	}
+	if (messages.empty()) return;
+
+	std::stable_sort(messages.begin(), messages.end(),
+		[](const std::pair<double, std::string>& a, const std::pair<double, std::string>& b) {
+			return a.first < b.first;
+		});
+	for (auto& message : messages) {
+		fwrite(message.second.data(), 1, message.second.size(), stdout);
+	}
+	fflush(stdout);
+}
+
+static void flusherThread() {
+	while (flusherRunning.load(std::memory_order_acquire)) {
+		drainRings();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	drainRings();
+}
+
+void startAsyncLogging() {
+	if (flusherRunning.exchange(true)) return;
+	asyncLogging = true;
+	flusher = std::thread(flusherThread);
+	// Pending messages are written on any exit
+	atexit(stopAsyncLogging);
+}
+
+void stopAsyncLogging() {
+	if (!flusherRunning.exchange(false)) return;
+	asyncLogging = false;
+	flusher.join();
+	drainRings();
+}
+
+void flushLog() {
+	if (asyncLogging) {
+		drainRings();
+	}
+}
+
+void logMessage(int verbosityLevel, const char* fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	logMessageV(verbosityLevel, fmt, args);
+	va_end(args);
+}
+
+void logMessageV(int verbosityLevel, const char* fmt, va_list args) {
 	if (verbosityLevel <= verbosityLevelSetting) {
-		va_list args;
-		va_start(args, fmt);
-		printf("[%.3f] ", getTime());
-		vprintf(fmt, args);
-		va_end(args);
-		fflush(stdout);
+		if (asyncLogging) {
+			// Format the message here, so the output thread only copies it
+			double time = getTime();
+			char buffer[1024];
+			int length = snprintf(buffer, sizeof(buffer), "[%.3f] ", time);
+			va_list argsCopy;
+			va_copy(argsCopy, args);
+			int textLength = std::max(0, vsnprintf(buffer + length, sizeof(buffer) - length, fmt, args));
+			if (length + textLength < (int) sizeof(buffer)) {
+				enqueueMessage(time, buffer, length + textLength);
+			} else {
+				std::string text(buffer, length);
+				text.resize(length + textLength + 1);
+				vsnprintf(&text[length], textLength + 1, fmt, argsCopy);
+				enqueueMessage(time, text.data(), length + textLength);
+			}
+			va_end(argsCopy);
+		} else {
+			printf("[%.3f] ", getTime());
+			vprintf(fmt, args);
+			fflush(stdout);
+		}
 	}
 }
 
 void exitError(const char* fmt, ...) {
+	flushLog();
 	va_list args;
 	va_start(args, fmt);
 	printf("[%.3f] Exiting due to critical error: ", getTime());
@@ -48,7 +202,3 @@ void exitError(const char* fmt, ...) {
 	fflush(stdout);
 	exit(1);
 }
-
-
-
-
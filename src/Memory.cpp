@@ -0,0 +1,94 @@
+#include <map>
+#include <algorithm>
+#include <mutex>
+#include <cstdio>
+
+#include <unistd.h>
+
+#include "Memory.h"
+#include "IPlanningProblem.h"
+#include "Logger.h"
+
+
+static long long memoryBudget = 0;
+
+// Estimated size of each solver
+static std::mutex solverMemoryMutex;
+static std::map<void*, long long> solverMemory;
+static long long totalSolverMemory = 0;
+static long long peakSolverMemory = 0;
+
+
+void setMemoryBudget(long long bytes) {
+    memoryBudget = bytes;
+}
+
+long long getMemoryBudget() {
+    return memoryBudget;
+}
+
+void checkMemoryBudget(long long bytes, const char *what) {
+    if (memoryBudget && bytes > memoryBudget) {
+        throw ProblemError("The " + std::string(what) + " need " + formatMemory(bytes)
+                + ", more than the memory budget of " + formatMemory(memoryBudget));
+    }
+}
+
+void addSolverMemory(void *solver, long long clauses, long long literals) {
+    long long bytes = clauses * SOLVER_BYTES_PER_CLAUSE + literals * SOLVER_BYTES_PER_LITERAL;
+    std::unique_lock<std::mutex> lck(solverMemoryMutex);
+    solverMemory[solver] += bytes;
+    totalSolverMemory += bytes;
+    peakSolverMemory = std::max(peakSolverMemory, totalSolverMemory);
+}
+
+void releaseSolverMemory(void *solver) {
+    std::unique_lock<std::mutex> lck(solverMemoryMutex);
+    auto it = solverMemory.find(solver);
+    if (it != solverMemory.end()) {
+        totalSolverMemory -= it->second;
+        solverMemory.erase(it);
+    }
+}
+
+long long getSolverMemory() {
+    std::unique_lock<std::mutex> lck(solverMemoryMutex);
+    return totalSolverMemory;
+}
+
+long long getPeakSolverMemory() {
+    std::unique_lock<std::mutex> lck(solverMemoryMutex);
+    return peakSolverMemory;
+}
+
+void resetPeakSolverMemory() {
+    std::unique_lock<std::mutex> lck(solverMemoryMutex);
+    peakSolverMemory = totalSolverMemory;
+}
+
+int getSolverCount() {
+    std::unique_lock<std::mutex> lck(solverMemoryMutex);
+    return solverMemory.size();
+}
+
+long long getResidentMemory() {
+    long long pages = 0;
+    long long residentPages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr) return 0;
+    if (fscanf(statm, "%lld %lld", &pages, &residentPages) != 2) {
+        residentPages = 0;
+    }
+    fclose(statm);
+    return residentPages * sysconf(_SC_PAGESIZE);
+}
+
+std::string formatMemory(long long bytes) {
+    char buffer[32];
+    if (bytes < 1024 * 1024) {
+        snprintf(buffer, sizeof(buffer), "%.1f KB", bytes / 1024.0);
+    } else {
+        snprintf(buffer, sizeof(buffer), "%.1f MB", bytes / (1024.0 * 1024.0));
+    }
+    return buffer;
+}
@@ -0,0 +1,130 @@
+#include <vector>
+#include <mutex>
+#include <cstdio>
+
+#include "Metrics.h"
+
+
+#ifndef PGP_NOMETRICS
+static const char *metricNames[METRIC_COUNT] = {
+    "layers_expanded", "expand_us", "mutex_checks", "nogood_hits", "nogood_misses",
+    "clauses", "solver_calls", "solve_us", "queued_jobs", "queue_wait_us"
+};
+
+static const char *layerMetricNames[LAYER_METRIC_COUNT] = {"expand_us", "clauses"};
+#endif
+
+thread_local ThreadMetrics *threadMetrics = nullptr;
+
+// Counters of all threads that counted anything. They are never freed, since
+// the report is made at exit.
+static std::mutex registryMutex;
+static std::vector<ThreadMetrics*> registry;
+
+
+ThreadMetrics* registerMetricsThread() {
+    ThreadMetrics *metrics = new ThreadMetrics();
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        metrics->values[i].store(0, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < LAYER_METRIC_COUNT; i++) {
+        for (int l = 0; l < METRICS_MAX_LAYERS; l++) {
+            metrics->layerValues[i][l].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    std::unique_lock<std::mutex> lck(registryMutex);
+    registry.push_back(metrics);
+    return metrics;
+}
+
+long long getMetric(Metric metric) {
+    std::unique_lock<std::mutex> lck(registryMutex);
+    long long sum = 0;
+    for (ThreadMetrics *metrics : registry) {
+        sum += metrics->values[metric].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+long long getLayerMetric(LayerMetric metric, int layer) {
+    std::unique_lock<std::mutex> lck(registryMutex);
+    long long sum = 0;
+    for (ThreadMetrics *metrics : registry) {
+        sum += metrics->layerValues[metric][layer].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+void resetMetrics() {
+    std::unique_lock<std::mutex> lck(registryMutex);
+    for (ThreadMetrics *metrics : registry) {
+        for (int i = 0; i < METRIC_COUNT; i++) {
+            metrics->values[i].store(0, std::memory_order_relaxed);
+        }
+        for (int i = 0; i < LAYER_METRIC_COUNT; i++) {
+            for (int l = 0; l < METRICS_MAX_LAYERS; l++) {
+                metrics->layerValues[i][l].store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+#ifndef PGP_NOMETRICS
+// Number of layers that have any layer metric counted
+static int getMetricLayerCount() {
+    int count = 0;
+    for (int l = 0; l < METRICS_MAX_LAYERS; l++) {
+        for (int i = 0; i < LAYER_METRIC_COUNT; i++) {
+            if (getLayerMetric((LayerMetric) i, l)) count = l + 1;
+        }
+    }
+    return count;
+}
+#endif
+
+void printMetrics() {
+#ifdef PGP_NOMETRICS
+    log(0, "Metrics are disabled (built with PGP_NOMETRICS)\n");
+#else
+    log(0, "Metrics:\n");
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        log(0, "\t%s\t%lld\n", metricNames[i], getMetric((Metric) i));
+    }
+    log(0, "LAYER\t%s\t%s\n", layerMetricNames[0], layerMetricNames[1]);
+    int layerCount = getMetricLayerCount();
+    for (int l = 0; l < layerCount; l++) {
+        log(0, "%d\t%lld\t%lld\n", l, getLayerMetric(LAYER_METRIC_EXPAND_MICROSECONDS, l),
+                getLayerMetric(LAYER_METRIC_CLAUSES, l));
+    }
+#endif
+}
+
+void writeMetrics(std::string file) {
+    FILE *out = fopen(file.c_str(), "w");
+    if (out == nullptr) {
+        log(0, "Could not write metrics to %s\n", file.c_str());
+        return;
+    }
+
+#ifdef PGP_NOMETRICS
+    fprintf(out, "{\"enabled\": false}\n");
+#else
+    fprintf(out, "{\n  \"enabled\": true,\n  \"counters\": {");
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        fprintf(out, "%s\"%s\": %lld", i ? ", " : "", metricNames[i], getMetric((Metric) i));
+    }
+    fprintf(out, "},\n  \"layers\": [");
+    int layerCount = getMetricLayerCount();
+    for (int l = 0; l < layerCount; l++) {
+        fprintf(out, "%s\n    {\"layer\": %d", l ? "," : "", l);
+        for (int i = 0; i < LAYER_METRIC_COUNT; i++) {
+            fprintf(out, ", \"%s\": %lld", layerMetricNames[i], getLayerMetric((LayerMetric) i, l));
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n  ]\n}\n");
+#endif
+
+    fclose(out);
+}
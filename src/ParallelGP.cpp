@@ -8,14 +8,24 @@
 
 // Other includes
 #include <string>
+#include <unistd.h>
 #include <list>
 
 #include "common.h"
 #include "Plan.h"
 #include "PlanningProblem.h"
 #include "Parser.h"
+#include "ProblemCache.h"
+#include "ProblemSimplifier.h"
 #include "Settings.h"
 #include "Logger.h"
+#include "PhaseTimes.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Memory.h"
+#include "PlanOutput.h"
+#include "PlanPostprocessor.h"
+#include "Batch.h"
 
 #include "Planners/LPEPEPlanner.h"
 #include "Planners/SimpleParallelPlannerWithSAT.h"
@@ -27,35 +37,168 @@
 
 Settings* settings;
 
+// Thread pools that are kept across the problems of a batch
+static SATSolverThreadPool *batchPool = nullptr;
+static SATPriorityThreadPool *batchPriorityPool = nullptr;
+
+/**
+ * Gets the pool for SPPSAT in batch mode (nullptr otherwise, so the planner
+ * creates its own).
+ */
+static SATSolverThreadPool* getBatchPool() {
+    if (!settings->getBatchMode()) return nullptr;
+    // Workers that were retired because of the memory budget don't come back
+    if (batchPool && batchPool->getWorkerLimit(0) < settings->getThreadCount()) {
+        delete batchPool;
+        batchPool = nullptr;
+    }
+    if (!batchPool) {
+        batchPool = new SATSolverThreadPool(1);
+        batchPool->addWorkers(0, settings->getThreadCount(), SimpleParallelPlannerWithSAT::createSATSolver, nullptr);
+    }
+    return batchPool;
+}
+
+/**
+ * Gets the pool for LPEPE in batch mode (nullptr otherwise).
+ */
+static SATPriorityThreadPool* getBatchPriorityPool() {
+    if (!settings->getBatchMode()) return nullptr;
+    if (batchPriorityPool && batchPriorityPool->getWorkerLimit(0) < settings->getThreadCount()) {
+        delete batchPriorityPool;
+        batchPriorityPool = nullptr;
+    }
+    if (!batchPriorityPool) {
+        batchPriorityPool = new SATPriorityThreadPool(1);
+        batchPriorityPool->addWorkers(0, settings->getThreadCount(), LPEPEPlanner::createSATSolver, nullptr);
+    }
+    return batchPriorityPool;
+}
+
+void releaseBatchPools() {
+    delete batchPool;
+    delete batchPriorityPool;
+    batchPool = nullptr;
+    batchPriorityPool = nullptr;
+}
+
 int main(int argc, char *argv[]) {
     // Get command line arguments
     settings = new Settings(argc, (char**)argv);
 
     setVerbosityLevel(settings->getVerbosityLevel());
+    if (settings->getAsyncLogging()) {
+        startAsyncLogging();
+    }
+    if (!settings->getTraceFile().empty()) {
+        startTrace();
+    }
+    setMemoryBudget((long long) settings->getMemoryBudget() * 1024 * 1024);
+    if (settings->getBatchMode()) {
+        return runBatch();
+    }
     if (settings->getInputFile() == nullptr) {
         exitError("No input file given\n");
     }
 
-    // Parse input file
-    log(0, "Parsing...\n");
-    SASParser parser;
-
-    // Switch between data structures here later
-    PlanningProblem::Builder builder;
-    parser.setProblemBuilder(&builder);
+    int unsolvable = 0;
+    IPlanningProblem *problem = nullptr;
+    try {
+        problem = loadProblem(settings->getInputFile(), unsolvable);
+    } catch (ProblemError& e) {
+        exitError("%s\n", e.what());
+    }
 
-    IPlanningProblem *problem = parser.parse(settings->getInputFile());
-    log(0, "Parsing done\n");
+    // Unsolvable problems are often already recognized by the simplification
+    if (unsolvable) {
+        log(0, "Problem is unsolvable\n");
+        log(0, "No plan found\n");
+        emitNoPlan();
+        printStatistics(problem);
+        return 0;
+    }
 
     // Find a plan, then verify and print it
     Plan plan;
-    if (findPlan(problem, plan)) {
-        printPlan(problem, plan);
+    int success = 0;
+    try {
+        success = findPlan(problem, plan);
+    } catch (ProblemError& e) {
+        exitError("%s\n", e.what());
+    }
+    if (success) {
+        emitPlan(problem, plan);
+    } else {
+        emitNoPlan();
+    }
+
+    printStatistics(problem);
+
+    // The planner was not deleted, so its workers may still be running
+    if (settings->getFastExit()) {
+        stopAsyncLogging();
+        fflush(stdout);
+        _exit(0);
     }
 
     return 0;
 }
 
+/**
+ * Parses a problem, or loads it from the cache, and simplifies it. Sets
+ * unsolvable if the simplification already found the problem unsolvable.
+ * Throws a ProblemError if the problem can't be read.
+ */
+IPlanningProblem* loadProblem(const char *file, int& unsolvable) {
+    // Switch between data structures here later
+    PlanningProblem::Builder builder;
+    IPlanningProblem *problem = nullptr;
+
+    // Reduce the problem on its way from the parser (or cache) to the builder
+    ProblemSimplifier simplifier(&builder);
+    IPlanningProblem::Builder *problemBuilder = &builder;
+    if (settings->getSimplification()) {
+        problemBuilder = &simplifier;
+    }
+
+    // Load the problem from the binary cache if there is a valid one (not in
+    // batch mode, where the problems change)
+    ProblemCache *cache = nullptr;
+    if (!settings->getCacheFile().empty() && !settings->getBatchMode()) {
+        PhaseTimer timer(PHASE_PARSE);
+        cache = new ProblemCache(settings->getCacheFile(), file);
+        problem = cache->load(problemBuilder);
+    }
+
+    if (problem == nullptr) {
+        PhaseTimer timer(PHASE_PARSE);
+
+        // Parse input file
+        log(0, "Parsing...\n");
+        SASParser parser;
+        parser.setThreadCount(settings->getThreadCount());
+        parser.setPinThreads(settings->getPinThreads());
+
+        // Record the problem while parsing if a cache is to be written
+        if (cache) {
+            parser.setProblemBuilder(cache->record(problemBuilder));
+        } else {
+            parser.setProblemBuilder(problemBuilder);
+        }
+
+        problem = parser.parse(file);
+        log(0, "Parsing done\n");
+
+        if (cache) {
+            cache->write();
+        }
+    }
+    delete cache;
+
+    unsolvable = settings->getSimplification() && simplifier.isUnsolvable();
+    return problem;
+}
+
 int findPlan(IPlanningProblem *problem, Plan& plan) {
     log(0, "Searching plan...\n");
 
@@ -67,20 +210,31 @@ int findPlan(IPlanningProblem *problem, Plan& plan) {
     } else if (plannerName == "satex") {    // Planner with SAT Extraction
         planner = new PlannerWithSATExtraction(problem);
     } else if (plannerName == "sppsat") {   // Simple Parallel Planner with SAT
-        planner = new SimpleParallelPlannerWithSAT(problem);
+        planner = new SimpleParallelPlannerWithSAT(problem, getBatchPool());
     } else if (plannerName == "lpepe") {
-        planner = new LPEPEPlanner(problem);
+        planner = new LPEPEPlanner(problem, getBatchPriorityPool());
     }
     
     // Call planner
     int success = 0;
     if (planner) {
-        success = planner->graphplan(plan);
+        try {
+            success = planner->graphplan(plan);
+        } catch (ProblemError& e) {
+            // Jobs of the planner may still be running
+            delete planner;
+            throw;
+        }
     } else {
         exitError("Invalid planner: %s\n", plannerName.c_str());
     }
 
-    delete planner;
+    // Stopping the workers waits for their current jobs and releases the
+    // solvers, which may take long. With -fastexit this is left to the exit.
+    // (not in batch mode, where the workers are reused)
+    if (!settings->getFastExit() || settings->getBatchMode()) {
+        delete planner;
+    }
 
     // No plan
     if (!success) {
@@ -90,23 +244,43 @@ int findPlan(IPlanningProblem *problem, Plan& plan) {
 
     // Plan found
     log(0, "Plan found!\n");
+    // A plan that was output early was already checked and improved
+    if (isPlanEmitted()) {
+        return 1;
+    }
+    if (!verifyPlan(problem, plan)) {
+        return 0;
+    }
+    if (settings->getPostprocessing()) {
+        PlanPostprocessor postprocessor(problem);
+        plan = postprocessor.improve(plan);
+    }
     return 1;
 }
 
-void printPlan(IPlanningProblem *problem, Plan plan) {
-    // Output plan (short version)
-    log(0, "BEGIN PLAN\n");
-    int step = 0;
-    log(0, "LAYER\tSTEP\tACTION\n");
-    for (int layerNumber = 0; layerNumber < plan.getLayerCount(); layerNumber++) {
-        std::list<Action> layer = plan.getLayerActions(layerNumber);
-        for (Action action : layer) {
-            if (!problem->isTrivialAction(action))  {
-                log(0, "%d\t%d\t%s\n", layerNumber+1, step+1, problem->getActionName(action).c_str());
-                step++;
-            }
+/**
+ * Checks that the plan is applicable and reaches the goal.
+ */
+int verifyPlan(IPlanningProblem *problem, Plan plan) {
+    PlanPostprocessor postprocessor(problem);
+    return postprocessor.isValid(plan);
+}
+
+void printStatistics(IPlanningProblem *problem) {
+    problem->printMemoryUsage();
+    log(1, "Peak memory of SAT solvers (estimated): %s\n", formatMemory(getPeakSolverMemory()).c_str());
+    log(1, "Resident memory: %s\n", formatMemory(getResidentMemory()).c_str());
+    if (settings->getPhaseTimes()) {
+        printPhaseTimes();
+    }
+    if (settings->getMetrics()) {
+        if (settings->getMetricsFile().empty()) {
+            printMetrics();
+        } else {
+            writeMetrics(settings->getMetricsFile());
         }
     }
-    log(0, "END PLAN\n");
+    if (traceEnabled) {
+        writeTrace(settings->getTraceFile());
+    }
 }
-
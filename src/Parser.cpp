@@ -1,11 +1,19 @@
 #include <string>
-#include <fstream>
-#include <iostream>
-#include <sstream>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <future>
 #include <assert.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "PlanningProblem.h"
 #include "Logger.h"
+#include "ThreadPool.h"
+#include "StreamBuffer.h"
 
 #include "Parser.h"
 
@@ -34,64 +42,168 @@
 /**
  * Constructor
  */
-SASParser::SASParser() {}
+SASParser::SASParser() {
+    threadCount = 1;
+    pinThreads = false;
+    mapped = nullptr;
+    stream = nullptr;
+}
 
 
 /**
- * Parse a file and output problem struct
+ * Parse a file and output problem struct. The filename "-" denotes stdin.
+ * Regular files are memory-mapped, anything else (stdin, pipes) is read
+ * by a background thread while parsing already goes on.
  */
 IPlanningProblem* SASParser::parse(const char *filename) {
     assert(problemBuilder != nullptr);
-    // Initialize Planning Problem Builder
-    //PlanningProblem::Builder builder;
-    //problemBuilder = new PlanningProblem::Builder;
-
-    // TODO: maybe modify this so it takes a stringstream
-    // Prepare file stream
-    file.open(filename);
-    if (!file.is_open()) {
+
+    fd = (strcmp(filename, "-") == 0) ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (fd < 0) {
         error("SAS file could not be opened");
-        return nullptr;
+    }
+    mapped = nullptr;
+    stream = nullptr;
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0) {
+        closeInput();
+        error("SAS file could not be read");
     }
 
-    // Start parsing!
-    nextLine();
-    
-    // Parse all sections
-    version();
-    metric();
-    variables();
-    mutexes();
-    initialstate();
-    goalstate();
-    operators();
-    //axioms();
-
-    file.close();
+    if (S_ISREG(fileStat.st_mode) && fileStat.st_size > 0) {
+        // Map the whole file into memory
+        mappedSize = fileStat.st_size;
+        mapped = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            mapped = nullptr;
+            closeInput();
+            error("SAS file could not be mapped");
+        }
+        // The file is read front to back exactly once
+        madvise(mapped, mappedSize, MADV_SEQUENTIAL);
+
+        buffer = (const char*) mapped;
+        bufferEnd = buffer + mappedSize;
+    } else {
+        // Stream the input, the buffer grows while the sections are parsed
+        log(1, "Reading SAS input as a stream\n");
+        stream = new StreamBuffer(fd);
+        buffer = stream->data();
+        bufferEnd = buffer + stream->waitFor(0);
+    }
+    position = buffer;
+    endOfInput = false;
+
+    try {
+        // Start parsing!
+        nextLine();
+
+        // Parse all sections
+        version();
+        metric();
+        variables();
+        mutexes();
+        initialstate();
+        goalstate();
+        operators();
+        axioms();
+    } catch (...) {
+        closeInput();
+        throw;
+    }
+    closeInput();
 
     return problemBuilder->build();
 }
 
+/**
+ * Unmaps and closes the input file
+ */
+void SASParser::closeInput() {
+    if (mapped) {
+        munmap(mapped, mappedSize);
+        mapped = nullptr;
+    }
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    // Waits for the rest of the input, which keeps the writing end of a
+    // pipe from failing
+    delete stream;
+    stream = nullptr;
+}
+
 
 void SASParser::setProblemBuilder(IPlanningProblem::Builder *builder) {
     problemBuilder = builder;
 }
 
+void SASParser::setThreadCount(int count) {
+    threadCount = count;
+}
+
+void SASParser::setPinThreads(bool pin) {
+    pinThreads = pin;
+}
+
+
+/**
+ * Waits for more input if the input is streamed. Returns whether there is
+ * more input.
+ */
+bool SASParser::fillBuffer() {
+    if (stream == nullptr) return false;
+    const char *oldEnd = bufferEnd;
+    bufferEnd = buffer + stream->waitFor(bufferEnd - buffer);
+    return bufferEnd > oldEnd;
+}
 
 /**
  * Reads next line for parsing
  */
 void SASParser::nextLine() {
-    if (!std::getline(file, curLine)) {
-        error("Unexpected EOF");
+    if (position >= bufferEnd && !fillBuffer()) {
+        // The last line has been consumed. Reading it is fine, using the
+        // empty line after it is an error.
+        if (endOfInput) {
+            error("Unexpected EOF");
+        }
+        endOfInput = true;
+        lineBegin = lineEnd = bufferEnd;
+        return;
+    }
+
+    lineBegin = position;
+    const char *searchBegin = position;
+    while (true) {
+        lineEnd = (const char*) memchr(searchBegin, '\n', bufferEnd - searchBegin);
+        if (lineEnd != nullptr) break;
+        // The line is incomplete so far
+        searchBegin = bufferEnd;
+        if (!fillBuffer()) break;
+    }
+
+    if (lineEnd == nullptr) {
+        lineEnd = bufferEnd;
+        position = bufferEnd;
+    } else {
+        position = lineEnd + 1;
+    }
+
+    // Ignore carriage returns of files with windows line endings
+    if (lineEnd > lineBegin && lineEnd[-1] == '\r') {
+        lineEnd--;
     }
 }
 
 /**
- * Outputs errors
+ * Throws a ProblemError with the given message
  */
 void SASParser::error(std::string err) {
-    exitError("Parser Error: %s\n", err.c_str());
+    if (endOfInput && err != "Unexpected EOF") {
+        err = "Unexpected EOF (" + err + ")";
+    }
+    throw ProblemError("Parser Error: " + err);
 }
 
 // ----------------------------------------------------------------------------
@@ -100,8 +212,9 @@ void SASParser::error(std::string err) {
  * Checks whether the current line matches the given line.
  * Invokes nextLine() in that case.
  */
-int SASParser::accept(std::string line) {
-    if (curLine == line) {
+int SASParser::accept(const char *line) {
+    size_t length = strlen(line);
+    if ((size_t) (lineEnd - lineBegin) == length && memcmp(lineBegin, line, length) == 0) {
         nextLine();
         return 1;
     }
@@ -111,23 +224,53 @@ int SASParser::accept(std::string line) {
 /**
  * Same as accept but throws an error if expected token is not given
  */
-int SASParser::expect(std::string line) {
+int SASParser::expect(const char *line) {
     if (accept(line)) {
         return 1;
     }
-    std::string msg = "Expected " + line + ", got " + curLine;
+    std::string msg = "Expected " + std::string(line) + ", got " + std::string(lineBegin, lineEnd);
     error(msg);
     return 0;
 }
 
 // ----------------------------------------------------------------------------
 
+/**
+ * Converts the characters in [begin, end) to an integer. Leading and trailing
+ * spaces are ignored, anything else that is not a digit is an error.
+ */
+int SASParser::parseInt(const char *begin, const char *end) {
+    while (begin < end && *begin == ' ') begin++;
+    while (end > begin && end[-1] == ' ') end--;
+
+    bool negative = false;
+    if (begin < end && (*begin == '-' || *begin == '+')) {
+        negative = (*begin == '-');
+        begin++;
+    }
+    if (begin == end) {
+        error("Expected integer, got empty string");
+    }
+
+    long number = 0;
+    for (const char *c = begin; c < end; c++) {
+        if (*c < '0' || *c > '9') {
+            error("Expected integer, got " + std::string(begin, end));
+        }
+        number = number * 10 + (*c - '0');
+        if (number > INT_MAX) {
+            error("Integer out of range: " + std::string(begin, end));
+        }
+    }
+    return negative ? -number : number;
+}
+
 /**
  * Converts the current line into an integer and returns it.
  * Invokes nextLine().
  */
 int SASParser::acceptAnyInt() {
-    int number = stoi(curLine);
+    int number = parseInt(lineBegin, lineEnd);
     nextLine();
     return number;
 }
@@ -136,29 +279,20 @@ int SASParser::acceptAnyInt() {
  * Returns the current line and invokes nextLine().
  */
 std::string SASParser::acceptAnyLine() {
-    std::string line = curLine;
+    std::string line(lineBegin, lineEnd);
     nextLine();
     return line;
 }
 
 /**
  * Initializes the line tokenizer for reading tokens and invokes nextToken()
- * and nextLine().
+ * and nextLine(). Tokens keep pointing into the buffer, so they stay valid
+ * after the line has been advanced.
  */
 void SASParser::acceptTokenLine() {
-    lineVector.clear();
-    currentTokenIndex = 0;
-
-    auto start = 0U;
-    auto end = curLine.find(" ");
-    while (end != std::string::npos)
-    {
-        std::string token = curLine.substr(start, end - start);
-        lineVector.push_back(token);
-        start = end + 1;
-        end = curLine.find(" ", start);
-    }
-    lineVector.push_back(curLine.substr(start, end));
+    tokenPosition = lineBegin;
+    tokenLineEnd = lineEnd;
+    tokenBegin = tokenEnd = lineBegin;
 
     nextToken();
     nextLine();
@@ -170,9 +304,11 @@ void SASParser::acceptTokenLine() {
  * Reads next token
  */
 void SASParser::nextToken() {
-    if (currentTokenIndex < lineVector.size()) {
-        curToken = lineVector[currentTokenIndex];
-        currentTokenIndex++;
+    while (tokenPosition < tokenLineEnd && *tokenPosition == ' ') tokenPosition++;
+    if (tokenPosition < tokenLineEnd) {
+        tokenBegin = tokenPosition;
+        while (tokenPosition < tokenLineEnd && *tokenPosition != ' ') tokenPosition++;
+        tokenEnd = tokenPosition;
     }
 }
 
@@ -181,7 +317,7 @@ void SASParser::nextToken() {
  * Invokes nextToken().
  */
 int SASParser::acceptAnyIntToken() {
-    int number = std::stoi(curToken);
+    int number = parseInt(tokenBegin, tokenEnd);
     nextToken();
     return number;
 }
@@ -193,7 +329,7 @@ int SASParser::acceptAnyIntToken() {
  * Returns MAGIC_ERROR otherwise.
  */
 int SASParser::acceptIntTokenRange(int min, int max) {
-    int number = std::stoi(curToken);
+    int number = parseInt(tokenBegin, tokenEnd);
     if (min <= number && number <= max) {
         nextToken();
         return number;
@@ -212,7 +348,7 @@ int SASParser::expectIntTokenRange(int min, int max) {
     }
 
     std::string msg = "Expected int between " + std::to_string(min) + " and ";
-    msg += std::to_string(max) + " inclusively, got " + curToken;
+    msg += std::to_string(max) + " inclusively, got " + std::string(tokenBegin, tokenEnd);
     error(msg);
     return MAGIC_ERROR;
 }
@@ -282,8 +418,8 @@ void SASParser::variables() {
         expect(VARIABLE_HEADER);
         // Variable name (mostly useless, so we will skip it)
         acceptAnyLine();
-        // axiom layer; we're not concerned with that for now
-        acceptAnyLine();
+        // Axiom layer (-1 unless the variable is derived by axioms)
+        problemBuilder->setVariableAxiomLayer(v, acceptAnyInt());
 
         // Domain size of the variable
         variableDomainSizes[i] = acceptAnyInt();
@@ -385,6 +521,12 @@ void SASParser::goalstate() {
 
 /**
  * Parse the operator section
+ *
+ * With more than one thread, this is done in three phases: first the start of
+ * every operator block is found, then chunks of blocks are decoded in parallel
+ * into separate buffers, and finally the operators are added to the builder in
+ * the order of the file. Action numbers therefore don't depend on the amount of
+ * threads.
  */
 void SASParser::operators() {
     log(2, "Parsing operator section\n");
@@ -393,38 +535,123 @@ void SASParser::operators() {
     int countOperators = acceptAnyInt(); // + problem->countPropositions;
     problemBuilder->setActionCount(countOperators);
 
-    // Parse actions
+    if (threadCount <= 1 || countOperators < 2) {
+        // Decode and add the operators one after another
+        OperatorData op;
+        for (int i = 0; i < countOperators; i++) {
+            operatorBlock(op);
+            addOperator(op);
+        }
+        return;
+    }
+
+    // Phase 1: find the start of every operator block
+    std::vector<const char*> blockStarts(countOperators);
     for (int i = 0; i < countOperators; i++) {
-        expect(OPERATION_HEADER);
+        blockStarts[i] = skipOperatorBlock();
+    }
+
+    // Phase 2: decode chunks of blocks in parallel. There are more chunks than
+    // threads, so that the pool can balance blocks of different sizes.
+    int chunkCount = std::min(countOperators, threadCount * 8);
+    std::vector<std::vector<OperatorData>> chunks(chunkCount);
+    std::vector<std::future<void>> decoded;
+    ThreadPool pool(threadCount, pinThreads);
+    for (int c = 0; c < chunkCount; c++) {
+        int first = (long) countOperators * c / chunkCount;
+        int last = (long) countOperators * (c+1) / chunkCount;
+        decoded.push_back(pool.submit([this, &blockStarts, &chunks, c, first, last]() {
+            // A copy of the parser reads the chunk from its first block on
+            SASParser decoder(*this);
+            decoder.position = blockStarts[first];
+            decoder.nextLine();
+            chunks[c].resize(last - first);
+            for (int i = first; i < last; i++) {
+                decoder.operatorBlock(chunks[c][i - first]);
+            }
+        }));
+    }
 
-        Action action = problemBuilder->addAction();
+    // Phase 3: add the operators in the order of the file
+    for (int c = 0; c < chunkCount; c++) {
+        decoded[c].get();
+        for (const OperatorData& op : chunks[c]) {
+            addOperator(op);
+        }
+        std::vector<OperatorData>().swap(chunks[c]);
+    }
+}
 
-        // Get operator name
-        problemBuilder->setActionName(action, acceptAnyLine());
+/**
+ * Skips an operator block and returns the position where it starts
+ */
+const char* SASParser::skipOperatorBlock() {
+    const char *start = lineBegin;
+    expect(OPERATION_HEADER);
+    while (!accept(OPERATION_FOOTER)) {
+        nextLine();
+    }
+    return start;
+}
 
-        // Prevail conditions
-        int countPrevailConditions = acceptAnyInt();
-        for (int j = 0; j < countPrevailConditions; j++) {
-            acceptTokenLine();
-            int variable, value;
-            expectVarValuePair(&variable, &value);
+/**
+ * Parse an operator block into the given buffer
+ */
+void SASParser::operatorBlock(OperatorData& op) {
+    expect(OPERATION_HEADER);
 
-            problemBuilder->addActionPrecondition(action, Proposition(variable, value));
-            problemBuilder->addActionPosEffect(action, Proposition(variable, value));
-        }
+    op.precs.clear();
+    op.posEffs.clear();
+    op.negEffs.clear();
+    op.condEffs.clear();
 
-        // Effects
-        int countEffects = acceptAnyInt();
-        for (int j = 0; j < countEffects; j++) {
-            acceptTokenLine();
-            operatorEffect(action);
-        }
+    // Get operator name
+    op.name = acceptAnyLine();
 
-        // Operator cost (we don't expect this to play a role, since we only expect
-        // "metric" problems)
-        acceptAnyLine();
+    // Prevail conditions
+    int countPrevailConditions = acceptAnyInt();
+    for (int j = 0; j < countPrevailConditions; j++) {
+        acceptTokenLine();
+        int variable, value;
+        expectVarValuePair(&variable, &value);
+
+        op.precs.push_back(Proposition(variable, value));
+        op.posEffs.push_back(Proposition(variable, value));
+    }
+
+    // Effects
+    int countEffects = acceptAnyInt();
+    for (int j = 0; j < countEffects; j++) {
+        acceptTokenLine();
+        operatorEffect(op);
+    }
+
+    // Operator cost (we don't expect this to play a role, since we only expect
+    // "metric" problems)
+    acceptAnyLine();
+
+    expect(OPERATION_FOOTER);
+}
+
+/**
+ * Adds a decoded operator to the problem
+ */
+void SASParser::addOperator(const OperatorData& op) {
+    Action action = problemBuilder->addAction();
+    problemBuilder->setActionName(action, op.name);
 
-        expect(OPERATION_FOOTER);
+    for (Proposition p : op.precs) {
+        problemBuilder->addActionPrecondition(action, p);
+    }
+    for (Proposition p : op.posEffs) {
+        problemBuilder->addActionPosEffect(action, p);
+    }
+    for (Proposition p : op.negEffs) {
+        problemBuilder->addActionNegEffect(action, p);
+    }
+    for (const ConditionalEffect& effect : op.condEffs) {
+        problemBuilder->addActionConditionalEffect(action, effect.conditions,
+            effect.posEffects, effect.negEffects);
     }
 }
 
@@ -432,18 +659,15 @@ void SASParser::operators() {
 /**
  * Parse an effect of an operator
  */
-void SASParser::operatorEffect(Action action) {
+void SASParser::operatorEffect(OperatorData& op) {
     int countEffConditions = acceptAnyIntToken();
 
     // For STRIPS, there are usually no effect conditions
-    if (countEffConditions != 0) {
-        log(0, "WARNING: amount of effect conditions is not zero!\n");
-    }
-
+    std::list<Proposition> conditions;
     for (int i = 0; i < countEffConditions; i++) {
         int variable, value;
         expectVarValuePair(&variable, &value);
-        // We usually don't have this case, so nothing useful implemented here
+        conditions.push_back(Proposition(variable, value));
     }
 
     // Get affected variable, "precondition" and "effect"
@@ -452,15 +676,30 @@ void SASParser::operatorEffect(Action action) {
     int preValue = expectIntTokenRange(-1, range-1);
     int postValue = expectIntTokenRange(0, range-1);
 
-    // If the effect needs the variable to have a certain value, then
-    // add that as both a precondition and a negative effect
+    // The "precondition" is a precondition of the whole operator, even if the
+    // effect itself is conditional
     if (preValue != -1) {
-        problemBuilder->addActionPrecondition(action, Proposition(variable, preValue));
-        problemBuilder->addActionNegEffect(action, Proposition(variable, preValue));
+        op.precs.push_back(Proposition(variable, preValue));
     }
 
-    // Add positive effect for both action and variable
-    problemBuilder->addActionPosEffect(action, Proposition(variable, postValue));
+    if (conditions.empty()) {
+        // If the effect needs the variable to have a certain value, then
+        // that is also a negative effect
+        if (preValue != -1) {
+            op.negEffs.push_back(Proposition(variable, preValue));
+        }
+
+        // Add positive effect for both action and variable
+        op.posEffs.push_back(Proposition(variable, postValue));
+    } else {
+        ConditionalEffect effect;
+        effect.conditions = conditions;
+        effect.posEffects.push_back(Proposition(variable, postValue));
+        if (preValue != -1) {
+            effect.negEffects.push_back(Proposition(variable, preValue));
+        }
+        op.condEffs.push_back(effect);
+    }
 }
 
 
@@ -468,6 +707,36 @@ void SASParser::operatorEffect(Action action) {
  * Parse the axiom section
  */
 void SASParser::axioms() {
-    // We don't expect the inputs to have axioms...
+    log(2, "Parsing axiom section\n");
+
+    int countAxioms = acceptAnyInt();
+    for (int i = 0; i < countAxioms; i++) {
+        axiomBlock();
+    }
 }
 
+/**
+ * Parse an axiom block, i.e. the body of the rule followed by the derived
+ * variable with its default and derived value
+ */
+void SASParser::axiomBlock() {
+    expect(AXIOM_HEADER);
+
+    std::list<Proposition> body;
+    int countConditions = acceptAnyInt();
+    for (int j = 0; j < countConditions; j++) {
+        acceptTokenLine();
+        int variable, value;
+        expectVarValuePair(&variable, &value);
+        body.push_back(Proposition(variable, value));
+    }
+
+    acceptTokenLine();
+    int variable = expectIntTokenRange(0, countVariables-1);
+    int range = variableDomainSizes[variable];
+    expectIntTokenRange(0, range-1);
+    int derivedValue = expectIntTokenRange(0, range-1);
+    problemBuilder->addAxiom(body, Proposition(variable, derivedValue));
+
+    expect(AXIOM_FOOTER);
+}
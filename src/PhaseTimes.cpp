@@ -0,0 +1,36 @@
+#include <atomic>
+
+#include "PhaseTimes.h"
+
+
+// Times are accumulated in microseconds, so they can be added atomically
+static std::atomic<long long> phaseMicroseconds[PHASE_COUNT];
+
+static const char *phaseNames[PHASE_COUNT] = {"parse", "expand", "encode", "solve"};
+
+
+void addPhaseTime(Phase phase, double seconds) {
+    phaseMicroseconds[phase].fetch_add((long long) (seconds * 1e6), std::memory_order_relaxed);
+}
+
+double getPhaseTime(Phase phase) {
+    return phaseMicroseconds[phase].load(std::memory_order_relaxed) / 1e6;
+}
+
+void resetPhaseTimes() {
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        phaseMicroseconds[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+const char* getPhaseName(Phase phase) {
+    return phaseNames[phase];
+}
+
+void printPhaseTimes() {
+    log(0, "Phase times: %s=%.6f %s=%.6f %s=%.6f %s=%.6f\n",
+            getPhaseName(PHASE_PARSE), getPhaseTime(PHASE_PARSE),
+            getPhaseName(PHASE_EXPAND), getPhaseTime(PHASE_EXPAND),
+            getPhaseName(PHASE_ENCODE), getPhaseTime(PHASE_ENCODE),
+            getPhaseName(PHASE_SOLVE), getPhaseTime(PHASE_SOLVE));
+}
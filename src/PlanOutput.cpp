@@ -0,0 +1,179 @@
+#include <mutex>
+#include <cstdio>
+
+#include "PlanOutput.h"
+#include "PhaseTimes.h"
+#include "Settings.h"
+#include "Logger.h"
+
+
+static std::mutex emitMutex;
+static bool planEmitted = false;
+// Times in the output are relative to this
+static double outputStartTime = 0;
+
+
+void emitPlan(IPlanningProblem *problem, Plan plan) {
+    std::unique_lock<std::mutex> lck(emitMutex);
+    if (planEmitted) return;
+    planEmitted = true;
+
+    printPlan(problem, plan);
+    if (!settings->getPlanFile().empty()) {
+        writePlanFile(problem, &plan, settings->getPlanFile());
+    }
+}
+
+void emitImprovedPlan(IPlanningProblem *problem, Plan plan) {
+    std::unique_lock<std::mutex> lck(emitMutex);
+    planEmitted = true;
+
+    printPlan(problem, plan);
+    if (!settings->getPlanFile().empty()) {
+        writePlanFile(problem, &plan, settings->getPlanFile());
+    }
+}
+
+void emitNoPlan() {
+    std::unique_lock<std::mutex> lck(emitMutex);
+    if (planEmitted) return;
+    planEmitted = true;
+
+    if (!settings->getPlanFile().empty() && settings->getPlanFormat() == PLAN_FORMAT_JSON) {
+        writePlanFile(nullptr, nullptr, settings->getPlanFile());
+    }
+}
+
+void resetPlanOutput() {
+    std::unique_lock<std::mutex> lck(emitMutex);
+    planEmitted = false;
+    outputStartTime = getTime();
+}
+
+bool isPlanEmitted() {
+    std::unique_lock<std::mutex> lck(emitMutex);
+    return planEmitted;
+}
+
+void printPlan(IPlanningProblem *problem, Plan plan) {
+    // Output plan (short version)
+    log(0, "BEGIN PLAN\n");
+    int step = 0;
+    log(0, "LAYER\tSTEP\tACTION\n");
+    for (int layerNumber = 0; layerNumber < plan.getLayerCount(); layerNumber++) {
+        std::list<Action> layer = plan.getLayerActions(layerNumber);
+        for (Action action : layer) {
+            if (!problem->isTrivialAction(action))  {
+                log(0, "%d\t%d\t%s\n", layerNumber+1, step+1, problem->getActionName(action).c_str());
+                step++;
+            }
+        }
+    }
+    log(0, "END PLAN\n");
+}
+
+// Writes a string as a JSON string literal
+static void writeJsonString(FILE *out, const std::string& s) {
+    fputc('"', out);
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            fputc('\\', out);
+            fputc(c, out);
+        } else if ((unsigned char) c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// Writes the result as JSON, over multiple lines or in a single line
+static void writeJsonPlan(FILE *out, IPlanningProblem *problem, Plan *plan, const char *file, bool pretty) {
+    const char *newline = pretty ? "\n  " : " ";
+    fprintf(out, "{%s", pretty ? "\n  " : "");
+    if (file) {
+        fprintf(out, "\"file\": ");
+        writeJsonString(out, file);
+        fprintf(out, ",%s", newline);
+    }
+    fprintf(out, "\"solved\": %s,%s\"planner\": ", plan ? "true" : "false", newline);
+    writeJsonString(out, settings->getPlannerName());
+    fprintf(out, ",%s\"threads\": %d,%s\"time\": %.6f,%s\"phases\": {",
+            newline, settings->getThreadCount(), newline, getTime() - outputStartTime, newline);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(out, "%s\"%s\": %.6f", i ? ", " : "", getPhaseName((Phase) i), getPhaseTime((Phase) i));
+    }
+    fprintf(out, "}");
+
+    if (plan) {
+        int step = 0;
+        fprintf(out, ",%s\"makespan\": %d,%s\"plan\": [", newline, plan->getLayerCount(), newline);
+        for (int layerNumber = 0; layerNumber < plan->getLayerCount(); layerNumber++) {
+            for (Action action : plan->getLayerActions(layerNumber)) {
+                if (problem->isTrivialAction(action)) continue;
+                fprintf(out, "%s%s{\"layer\": %d, \"step\": %d, \"action\": ", step ? "," : "",
+                        pretty ? "\n    " : (step ? " " : ""), layerNumber+1, step+1);
+                writeJsonString(out, problem->getActionName(action));
+                fprintf(out, "}");
+                step++;
+            }
+        }
+        fprintf(out, "%s],%s\"length\": %d", pretty ? "\n  " : "", newline, step);
+    }
+    fprintf(out, "%s}\n", pretty ? "\n" : "");
+}
+
+// The IPC format lists the actions in order, one per line in parentheses
+static void writeIpcPlan(FILE *out, IPlanningProblem *problem, Plan *plan) {
+    int step = 0;
+    for (int layerNumber = 0; layerNumber < plan->getLayerCount(); layerNumber++) {
+        for (Action action : plan->getLayerActions(layerNumber)) {
+            if (problem->isTrivialAction(action)) continue;
+            fprintf(out, "(%s)\n", problem->getActionName(action).c_str());
+            step++;
+        }
+    }
+    fprintf(out, "; cost = %d (unit cost)\n", step);
+}
+
+void writePlanFile(IPlanningProblem *problem, Plan *plan, std::string file) {
+    std::string tmpFile = file + ".tmp";
+    FILE *out = fopen(tmpFile.c_str(), "w");
+    if (out == nullptr) {
+        log(0, "Could not write plan to %s\n", file.c_str());
+        return;
+    }
+
+    if (settings->getPlanFormat() == PLAN_FORMAT_JSON) {
+        writeJsonPlan(out, problem, plan, nullptr, true);
+    } else {
+        writeIpcPlan(out, problem, plan);
+    }
+
+    if (fclose(out) != 0 || rename(tmpFile.c_str(), file.c_str()) != 0) {
+        log(0, "Could not write plan to %s\n", file.c_str());
+        remove(tmpFile.c_str());
+        return;
+    }
+    log(1, "Plan written to %s\n", file.c_str());
+}
+
+// The stream is locked, so log messages can't end up within the line
+void writePlanResult(FILE *out, const char *file, IPlanningProblem *problem, Plan *plan) {
+    flockfile(out);
+    writeJsonPlan(out, problem, plan, file, false);
+    fflush(out);
+    funlockfile(out);
+}
+
+void writeErrorResult(FILE *out, const char *file, std::string message) {
+    flockfile(out);
+    fprintf(out, "{\"file\": ");
+    writeJsonString(out, file);
+    fprintf(out, ", \"error\": ");
+    writeJsonString(out, message);
+    fprintf(out, "}\n");
+    fflush(out);
+    funlockfile(out);
+}
@@ -0,0 +1,318 @@
+#include <set>
+#include <algorithm>
+
+#include "PlanPostprocessor.h"
+#include "Logger.h"
+
+
+PlanPostprocessor::PlanPostprocessor(IPlanningProblem *problem) {
+    this->problem = problem;
+
+    // The first proposition layer is the initial state
+    initialState.assign(problem->getVariableCount(), -1);
+    for (Proposition p : problem->getLayerPropositions(problem->getFirstLayer())) {
+        initialState[p.first] = p.second;
+    }
+    deriveVariables(initialState);
+    goal = problem->getGoal();
+
+    if (problem->hasAxioms()) {
+        std::set<Variable> variables;
+        for (Axiom& axiom : problem->getAxioms()) {
+            for (Proposition p : axiom.body) {
+                variables.insert(p.first);
+            }
+        }
+        axiomVariables.assign(variables.begin(), variables.end());
+    }
+}
+
+bool PlanPostprocessor::holds(State& state, std::list<Proposition>& propositions) {
+    for (Proposition p : propositions) {
+        if (state[p.first] != p.second) return false;
+    }
+    return true;
+}
+
+/**
+ * Derived variables have their default value unless an axiom derives the
+ * other one. Axioms are applied until nothing changes.
+ */
+void PlanPostprocessor::deriveVariables(State& state) {
+    if (!problem->hasAxioms()) return;
+
+    for (Variable v : problem->getDerivedVariables()) {
+        state[v] = problem->getDerivedDefaultValue(v);
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (Axiom& axiom : problem->getAxioms()) {
+            if (state[axiom.head.first] != axiom.head.second && holds(state, axiom.body)) {
+                state[axiom.head.first] = axiom.head.second;
+                changed = true;
+            }
+        }
+    }
+}
+
+void PlanPostprocessor::apply(State& state, Action a) {
+    // Conditions of effects are evaluated before the action
+    State before = state;
+    for (Proposition p : problem->getActionPosEffects(a)) {
+        state[p.first] = p.second;
+    }
+    for (ConditionalEffect& effect : problem->getActionConditionalEffects(a)) {
+        if (holds(before, effect.conditions)) {
+            for (Proposition p : effect.posEffects) {
+                state[p.first] = p.second;
+            }
+        }
+    }
+    deriveVariables(state);
+}
+
+bool PlanPostprocessor::isValid(Plan& plan) {
+    State state = initialState;
+    for (int step = 0; step < plan.getLayerCount(); step++) {
+        State next = state;
+        // Value that was set for each variable in this step
+        std::vector<VariableValue> written(state.size(), -1);
+        // Action of this step that reads and that changes each variable (-1
+        // for none, -2 for more than one reader)
+        std::vector<Action> reader(state.size(), -1);
+        std::vector<Action> changer(state.size(), -1);
+        for (Action a : plan.getLayerActions(step)) {
+            if (problem->isTrivialAction(a)) continue;
+            if (!holds(state, problem->getActionPreconditions(a))) {
+                log(0, "Invalid plan: precondition of %s doesn't hold in step %d\n",
+                        problem->getActionName(a).c_str(), step+1);
+                return false;
+            }
+
+            std::vector<Variable> reads;
+            for (Proposition p : problem->getActionPreconditions(a)) {
+                reads.push_back(p.first);
+            }
+            std::list<Proposition> effects = problem->getActionPosEffects(a);
+            for (ConditionalEffect& effect : problem->getActionConditionalEffects(a)) {
+                for (Proposition p : effect.conditions) {
+                    reads.push_back(p.first);
+                }
+                if (holds(state, effect.conditions)) {
+                    effects.insert(effects.end(), effect.posEffects.begin(), effect.posEffects.end());
+                }
+            }
+            addAxiomReads(reads);
+            for (Variable v : reads) {
+                reader[v] = (reader[v] == -1 || reader[v] == a) ? a : -2;
+            }
+
+            for (Proposition p : effects) {
+                if (written[p.first] != -1 && written[p.first] != p.second) {
+                    log(0, "Invalid plan: %s sets %s in step %d, which another action changes\n",
+                            problem->getActionName(a).c_str(), problem->getPropositionName(p).c_str(), step+1);
+                    return false;
+                }
+                written[p.first] = p.second;
+                next[p.first] = p.second;
+                if (state[p.first] != p.second) {
+                    changer[p.first] = a;
+                }
+            }
+        }
+
+        // The actions of a step are output in sequence, which only works if
+        // none of them changes what another one reads
+        for (Variable v = 0; v < (Variable) state.size(); v++) {
+            if (changer[v] != -1 && reader[v] != -1 && reader[v] != changer[v]) {
+                log(0, "Invalid plan: %s changes %s in step %d, which another action reads\n",
+                        problem->getActionName(changer[v]).c_str(),
+                        problem->getPropositionName(Proposition(v, next[v])).c_str(), step+1);
+                return false;
+            }
+        }
+
+        deriveVariables(next);
+        state = next;
+    }
+
+    if (!holds(state, goal)) {
+        log(0, "Invalid plan: goal doesn't hold after the last step\n");
+        return false;
+    }
+    return true;
+}
+
+bool PlanPostprocessor::isValidSequence(std::vector<Action>& actions) {
+    State state = initialState;
+    for (Action a : actions) {
+        if (!holds(state, problem->getActionPreconditions(a))) return false;
+        apply(state, a);
+    }
+    return holds(state, goal);
+}
+
+Plan PlanPostprocessor::improve(Plan& plan) {
+    std::vector<Action> actions = linearize(plan);
+    // The actions of a valid plan can be applied in sequence, which action
+    // elimination relies on. Invalid plans are left to the caller to reject.
+    if (!isValid(plan) || !isValidSequence(actions)) {
+        return plan;
+    }
+
+    std::vector<char> removed = eliminateActions(actions);
+    std::vector<Action> kept;
+    for (size_t i = 0; i < actions.size(); i++) {
+        if (!removed[i]) kept.push_back(actions[i]);
+    }
+    Plan result = parallelize(kept);
+
+    // The steps of the planner may still be shorter, since they can contain
+    // actions that only depend on each other when applied in sequence
+    Plan reduced;
+    size_t index = 0;
+    for (int step = 0; step < plan.getLayerCount(); step++) {
+        std::list<Action> layer;
+        for (Action a : plan.getLayerActions(step)) {
+            if (problem->isTrivialAction(a)) continue;
+            if (!removed[index++]) layer.push_back(a);
+        }
+        if (!layer.empty()) reduced.addLayer(layer);
+    }
+    if (reduced.getLayerCount() < result.getLayerCount() && isValid(reduced)) {
+        result = reduced;
+    }
+
+    log(0, "Post-processed plan: %d actions in %d steps (before: %d actions in %d steps)\n",
+            (int) kept.size(), result.getLayerCount(), (int) actions.size(), plan.getLayerCount());
+    return result;
+}
+
+std::vector<Action> PlanPostprocessor::linearize(Plan& plan) {
+    std::vector<Action> actions;
+    for (int step = 0; step < plan.getLayerCount(); step++) {
+        for (Action a : plan.getLayerActions(step)) {
+            if (!problem->isTrivialAction(a)) {
+                actions.push_back(a);
+            }
+        }
+    }
+    return actions;
+}
+
+/**
+ * Removes each action that the plan reaches the goal without. Later actions
+ * that depend on a removed action are removed with it. The state before the
+ * current action doesn't change by removing it or later actions, so it is
+ * kept across the candidates.
+ */
+std::vector<char> PlanPostprocessor::eliminateActions(std::vector<Action>& actions) {
+    std::vector<char> removed(actions.size(), 0);
+    State prefix = initialState;
+    for (size_t i = 0; i < actions.size(); i++) {
+        if (removed[i]) continue;
+        std::vector<char> candidate = removed;
+        candidate[i] = 1;
+        State state = prefix;
+        for (size_t j = i+1; j < actions.size(); j++) {
+            if (candidate[j]) continue;
+            if (!holds(state, problem->getActionPreconditions(actions[j]))) {
+                candidate[j] = 1;
+                continue;
+            }
+            apply(state, actions[j]);
+        }
+
+        if (holds(state, goal)) {
+            removed = candidate;
+        } else {
+            apply(prefix, actions[i]);
+        }
+    }
+    return removed;
+}
+
+void PlanPostprocessor::getActionVariables(Action a, std::vector<Variable>& reads, std::vector<Variable>& writes) {
+    std::list<Proposition>& preconditions = problem->getActionPreconditions(a);
+    for (Proposition p : preconditions) {
+        reads.push_back(p.first);
+    }
+    // An effect that keeps the value of the precondition only reads it
+    for (Proposition p : problem->getActionPosEffects(a)) {
+        if (std::find(preconditions.begin(), preconditions.end(), p) == preconditions.end()) {
+            writes.push_back(p.first);
+        }
+    }
+    for (Proposition p : problem->getActionNegEffects(a)) {
+        writes.push_back(p.first);
+    }
+    for (ConditionalEffect& effect : problem->getActionConditionalEffects(a)) {
+        for (Proposition p : effect.conditions) {
+            reads.push_back(p.first);
+        }
+        for (Proposition p : effect.posEffects) {
+            writes.push_back(p.first);
+        }
+        for (Proposition p : effect.negEffects) {
+            writes.push_back(p.first);
+        }
+    }
+
+    addAxiomReads(reads);
+}
+
+/**
+ * Reading a derived variable reads everything it is derived from
+ */
+void PlanPostprocessor::addAxiomReads(std::vector<Variable>& reads) {
+    size_t readCount = reads.size();
+    for (size_t i = 0; i < readCount; i++) {
+        if (problem->isDerivedProposition(Proposition(reads[i], 0))) {
+            reads.insert(reads.end(), axiomVariables.begin(), axiomVariables.end());
+            return;
+        }
+    }
+}
+
+/**
+ * Puts each action into the first step after all earlier actions it
+ * interferes with.
+ */
+Plan PlanPostprocessor::parallelize(std::vector<Action>& actions) {
+    // Last step in which each variable was read and written
+    std::vector<int> lastRead(problem->getVariableCount(), -1);
+    std::vector<int> lastWrite(problem->getVariableCount(), -1);
+    std::vector<std::list<Action>> steps;
+
+    for (Action a : actions) {
+        std::vector<Variable> reads;
+        std::vector<Variable> writes;
+        getActionVariables(a, reads, writes);
+
+        int step = 0;
+        for (Variable v : reads) {
+            step = std::max(step, lastWrite[v]+1);
+        }
+        for (Variable v : writes) {
+            step = std::max(step, std::max(lastWrite[v], lastRead[v])+1);
+        }
+
+        for (Variable v : reads) {
+            lastRead[v] = std::max(lastRead[v], step);
+        }
+        for (Variable v : writes) {
+            lastWrite[v] = std::max(lastWrite[v], step);
+        }
+        if (step >= (int) steps.size()) {
+            steps.resize(step+1);
+        }
+        steps[step].push_back(a);
+    }
+
+    Plan plan;
+    for (std::list<Action>& step : steps) {
+        plan.addLayer(step);
+    }
+    return plan;
+}
@@ -2,34 +2,47 @@
 #include <iterator>
 #include <algorithm>
 #include <assert.h>
+#include <climits>
 #include <map>
 
-#include <unistd.h>
+#include <chrono>
 #include <thread>
 
 #include "Planners/LPEPEPlanner.h"
 #include "Logger.h"
 #include "Settings.h"
+#include "PhaseTimes.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Memory.h"
+#include "PlanOutput.h"
+#include "PlanPostprocessor.h"
 #include "common.h"
 
-#ifdef IPASIRCPP
-#include "ipasir.h"
-#else
-extern "C" {
-    #include "ipasir_cpp.h"
-}
-#endif
+#include "ipasir_cpp.h"
 
 
 
-LPEPEPlanner::LPEPEPlanner(IPlanningProblem *problem) {
+LPEPEPlanner::LPEPEPlanner(IPlanningProblem *problem, SATPriorityThreadPool *pool) {
     this->problem = problem;
     problemSolved = false;
+    outOfMemory = false;
+    lastFailedLayer = 0;
+    horizonOffset = 0;
+    fixedActionLayer = 0;
 
     // Create thread pool with 1 tag (0)
     int threadCount = settings->getThreadCount();
-    threadPool = new SATPriorityThreadPool(1);
-    threadPool->addWorkers(0, threadCount, createSATSolver, this);
+    if (pool) {
+        // Workers of a previous problem get fresh solvers
+        threadPool = pool;
+        ownsThreadPool = false;
+        threadPool->resetSolvers(0, createSATSolver, this);
+    } else {
+        threadPool = new SATPriorityThreadPool(1);
+        ownsThreadPool = true;
+        threadPool->addWorkers(0, threadCount, createSATSolver, this);
+    }
 
     // Get action and proposition count from problem data
     countActions = problem->getActionCount();
@@ -37,18 +50,25 @@ LPEPEPlanner::LPEPEPlanner(IPlanningProblem *problem) {
 }
 
 LPEPEPlanner::~LPEPEPlanner() {
-    delete threadPool;
+    if (ownsThreadPool) {
+        delete threadPool;
+    } else {
+        // Remaining jobs refer to this planner
+        threadPool->waitIdle(0);
+    }
 }
 
 int LPEPEPlanner::graphplan(Plan& plan) {
-    log(0, "SPPSAT algorithm using SAT Solver %s\n", ipasir_signature());
+    log(0, "LPEPE algorithm using SAT Solver %s\n", ipasir_signature());
 
-    // Expand the graph until we hit a fixed-point level or we find out that
-    // the problem is unsolvable.
-    while (!fixedPoint && checkGoalUnreachable()) {
-        expand();
-        fixedPoint = fixedPoint || checkFixedPoint();
-        horizonOffset++;
+    if (problem->hasConditionalEffects() || problem->hasAxioms()) {
+        throw ProblemError("Conditional effects and axioms are only supported by -p=satex and -p=sppsat");
+    }
+
+    // The encoding needs the complete graph, so expand until it levels off
+    while (!fixedPoint) {
+        Planner::expand();
+        fixedPoint = checkFixedPoint();
     }
 
     // If goal is impossible to reach, this problem has no solution
@@ -57,100 +77,201 @@ int LPEPEPlanner::graphplan(Plan& plan) {
         return false;
     }
 
-    // Inverted horizon, used to determine how far to expand before "going idle"
+    // The first horizon to try is the first layer where the goal is reachable
+    std::list<Proposition> goal = problem->getGoal();
+    horizonOffset = problem->getLastActionLayer();
+    for (int layer = problem->getFirstLayer(); layer <= problem->getLastLayer(); layer++) {
+        bool reachable = true;
+        for (Proposition g : goal) {
+            if (!problem->isPropEnabled(g, layer)) reachable = false;
+            for (Proposition h : goal) {
+                if (g == h) break;
+                if (problem->isMutexProp(g, h, layer)) reachable = false;
+            }
+        }
+        if (reachable) {
+            horizonOffset = problem->getActionLayerBeforePropLayer(layer);
+            break;
+        }
+    }
+
+    prepareEncoding();
+
+    // Inverted horizon, used to determine how far to go before "going idle"
     std::map<int, int> horizonInv;
     int iteration = 0;
+    int seenFinishedJobs = 0;
+
+    while (!problemSolved && !outOfMemory) {
+        enforceMemoryBudget();
 
-    while (!problemSolved) {
-        // Determine if graph shall be expanded
-        bool doExpand = false;
+        // Determine if another job shall be queued
+        bool doQueue = false;
         {
             // Calculation depends on the layer of the last failed extraction
             std::unique_lock<std::mutex> lck(lastFailedLayerMutex);
-            // Expand far enough (so that each thread has something to work with)
+            seenFinishedJobs = finishedJobs;
+            // Queue enough jobs so that each thread has something to work with
             if (iteration <= horizonInv[lastFailedLayer]+settings->getThreadCount()) {
-                doExpand = true;
+                doQueue = true;
             }
         }
 
-        if (doExpand) {
+        if (doQueue) {
             // Extract at horizon level
             int extractionLayer = horizon(iteration);
             horizonInv[extractionLayer] = iteration;
 
-            // Queue an extraction job to the pool
+            // Queue an extraction job to the pool, shorter horizons first
             ThreadParameters *tp = new ThreadParameters();
             tp->planner = this;
             tp->layer = extractionLayer;
             SATPriorityThreadPool::Job j;
             j.func = extractionThread;
             j.arguments = (void*)tp;
-            threadPool->enqueueJob(extractionLayer, 0, j);
-
-            // Expand the graph to the horizon
-            while (problem->getLastActionLayer() < horizon(iteration+1)) {
-                expand();
-                fixedPoint = fixedPoint || checkFixedPoint();
-            }
+            threadPool->enqueueJob(0, extractionLayer, j);
 
             iteration++;
         } else {
-            sleep(1);
+            // Wait until a job finished (or check the memory budget again)
+            std::unique_lock<std::mutex> lck(lastFailedLayerMutex);
+            jobFinished.wait_for(lck, std::chrono::seconds(1),
+                    [&]() { return finishedJobs != seenFinishedJobs; });
         }
     }
 
+    if (!problemSolved) {
+        log(0, "Memory budget exceeded, giving up\n");
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lck(solvedMutex);
     plan = solution;
 
     return true;
 }
 
+/**
+ * Reduces the amount of workers while the memory budget is exceeded, which
+ * releases their solvers. Gives up if a single worker is already too much.
+ */
+void LPEPEPlanner::enforceMemoryBudget() {
+    if (!isOverMemoryBudget()) return;
+
+    // Fewer solvers can't help if the planning graph alone is too large
+    if (getGraphMemory() > getMemoryBudget()) {
+        if (!outOfMemory) {
+            log(0, "The planning graph alone needs %s, more than the memory budget of %s\n",
+                    formatMemory(getGraphMemory()).c_str(), formatMemory(getMemoryBudget()).c_str());
+        }
+        outOfMemory = true;
+        return;
+    }
+
+    // Wait until the last retired worker has released its solver
+    int workers = threadPool->getWorkerLimit(0);
+    if (threadPool->getRunningWorkerCount(0) > workers) return;
+
+    if (workers > 1) {
+        log(0, "Memory budget exceeded, reducing to %d workers\n", workers-1);
+        threadPool->setWorkerLimit(0, workers-1);
+    } else {
+        outOfMemory = true;
+    }
+}
+
+/**
+ * Collects reachable actions, the initial state and the action mutexes of the
+ * leveled-off planning graph. Mutexes that still hold in the last layer will
+ * hold in every later layer too, so they are permanent.
+ */
+void LPEPEPlanner::prepareEncoding() {
+    fixedActionLayer = problem->getLastActionLayer();
+    LayerView<Proposition> props = problem->getLayerPropositions(problem->getLastLayer());
+    reachablePropositions.assign(props.begin(), props.end());
+
+    for (Action a = 0; a < countActions; a++) {
+        if (problem->getActionFirstLayer(a) > 0) {
+            reachableActions.push_back(a);
+        }
+    }
+
+    for (unsigned int i = 0; i < reachableActions.size(); i++) {
+        Action a = reachableActions[i];
+        for (unsigned int j = 0; j < i; j++) {
+            Action b = reachableActions[j];
+            int lastLayer = problem->getActionMutexLastLayer(a, b);
+            // Mutexes are only meaningful in layers where both actions exist
+            int firstLayer = std::max(problem->getActionFirstLayer(a), problem->getActionFirstLayer(b));
+            if (lastLayer >= fixedActionLayer) {
+                permanentMutexes.push_back(ActionMutex{a, b, INT_MAX});
+            } else if (lastLayer >= firstLayer) {
+                layeredMutexes.push_back(ActionMutex{a, b, lastLayer});
+            }
+        }
+    }
+
+    log(1, "LPEPE encoding: %d actions, %d permanent and %d layered mutexes\n",
+        (int) reachableActions.size(), (int) permanentMutexes.size(), (int) layeredMutexes.size());
+}
+
 // Initializes one SAT solver for one thread
-void* LPEPEPlanner::createSATSolver(void *args) {
+void* LPEPEPlanner::createSATSolver(void* /* args */) {
 	void *solver = ipasir_init();
 
     #ifndef PGP_NOSETLEARN
 	// Set clause learning callback
     ipasir_set_learn(solver, NULL, 0, NULL);
-	ipasir_set_terminate(solver, args, solverTerminator);
     #endif
 
     return solver;
 }
 
 // Each extraction thread is running this function which extracts a plan
-// starting from a given layer.
+// for a given horizon.
 // args has to be of type LPEPEPlanner::ThreadParameters
 void* LPEPEPlanner::extractionThread(void* solver, void* args) {
     // Get parameters for this thread
     ThreadParameters *param = (ThreadParameters*) args;
     LPEPEPlanner *planner = param->planner;
     int layer = param->layer;
+    TraceScope trace("extraction", layer);
 
-    // If problem has been solved in the meantime, abort prematurely
-    if (planner->problemSolved) {
+    // If problem has been solved or a longer horizon failed in the meantime,
+    // abort prematurely
+    if (planner->isTerminated() || planner->lastFailedLayer >= layer) {
         delete param;
         return NULL;
     }
 
-    // Get the last layer of clauses that have been added to the solver
-    int lastLayer = 1;
-    if (planner->solversLastLayer.count(solver) == 0) {
-        planner->solversLastLayer[solver] = 1;
-    } else {
+    // Get the amount of steps that have been added to the solver
+    int lastLayer = 0;
+    {
+        std::unique_lock<std::mutex> lck(planner->solversLastLayerMutex);
         lastLayer = planner->solversLastLayer[solver];
     }
 
-    // Add necessary clauses to this thread's SAT solver
-    for (int i = lastLayer; i <= layer; i++) {
-        // TODO: only add new mutexes planner->addClausesToSolver(solver, i);
-        // If problem has been solved in the meantime, abort prematurely
-        if (planner->problemSolved) {
-            delete param;
-            return NULL;
+    // Add steps in whole packs until the horizon is covered
+    if (lastLayer < layer) {
+        int packSize = std::max(1, settings->getLayerPackSize());
+        int packEnd = ((layer + packSize - 1) / packSize) * packSize;
+
+        // Guards of the new steps refer to horizon literals up to fixedActionLayer+packEnd
+        int chainStart = (lastLayer == 0) ? 0 : planner->fixedActionLayer + lastLayer;
+        planner->addHorizonChainToSolver(solver, chainStart, planner->fixedActionLayer + packEnd);
+        for (int i = lastLayer + 1; i <= packEnd; i++) {
+            planner->addClausesToSolver(solver, i);
+            planner->addNewMutexesToSolver(solver, i);
+            // If problem has been solved in the meantime, abort prematurely
+            if (planner->isTerminated()) {
+                delete param;
+                return NULL;
+            }
         }
-    }
 
-    planner->solversLastLayer[solver] = layer;
+        std::unique_lock<std::mutex> lck(planner->solversLastLayerMutex);
+        planner->solversLastLayer[solver] = packEnd;
+    }
 
     // Set termination callback for SAT solver, including information of the
     // current extraction run, e.g. which layer.
@@ -158,26 +279,57 @@ void* LPEPEPlanner::extractionThread(void* solver, void* args) {
 
     // Extract plan
     Plan plan;
-    int success = planner->extract(solver,
-            planner->problem->getGoal(),
-            planner->problem->getPropLayerAfterActionLayer(layer),
-            plan);
+    int success = planner->extract(solver, planner->problem->getGoal(), layer, plan);
 
     if (success) {
         // Mark the problem as solved so planner can terminate
         planner->markProblemSolved(plan);
+    } else if (!planner->problemSolved) {
+        // Update last failed layer so other threads can terminate that work
+        // on extraction for a shorter horizon
+        std::unique_lock<std::mutex> lck(planner->lastFailedLayerMutex);
+        if (planner->lastFailedLayer < layer) {
+            planner->lastFailedLayer = layer;
+        }
     }
+    planner->notifyJobFinished();
 
+	ipasir_set_terminate(solver, NULL, NULL);
     delete param;
 	return NULL;
 }
 
 
+bool LPEPEPlanner::isTerminated() {
+    return problemSolved || outOfMemory;
+}
+
+// Wakes the main loop, which may queue a new job now
+void LPEPEPlanner::notifyJobFinished() {
+    std::unique_lock<std::mutex> lck(lastFailedLayerMutex);
+    finishedJobs++;
+    jobFinished.notify_all();
+}
+
 // Can be called by a thread to provide a solution to the planning problem.
 void LPEPEPlanner::markProblemSolved(Plan plan) {
     std::unique_lock<std::mutex> lck(solvedMutex);
     if (!problemSolved) {
+        // Invalid plans are never output or returned, so findPlan can't
+        // reject a plan that was already output
+        PlanPostprocessor postprocessor(problem);
+        if (!postprocessor.isValid(plan)) {
+            log(0, "Discarding invalid plan\n");
+            return;
+        }
         problemSolved = true;
+        // Output the plan before the other workers are stopped
+        if (settings->getEarlyPlan()) {
+            if (settings->getPostprocessing()) {
+                plan = postprocessor.improve(plan);
+            }
+            emitPlan(problem, plan);
+        }
         solution = plan;
     }
 }
@@ -186,47 +338,180 @@ void LPEPEPlanner::markProblemSolved(Plan plan) {
 // to determine if they should abort solving of the formula.
 // A non-zero value indicates that the solver should abort.
 int LPEPEPlanner::solverTerminator(void* state) {
-    // Get arguments (planner)
-    auto *planner = (LPEPEPlanner*) state;
-    // If problem was solved, or extraction failed at a higher layer, terminate
-    int t = planner->problemSolved;
+    // Get arguments (used planner and layer)
+    auto *p = (LPEPEPlanner::ThreadParameters*) state;
+    int layer = p->layer;
+    auto *planner = p->planner;
+    // If problem was solved, or extraction failed at a longer horizon, terminate
+    // (a plan for this horizon could be padded to a plan for the longer one)
+    int t = planner->isTerminated() || planner->lastFailedLayer >= layer;
 	return t;
 }
 
-void LPEPEPlanner::expand() {
-    // Get lock and then expand graph
-    std::unique_lock<std::mutex> lck(graphMutex);
-    Planner::expand();
-}
+/**
+ * Adds the clauses of the given step to the solver. Step j connects the
+ * propositions at position j (before the actions) with those at position j-1
+ * (after the actions). The graph-dependent parts are guarded by horizon
+ * literals, since step j corresponds to action layer horizon-j+1.
+ */
+void LPEPEPlanner::addClausesToSolver(void *solver, int step) {
+    log(0, "Adding step %d to SAT solver %p\n", step, solver);
+    PhaseTimer timer(PHASE_ENCODE);
+    TraceScope trace("add clauses", step);
+
+    long long clauseCount = 0;
+    long long providerCount = 0;
+    for (Action a : reachableActions) {
+        // Stop if the solver isn't needed any more
+        if (isTerminated()) break;
+        // Actions that can't reach the goal within step steps are never used
+        if (!isActionRelevant(a, step)) continue;
+        int lit = actionAtStep(a, step);
+
+        // If an action is done, its preconditions hold before the step
+        for (Proposition prec : problem->getActionPreconditions(a)) {
+            ipasir_add(solver, -lit);
+            ipasir_add(solver, propositionAtPosition(prec, step));
+            ipasir_add(solver, 0);
+            clauseCount++;
+        }
+
+        // Positive effects hold after the step
+        for (Proposition pos : problem->getActionPosEffects(a)) {
+            ipasir_add(solver, -lit);
+            ipasir_add(solver, propositionAtPosition(pos, step-1));
+            ipasir_add(solver, 0);
+            clauseCount++;
+        }
+
+        // Negative effects don't hold after the step
+        for (Proposition neg : problem->getActionNegEffects(a)) {
+            ipasir_add(solver, -lit);
+            ipasir_add(solver, -propositionAtPosition(neg, step-1));
+            ipasir_add(solver, 0);
+            clauseCount++;
+        }
+
+        // The action is enabled in action layer horizon-step+1, i.e. it is
+        // disabled for every horizon up to firstLayer+step-2. This also
+        // disables all actions in steps beyond the horizon.
+        ipasir_add(solver, -lit);
+        ipasir_add(solver, -horizonAtMost(problem->getActionFirstLayer(a) + step - 2));
+        ipasir_add(solver, 0);
+        clauseCount++;
+    }
+
+    // Mutexes that hold in every layer
+    for (const ActionMutex& m : permanentMutexes) {
+        if (isTerminated()) break;
+        if (!isActionRelevant(m.a, step) || !isActionRelevant(m.b, step)) continue;
+        ipasir_add(solver, -actionAtStep(m.a, step));
+        ipasir_add(solver, -actionAtStep(m.b, step));
+        ipasir_add(solver, 0);
+        clauseCount++;
+    }
+
+    // If a proposition is true after the step, it must have been enabled by an
+    // action: p -> a or b or c or ..., where a,b,c.. are providers of p.
+    // This only applies if the step is part of the plan (horizon >= step).
+    // Propositions that no relevant action of the following steps needs are
+    // left unconstrained.
+    for (Proposition p : reachablePropositions) {
+        if (isTerminated()) break;
+        if (!isPropRelevant(p, step-1)) continue;
+        ipasir_add(solver, -propositionAtPosition(p, step-1));
+        ipasir_add(solver, horizonAtMost(step-1));
+        for (Action a : problem->getPropPosActions(p)) {
+            if (problem->getActionFirstLayer(a) > 0 && isActionRelevant(a, step)) {
+                ipasir_add(solver, actionAtStep(a, step));
+                providerCount++;
+            }
+        }
+        ipasir_add(solver, 0);
+        clauseCount++;
+    }
 
-void LPEPEPlanner::addClausesToSolver(void *solver, int actionLayer) {
-    // Get lock and then add clauses
-    std::unique_lock<std::mutex> lck(graphMutex);
-    PlannerWithSATExtraction::addClausesToSolver(solver, actionLayer);
+    countMetric(METRIC_CLAUSES, clauseCount);
+    countLayerMetric(LAYER_METRIC_CLAUSES, step, clauseCount);
+    // Each clause has two literals, plus the providers in the proposition clauses
+    addSolverMemory(solver, clauseCount, 2 * clauseCount + providerCount);
+    log(0, "Done adding clauses\n");
 }
 
-void LPEPEPlanner::addNewMutexesToSolver(void *solver, int actionLayer) {
+/**
+ * Adds the mutexes of a step that don't hold in every layer. A mutex that holds
+ * up to action layer m applies to step j iff horizon-j+1 <= m, i.e. iff the
+ * horizon is at most m+j-1.
+ */
+void LPEPEPlanner::addNewMutexesToSolver(void *solver, int step) {
+    long long clauseCount = 0;
+    for (const ActionMutex& m : layeredMutexes) {
+        if (isTerminated()) break;
+        if (!isActionRelevant(m.a, step) || !isActionRelevant(m.b, step)) continue;
+        ipasir_add(solver, -actionAtStep(m.a, step));
+        ipasir_add(solver, -actionAtStep(m.b, step));
+        ipasir_add(solver, -horizonAtMost(m.lastLayer + step - 1));
+        ipasir_add(solver, 0);
+        clauseCount++;
+    }
+    addSolverMemory(solver, clauseCount, 3 * clauseCount);
+}
 
+/**
+ * Adds the implications (horizon <= k) -> (horizon <= k+1) for from <= k < to.
+ */
+void LPEPEPlanner::addHorizonChainToSolver(void *solver, int from, int to) {
+    for (int k = std::max(0, from); k < to; k++) {
+        ipasir_add(solver, -horizonAtMost(k));
+        ipasir_add(solver, horizonAtMost(k+1));
+        ipasir_add(solver, 0);
+    }
 }
 
 
 int LPEPEPlanner::extract(void* solver, std::list<Proposition> goal, int layer, Plan& plan) {
-    log(0, "Extracting in layer %d with LPEPE\n", layer);
+    log(0, "Extracting with horizon %d with LPEPE\n", layer);
 
-    int packSize = settings->getLayerPackSize();
-    // Layer at which the goals will be assumed
-    int goalPackLayer = ((layer - 1) % packSize) + 1;
+    // Select the horizon: horizon <= layer and not horizon <= layer-1
+    ipasir_assume(solver, horizonAtMost(layer));
+    if (layer > 0) {
+        ipasir_assume(solver, -horizonAtMost(layer-1));
+    }
 
-    // Assume that the goal is true in this layer
+    // Assume that the goal is true at position 0
     for (Proposition p : goal) {
-        ipasir_assume(solver, propositionAtLayer(p, goalPackLayer));
+        ipasir_assume(solver, propositionAtPosition(p, 0));
+    }
+
+    // Assume the initial state at the position of the horizon. Propositions
+    // that are never reachable don't occur in any clause of a reachable action.
+    for (Proposition p : reachablePropositions) {
+        int lit = propositionAtPosition(p, layer);
+        if (problem->isPropEnabled(p, problem->getFirstLayer())) {
+            ipasir_assume(solver, lit);
+        } else {
+            ipasir_assume(solver, -lit);
+        }
     }
 
-    if (ipasir_solve(solver) == IPASIR_IS_SAT) {
-        for (int i = problem->getFirstActionLayer(); i <= problem->getActionLayerBeforePropLayer(layer); i++) {
+    int result;
+    {
+        PhaseTimer timer(PHASE_SOLVE);
+        MetricTimer metricTimer(METRIC_SOLVE_MICROSECONDS);
+        TraceScope trace("solve", layer);
+        countMetric(METRIC_SOLVER_CALLS);
+        result = ipasir_solve(solver);
+    }
+    if (result != IPASIR_IS_SAT && result != IPASIR_IS_UNSAT) {
+        traceInstant("terminated", layer);
+    }
+    if (result == IPASIR_IS_SAT) {
+        // Action layer i corresponds to step layer-i+1
+        for (int i = problem->getFirstActionLayer(); i <= layer; i++) {
             std::list<Action> actions;
-            for (Action a : problem->getLayerActions(i)) {
-                int lit = actionAtLayer(a, i);
+            for (Action a : reachableActions) {
+                if (!isActionRelevant(a, layer - i + 1)) continue;
+                int lit = actionAtStep(a, layer - i + 1);
                 if (ipasir_val(solver, lit) == lit) {
                     actions.push_back(a);
                 }
@@ -241,3 +526,25 @@ int LPEPEPlanner::extract(void* solver, std::list<Proposition> goal, int layer,
     }
 }
 
+/*
+ * Returns the variable number of a proposition being true at the given position
+ * (counted backwards from the goal)
+ */
+int LPEPEPlanner::propositionAtPosition(Proposition p, int position) {
+    return (countPropositions + countActions + 1) * position + 1 + problem->getPropositionNumber(p);
+}
+
+/*
+ * Returns the variable number of an action being used in the given step
+ * (counted backwards from the goal)
+ */
+int LPEPEPlanner::actionAtStep(Action a, int step) {
+    return (countPropositions + countActions + 1) * step + 1 + countPropositions + a;
+}
+
+/*
+ * Returns the variable number of the literal "the horizon is at most h"
+ */
+int LPEPEPlanner::horizonAtMost(int horizon) {
+    return (countPropositions + countActions + 1) * horizon + 1 + countPropositions + countActions;
+}
@@ -6,8 +6,13 @@
 #include <list>
 
 #include "Planners/Planner.h"
+#include "PlanningProblem.h"
 #include "Logger.h"
 #include "Settings.h"
+#include "PhaseTimes.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Memory.h"
 #include "pgp_utility.h"
 
 
@@ -154,10 +159,25 @@ void Planner::addNogood(int layer, std::list<Proposition> props) {
 
 
 
+int Planner::isOverMemoryBudget() {
+    long long budget = getMemoryBudget();
+    if (!budget) return false;
+    return getGraphMemory() + getSolverMemory() > budget;
+}
+
+long long Planner::getGraphMemory() {
+    long long nogoodMemory = 0;
+    for (const std::vector<int>& layerNogoods : nogoods) {
+        nogoodMemory += layerNogoods.capacity() * sizeof(int);
+    }
+    return problem->getMemoryUsage() + nogoodMemory;
+}
+
 void Planner::dumpNogoods() {
     int layer = 0;
     for (auto n : nogoods) {
         log(0, "Layer %d: ", layer);
+        flushLog();
         for (auto x : n) {
             std::cout << x << " ";
         }
@@ -179,8 +199,8 @@ int Planner::checkFixedPoint() {
     if (lastLayer - problem->getFirstLayer() < 1) return false;
 
     log(4, "last prop#: %d, before that: %d, last mutex#: %d, before that: %d\n",
-            problem->getLayerPropositions(lastLayer).size(),
-            problem->getLayerPropositions(lastLayer-1).size(),
+            (int) problem->getLayerPropositions(lastLayer).size(),
+            (int) problem->getLayerPropositions(lastLayer-1).size(),
             problem->getPropMutexCount(lastLayer),
             problem->getPropMutexCount(lastLayer-1)
         );
@@ -190,6 +210,9 @@ int Planner::checkFixedPoint() {
     if (problem->getLayerPropositions(lastLayer).size() == problem->getLayerPropositions(lastLayer-1).size()
             && problem->getPropMutexCount(lastLayer) == problem->getPropMutexCount(lastLayer-1)) {
         log(1, "Fixed point reached\n");
+        if (!problem->getFixedPointLayer()) {
+            problem->setFixedPointLayer(lastLayer);
+        }
         return true;
     }
 
@@ -226,7 +249,8 @@ int Planner::checkGoalUnreachable() {
         for (Proposition goal2 : problemGoal) {
             if (goal1 == goal2) break;
             if (problem->isMutexProp(goal1, goal2, problem->getLastLayer())) {
-                log(2, "Pair of goals still mutex: %d, %d\n", goal1, goal2);
+                log(2, "Pair of goals still mutex: (%d, %d), (%d, %d)\n",
+                        goal1.first, goal1.second, goal2.first, goal2.second);
                 return true;
             }
         }
@@ -241,6 +265,10 @@ int Planner::checkGoalUnreachable() {
 int Planner::graphplan(Plan& plan) {
     log(4, "Entering graphplan algorithm\n");
 
+    if (problem->hasConditionalEffects() || problem->hasAxioms()) {
+        throw ProblemError("Conditional effects and axioms are only supported by -p=satex and -p=sppsat");
+    }
+
     // Expand the graph until we hit a fixed-point level or we find out that
     // the problem is unsolvable.
     while (!fixedPoint && checkGoalUnreachable()) {
@@ -262,12 +290,21 @@ int Planner::graphplan(Plan& plan) {
     // So we subtract that additional layer again
     int lastLayer = problem->getLastLayer();
     //if (fixedPoint) lastLayer--;
-    int success = extract(goal, lastLayer, plan);
+    int success;
+    {
+        PhaseTimer timer(PHASE_SOLVE);
+        success = extract(goal, lastLayer, plan);
+    }
 
     // Keep track of how many nogoods exist, so we can determine if any are added during an iteration
     int lastNogoodCount = 0;
 
     while(!success) {
+        if (isOverMemoryBudget()) {
+            log(0, "Memory budget exceeded, giving up\n");
+            return 0;
+        }
+
         // Expand for one more layer
         expand();
         fixedPoint = checkFixedPoint();
@@ -278,7 +315,10 @@ int Planner::graphplan(Plan& plan) {
         // Do backwards search with given goal propositions
         lastLayer = problem->getLastLayer();
         //if (fixedPoint) lastLayer--;    // about the -1 see above
-        success = extract(goal, lastLayer, plan);
+        {
+            PhaseTimer timer(PHASE_SOLVE);
+            success = extract(goal, lastLayer, plan);
+        }
 
         if ((!success) && fixedPoint) {
             if (lastNogoodCount == countNogoods[problem->getLastLayer()]) {
@@ -291,40 +331,109 @@ int Planner::graphplan(Plan& plan) {
     return success;
 }
 
+/**
+ * Checks if an action can contribute to the goal at all, according to the
+ * backward relevance analysis.
+ */
+int Planner::isActionRelevant(Action a) {
+    if (!settings->getRelevancePruning()) return true;
+    return problem->getActionGoalDistance(a) != INT_MAX;
+}
+
+/**
+ * Checks if an action can contribute to the goal within the given amount of
+ * steps, according to the backward relevance analysis.
+ */
+int Planner::isActionRelevant(Action a, int steps) {
+    if (!settings->getRelevancePruning()) return true;
+    return problem->getActionGoalDistance(a) <= steps;
+}
+
+/**
+ * Checks if a proposition can contribute to the goal within the given amount
+ * of steps, according to the backward relevance analysis.
+ */
+int Planner::isPropRelevant(Proposition p, int steps) {
+    if (!settings->getRelevancePruning()) return true;
+    return problem->getPropGoalDistance(p) <= steps;
+}
+
 void Planner::expand() {
+    PhaseTimer timer(PHASE_EXPAND);
+    MetricTimer metricTimer(METRIC_EXPAND_MICROSECONDS);
+    TraceScope trace("expand", problem->getLastActionLayer() + 1);
+    countMetric(METRIC_LAYERS_EXPANDED);
+
+    // Beyond the fixed point all layers are equal, so they are only counted
+    if (problem->getFixedPointLayer()) {
+        log(0, "Expanding graph beyond fixed point\n");
+        problem->addPropositionLayer();
+        problem->addActionLayer();
+        countNogoods.push_back(0);
+        problem->commitLayers();
+        countLayerMetric(LAYER_METRIC_EXPAND_MICROSECONDS, problem->getLastActionLayer(),
+                metricTimer.elapsedMicroseconds());
+        return;
+    }
+
+    // Calls to the final PlanningProblem class are resolved at compile time
+    PlanningProblem *concrete = dynamic_cast<PlanningProblem*>(problem);
+    bool general = problem->hasConditionalEffects() || problem->hasAxioms();
+
+    if (concrete && !general) {
+        expandLayer<PlanningProblem, false>(concrete);
+    } else if (concrete) {
+        expandLayer<PlanningProblem, true>(concrete);
+    } else {
+        expandLayer<IPlanningProblem, true>(problem);
+    }
+
+    countLayerMetric(LAYER_METRIC_EXPAND_MICROSECONDS, problem->getLastActionLayer(),
+            metricTimer.elapsedMicroseconds());
+}
+
+template <class Problem, bool General>
+void Planner::expandLayer(Problem *graph) {
     log(0, "Expanding graph\n");
 
-    int lastPropositionLayer = problem->getLastLayer();
+    int lastPropositionLayer = graph->getLastLayer();
 
-    int newPropositionLayer = problem->addPropositionLayer();
+    int newPropositionLayer = graph->addPropositionLayer();
     log(4, "New proposition layer is %d\n", newPropositionLayer);
-    int newActionLayer = problem->addActionLayer();
+    int newActionLayer = graph->addActionLayer();
     log(4, "New action layer is %d\n", newActionLayer);
 
-    // TODO: Possibly remove. Still useful if giving up optimality
-    // If we reached a fixed point we don't need to do anything else.
-    // No adding of actions or propositions needed, since those will be carried
-    // over implicitly.
-    //if (fixedPoint && !fixedMutexes) {
-    //    updateNewLayerMutexes(currentPropLayer);
-    //    return;
-    //}
-
     // No nogoods for this layer yet
     countNogoods.push_back(0);
 
+    if (General && graph->hasConditionalEffects() && possibleReads.empty()) {
+        initConditionalInteractions();
+    }
+
+    bool relevancePruning = settings->getRelevancePruning();
+    long long mutexChecks = 0;
+
     // Add actions
     // TODO: Not a very clean loop, use a list of unused actions instead
-    for(Action action = 0; action < problem->getActionCount(); action++) {
+    int countActions = graph->getActionCount();
+    for(Action action = 0; action < countActions; action++) {
         // Only check disabled actions
-        if (problem->isActionEnabled(action, newActionLayer-1)) continue;
+        if (graph->isActionEnabled(action, newActionLayer-1)) continue;
+        // Skip actions that can never contribute to the goal. No-ops are kept
+        // for every proposition, so mutexes still only decrease over layers.
+        if (relevancePruning && !graph->isTrivialAction(action)
+                && graph->getActionGoalDistance(action) == INT_MAX) continue;
+        // Derived propositions aren't kept by no-ops, they are derived anew in
+        // every layer
+        if (General && graph->hasAxioms() && graph->isTrivialAction(action)
+                && graph->isDerivedProposition(graph->getActionPreconditions(action).front())) continue;
 
         bool enable = true;
 
         // Check if preconditions already present and abort if not
-        std::list<Proposition> preconds = problem->getActionPreconditions(action);
+        auto& preconds = graph->getActionPreconditions(action);
         for (Proposition p : preconds) {
-            if (!problem->isPropEnabled(p, lastPropositionLayer)) {
+            if (!graph->isPropEnabled(p, lastPropositionLayer)) {
                 enable = false;
                 break;
             }
@@ -332,7 +441,8 @@ void Planner::expand() {
             // Check for precondition mutexes and abort if mutex was found
             for (Proposition q : preconds) {
                 if (p == q) break;
-                if (problem->isMutexProp(p, q, lastPropositionLayer)) {
+                mutexChecks++;
+                if (graph->isMutexProp(p, q, lastPropositionLayer)) {
                     enable = false;
                     break;
                 }
@@ -345,22 +455,115 @@ void Planner::expand() {
 
         // Add the action
         // Enable action in next layer
-        problem->activateAction(action, newActionLayer);
+        graph->activateAction(action, newActionLayer);
         // Check for general mutexes that are independent on the layer
-        for (Action b : problem->getLayerActions(newActionLayer)) {
-            if (checkActionsMutex(action, b)) {
-                problem->setMutexAction(action, b, INT_MAX);
+        for (Action b : graph->getLayerActions(newActionLayer)) {
+            mutexChecks++;
+            if (checkActionsMutex<Problem, General>(graph, action, b)) {
+                graph->setMutexAction(action, b, INT_MAX);
             }
         }
     }
 
-    updateActionLayerMutexes(lastPropositionLayer, newActionLayer);
-    updatePropLayerMutexes(newPropositionLayer, newActionLayer);
+    if (General && graph->hasConditionalEffects()) {
+        activateConditionalEffects(lastPropositionLayer, newActionLayer);
+    }
+    if (General && graph->hasAxioms()) {
+        activateDerivedPropositions(newPropositionLayer);
+    }
+
+    updateActionLayerMutexes<Problem>(graph, lastPropositionLayer, newActionLayer);
+    updatePropLayerMutexes<Problem, General>(graph, newPropositionLayer, newActionLayer);
+    countMetric(METRIC_MUTEX_CHECKS, mutexChecks);
+
+    // The new layers are complete and may now be read by other threads
+    graph->commitLayers();
 
     log(0, "Done expanding graph\n");
 
     if (settings->getDumpPlanningGraph()) {
-        problem->dumpPlanningGraph();
+        graph->dumpPlanningGraph();
+    }
+}
+
+/**
+ * Collects for every action everything it may read, add or delete, including
+ * its conditional effects.
+ */
+void Planner::initConditionalInteractions() {
+    int countActions = problem->getActionCount();
+    possibleReads.resize(countActions);
+    possibleAdds.resize(countActions);
+    possibleDeletes.resize(countActions);
+
+    for (Action a = 0; a < countActions; a++) {
+        possibleReads[a] = problem->getActionPreconditions(a);
+        possibleAdds[a] = problem->getActionPosEffects(a);
+        possibleDeletes[a] = problem->getActionNegEffects(a);
+        for (ConditionalEffect& effect : problem->getActionConditionalEffects(a)) {
+            possibleReads[a].insert(possibleReads[a].end(), effect.conditions.begin(), effect.conditions.end());
+            possibleAdds[a].insert(possibleAdds[a].end(), effect.posEffects.begin(), effect.posEffects.end());
+            possibleDeletes[a].insert(possibleDeletes[a].end(), effect.negEffects.begin(), effect.negEffects.end());
+        }
+        possibleReads[a].sort();
+        possibleAdds[a].sort();
+        possibleDeletes[a].sort();
+    }
+}
+
+/**
+ * Adds the effects of every conditional effect whose conditions are all
+ * present in the previous proposition layer. This is optimistic, the SAT
+ * encoding decides whether an effect actually occurs.
+ */
+void Planner::activateConditionalEffects(int prevPropLayer, int actionLayer) {
+    int nextPropLayer = problem->getPropLayerAfterActionLayer(actionLayer);
+    for (Action a : problem->getLayerActions(actionLayer)) {
+        for (ConditionalEffect& effect : problem->getActionConditionalEffects(a)) {
+            bool possible = true;
+            for (Proposition c : effect.conditions) {
+                if (!problem->isPropEnabled(c, prevPropLayer)) {
+                    possible = false;
+                    break;
+                }
+            }
+            if (!possible) continue;
+
+            for (Proposition p : effect.posEffects) {
+                problem->activateProposition(p, nextPropLayer);
+            }
+        }
+    }
+}
+
+/**
+ * Adds the derived propositions of a layer. Default values are assumed to be
+ * possible in every layer after the first one, derived values as soon as the
+ * body of one of their axioms is present.
+ */
+void Planner::activateDerivedPropositions(int propLayer) {
+    for (Variable v : problem->getDerivedVariables()) {
+        problem->activateProposition(Proposition(v, problem->getDerivedDefaultValue(v)), propLayer);
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (Axiom& axiom : problem->getAxioms()) {
+            if (problem->isPropEnabled(axiom.head, propLayer)) continue;
+
+            bool possible = true;
+            for (Proposition b : axiom.body) {
+                if (!problem->isPropEnabled(b, propLayer)) {
+                    possible = false;
+                    break;
+                }
+            }
+            if (possible) {
+                problem->activateProposition(axiom.head, propLayer);
+                changed = true;
+            }
+        }
     }
 }
 
@@ -373,33 +576,24 @@ void Planner::expand() {
  * @param actionLayer
  *      The action that is to be updated
  *
- * // TODO: The following feature is only useful when expanding beyond the fixed point
- * // If a fixed point is reached, the mutexes will be added (one last time) for every layer.
- * // Then fixedMutexes will be set to 1, which means this function _should_ never be called
- * // again.
- * 
+ * Beyond the fixed point, this isn't called anymore: the mutexes of the last
+ * stored layers hold in all later layers.
  */
-void Planner::updateActionLayerMutexes(int prevPropLayer, int actionLayer) {
-    // TODO: See above
-    // If we reached a fixed point then all current mutexes will be there forever.
-    /*
-    if (fixedPoint) {
-        newMutexActionLayer = INT_MAX;
-        newMutexPropLayer = INT_MAX;
-        fixedMutexes = 1;
-    }
-    */
-
+template <class Problem>
+void Planner::updateActionLayerMutexes(Problem *graph, int prevPropLayer, int actionLayer) {
     // Perform various checks for each pair of actions present
-    std::list<Action> actions = problem->getLayerActions(actionLayer);
+    auto actions = graph->getLayerActions(actionLayer);
+    long long mutexChecks = 0;
     for (Action a : actions) {
         for (Action b : actions) {
-            if (a == b || problem->isMutexAction(a, b, actionLayer)) break;
-            if (checkActionPrecsMutex(a, b, prevPropLayer)) {
-                problem->setMutexAction(a, b, actionLayer);
+            if (a == b || graph->isMutexAction(a, b, actionLayer)) break;
+            mutexChecks++;
+            if (checkActionPrecsMutex<Problem>(graph, a, b, prevPropLayer)) {
+                graph->setMutexAction(a, b, actionLayer);
             }
         }
     }
+    countMetric(METRIC_MUTEX_CHECKS, mutexChecks);
 }
 
 
@@ -412,18 +606,22 @@ void Planner::updateActionLayerMutexes(int prevPropLayer, int actionLayer) {
  * @param actionLayer
  *      The last action layer, ie the one right before the new proposition layer
  */
-void Planner::updatePropLayerMutexes(int newPropLayer, int actionLayer) {
+template <class Problem, bool General>
+void Planner::updatePropLayerMutexes(Problem *graph, int newPropLayer, int actionLayer) {
     // Update proposition mutexes
-    std::list<Proposition> props = problem->getLayerPropositions(newPropLayer);
+    auto props = graph->getLayerPropositions(newPropLayer);
+    long long mutexChecks = 0;
     for (Proposition p : props) {
         for (Proposition q : props) {
             if (p == q) break;
-            if (checkPropsMutex(p, q, actionLayer)) {
+            mutexChecks++;
+            if (checkPropsMutex<Problem, General>(graph, p, q, actionLayer)) {
                 // Set a new mutex
-                problem->setMutexProp(p, q, newPropLayer);
+                graph->setMutexProp(p, q, newPropLayer);
             }
         }
     }
+    countMetric(METRIC_MUTEX_CHECKS, mutexChecks);
 }
 
 
@@ -431,14 +629,53 @@ void Planner::updatePropLayerMutexes(int newPropLayer, int actionLayer) {
  * Checks if two propositions will be mutex in the proposition layer following
  * the given action layer
  */
-int Planner::checkPropsMutex(Proposition p, Proposition q, int actionLayer) {
+template <class Problem, bool General>
+int Planner::checkPropsMutex(Problem *graph, Proposition p, Proposition q, int actionLayer) {
+    // Derived propositions have no providers, they are only mutex with the
+    // other value of their variable
+    if (General && graph->hasAxioms()
+            && (graph->isDerivedProposition(p) || graph->isDerivedProposition(q))) {
+        return false;
+    }
+    if (General && graph->hasConditionalEffects()) {
+        return checkConditionalPropsMutex(p, q, actionLayer);
+    }
+
     // Iterate over all pairs of p's and q's preconditions
-    for (int a : problem->getPropPosActions(p)) {
-        for (int b : problem->getPropPosActions(q)) {
+    for (int a : graph->getPropPosActions(p)) {
+        for (int b : graph->getPropPosActions(q)) {
+            if (graph->isActionEnabled(a, actionLayer)
+                    && graph->isActionEnabled(b, actionLayer)
+                    && !(graph->isMutexAction(a, b, actionLayer))) {
+                // Two non-mutex actions exist which resp. enable p and q
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Checks if two propositions will be mutex in the proposition layer following
+ * the given action layer, where actions with a conditional effect that adds
+ * a proposition count as its providers as well
+ */
+int Planner::checkConditionalPropsMutex(Proposition p, Proposition q, int actionLayer) {
+    std::list<Action> providersP = problem->getPropPosActions(p);
+    for (auto& provider : problem->getPropConditionalActions(p)) {
+        providersP.push_back(provider.first);
+    }
+    std::list<Action> providersQ = problem->getPropPosActions(q);
+    for (auto& provider : problem->getPropConditionalActions(q)) {
+        providersQ.push_back(provider.first);
+    }
+
+    for (Action a : providersP) {
+        for (Action b : providersQ) {
             if (problem->isActionEnabled(a, actionLayer)
                     && problem->isActionEnabled(b, actionLayer)
                     && !(problem->isMutexAction(a, b, actionLayer))) {
-                // Two non-mutex actions exist which resp. enable p and q
                 return false;
             }
         }
@@ -450,13 +687,14 @@ int Planner::checkPropsMutex(Proposition p, Proposition q, int actionLayer) {
 /**
  * Checks if two actions are mutex due to colliding effects
  */
-int Planner::checkActionsMutex(Action a, Action b) {
-    auto& precA = problem->getActionPreconditions(a);
-    auto& posA = problem->getActionPosEffects(a);
-    auto& negA = problem->getActionNegEffects(a);
-    auto& precB = problem->getActionPreconditions(b);
-    auto& posB = problem->getActionPosEffects(b);
-    auto& negB = problem->getActionNegEffects(b);
+template <class Problem, bool General>
+int Planner::checkActionsMutex(Problem *graph, Action a, Action b) {
+    auto& precA = graph->getActionPreconditions(a);
+    auto& posA = graph->getActionPosEffects(a);
+    auto& negA = graph->getActionNegEffects(a);
+    auto& precB = graph->getActionPreconditions(b);
+    auto& posB = graph->getActionPosEffects(b);
+    auto& negB = graph->getActionNegEffects(b);
 
     if (!empty_intersection(negA, precB) || !empty_intersection(negA, posB)
             || !empty_intersection(negB, precA) || !empty_intersection(negB, posA)) {
@@ -466,12 +704,51 @@ int Planner::checkActionsMutex(Action a, Action b) {
     // Check if positive effects coĺlide
     for (Proposition p : posA) {
         for (Proposition q : posB) {
-            if (problem->isMutexProp(p, q, INT_MAX)) {
+            if (graph->isMutexProp(p, q, INT_MAX)) {
                 return true;
             }
         }
     }
 
+    if (General && graph->hasConditionalEffects()) {
+        return checkConditionalActionsMutex(a, b);
+    }
+
+    return false;
+}
+
+/**
+ * Checks if two actions may interfere through their conditional effects, in
+ * which case they are mutex, so that the actions of a layer can still be
+ * applied in any order. Interference of conditional effects with no-ops is
+ * left to the SAT encoding, since it depends on whether the effect occurs.
+ */
+int Planner::checkConditionalActionsMutex(Action a, Action b) {
+    if (problem->isTrivialAction(a) || problem->isTrivialAction(b)) return false;
+    if (problem->getActionConditionalEffects(a).empty() && problem->getActionConditionalEffects(b).empty()) {
+        return false;
+    }
+
+    if (!empty_intersection(possibleDeletes[a], possibleReads[b]) || !empty_intersection(possibleDeletes[a], possibleAdds[b])
+            || !empty_intersection(possibleDeletes[b], possibleReads[a]) || !empty_intersection(possibleDeletes[b], possibleAdds[a])) {
+        return true;
+    }
+
+    // An added proposition replaces everything it is mutex with
+    for (Proposition p : possibleAdds[a]) {
+        for (Proposition q : possibleAdds[b]) {
+            if (problem->isMutexProp(p, q, INT_MAX)) return true;
+        }
+        for (Proposition q : possibleReads[b]) {
+            if (problem->isMutexProp(p, q, INT_MAX)) return true;
+        }
+    }
+    for (Proposition p : possibleAdds[b]) {
+        for (Proposition q : possibleReads[a]) {
+            if (problem->isMutexProp(p, q, INT_MAX)) return true;
+        }
+    }
+
     return false;
 }
 
@@ -481,11 +758,12 @@ int Planner::checkActionsMutex(Action a, Action b) {
  * @param layer
  *      The proposition layer where the preconditions of the actions are in
  */
-int Planner::checkActionPrecsMutex(Action a, Action b, int propLayer) {
-    for (Proposition p : problem->getActionPreconditions(a)) {
-        for (Proposition q : problem->getActionPreconditions(b)) {
+template <class Problem>
+int Planner::checkActionPrecsMutex(Problem *graph, Action a, Action b, int propLayer) {
+    for (Proposition p : graph->getActionPreconditions(a)) {
+        for (Proposition q : graph->getActionPreconditions(b)) {
             if (p == q) continue;
-            if (problem->isMutexProp(p, q, propLayer)) {
+            if (graph->isMutexProp(p, q, propLayer)) {
                 return true;
             }
         }
@@ -519,8 +797,10 @@ int Planner::extract(std::list<Proposition> goal, int layer, Plan& plan) {
     // TODO: share with other threads (receive)
     if (isNogood(layer, goal)) {
         log(3, "Nogood found\n");
+        countMetric(METRIC_NOGOOD_HITS);
         return 0;
     }
+    countMetric(METRIC_NOGOOD_MISSES);
 
     // Perform the graphplan search
     std::list<Action> actions;
@@ -538,7 +818,7 @@ int Planner::extract(std::list<Proposition> goal, int layer, Plan& plan) {
 }
 
 int Planner::gpSearch(std::list<Proposition> goal, std::list<Action> actions, int layer, Plan& plan) {
-    log(3, "Performing gpSearch %d  %d\n", goal.size(), actions.size());
+    log(3, "Performing gpSearch %d  %d\n", (int) goal.size(), (int) actions.size());
 
     int actionLayer = problem->getActionLayerBeforePropLayer(layer);
 
@@ -649,3 +929,8 @@ int Planner::gpSearch(std::list<Proposition> goal, std::list<Action> actions, in
     return 0;
 }
 
+
+// Instantiations of the expansion kernel, which are also used by benchmarks
+template void Planner::expandLayer<PlanningProblem, false>(PlanningProblem *graph);
+template void Planner::expandLayer<PlanningProblem, true>(PlanningProblem *graph);
+template void Planner::expandLayer<IPlanningProblem, true>(IPlanningProblem *graph);
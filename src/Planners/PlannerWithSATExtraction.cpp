@@ -7,12 +7,21 @@
 #include "Planners/PlannerWithSATExtraction.h"
 #include "Logger.h"
 #include "Settings.h"
+#include "PhaseTimes.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Memory.h"
 
 #include "ipasir_cpp.h"
 
 
 
 PlannerWithSATExtraction::PlannerWithSATExtraction(IPlanningProblem *problem) : Planner(problem) {
+    // The layout may reject the problem, so it comes before the solver
+    countActions = problem->getActionCount();
+    countPropositions = problem->getPropositionCount();
+    initVariableLayout();
+
     solver = ipasir_init();
     solverInitialized = true;
     horizonOffset = 0;
@@ -21,17 +30,46 @@ PlannerWithSATExtraction::PlannerWithSATExtraction(IPlanningProblem *problem) :
     #ifndef PGP_NOSETLEARN
     ipasir_set_learn(solver, NULL, 0, NULL); 
     #endif
-
-    countActions = problem->getActionCount();
-    countPropositions = problem->getPropositionCount();
 }
 
 PlannerWithSATExtraction::~PlannerWithSATExtraction() {
     if (solverInitialized) {
+        releaseSolverMemory(solver);
         ipasir_release(solver);
     }
 }
 
+/**
+ * Determines how many variables each layer needs and where the variables of
+ * conditional effects and axioms are. Without those, a layer consists of the
+ * actions, propositions and goal literals only.
+ */
+void PlannerWithSATExtraction::initVariableLayout() {
+    countConditionalEffects = 0;
+    conditionalEffectOffset.assign(countActions, 0);
+    if (problem->hasConditionalEffects()) {
+        for (Action a = 0; a < countActions; a++) {
+            conditionalEffectOffset[a] = countConditionalEffects;
+            countConditionalEffects += problem->getActionConditionalEffects(a).size();
+        }
+    }
+
+    int countAxioms = 0;
+    if (problem->hasAxioms()) {
+        if (problem->hasRecursiveAxioms()) {
+            throw ProblemError("Recursive axioms are not supported");
+        }
+        std::vector<Axiom>& axioms = problem->getAxioms();
+        countAxioms = axioms.size();
+        variableAxioms.resize(problem->getVariableCount());
+        for (int r = 0; r < countAxioms; r++) {
+            variableAxioms[axioms[r].head.first].push_back(r);
+        }
+    }
+
+    layerVariableCount = countActions + countPropositions + 2 + countConditionalEffects + countAxioms;
+}
+
 int PlannerWithSATExtraction::graphplan(Plan& plan) {
     log(0, "SATEx algorithm using SAT Solver %s\n", ipasir_signature());
 
@@ -49,17 +87,21 @@ int PlannerWithSATExtraction::graphplan(Plan& plan) {
         return false;
     }
 
-    // Do backwards search with given goal propositions
-    std::list<Proposition> goal = problem->getGoal();
+    // Extract with the goal activated in the last layer
     // If fixed point is reached, we have theoretically expanded beyond it, just to find out.
     // So we subtract that additional layer again
     int lastLayer = problem->getLastLayer();
-    int success = extract(solver, goal, lastLayer, plan);
+    int success = extract(solver, lastLayer, plan);
 
     // How many iteration of the main loop have been done, to calculate horizon
     int iteration = 0;
 
     while(!success) {
+        if (isOverMemoryBudget()) {
+            log(0, "Memory budget exceeded, giving up\n");
+            return 0;
+        }
+
         // Expand until horizon
         while (problem->getLastActionLayer() < horizon(iteration+1)) {
             expand();
@@ -69,9 +111,9 @@ int PlannerWithSATExtraction::graphplan(Plan& plan) {
         // Clean up, start with a fresh empty plan
         plan.clear();
 
-        // Do backwards search with given goal propositions
+        // Extract with the goal activated in the last layer
         lastLayer = problem->getLastLayer();
-        success = extract(solver, goal, lastLayer, plan);
+        success = extract(solver, lastLayer, plan);
 
         iteration++;
     }
@@ -81,10 +123,56 @@ int PlannerWithSATExtraction::graphplan(Plan& plan) {
 
 /**
  * Adds necessary clauses for one action layer to the given SAT solver.
+ *
+ * Beyond the fixed point, all layers have the same clauses, just with the
+ * variables of a different layer. The clauses of the first such layer are
+ * kept and only shifted for all further layers.
  */
 void PlannerWithSATExtraction::addClausesToSolver(void *solver, int actionLayer) {
     log(0, "Adding clauses to SAT solver %p\n", solver);
+    PhaseTimer timer(PHASE_ENCODE);
+    TraceScope trace("add clauses", actionLayer);
+
+    long long clauseCount = 0;
+    long long literalCount = 0;
+    int fixedPointLayer = problem->getFixedPointLayer();
+    if (fixedPointLayer && actionLayer >= fixedPointLayer) {
+        {
+            std::unique_lock<std::mutex> lck(leveledClausesMutex);
+            if (!leveledClauseLayer) {
+                addLayerClauses(leveledClauses, actionLayer);
+                leveledClauseLayer = actionLayer;
+            }
+        }
+        int shift = layerVariableCount * (actionLayer - leveledClauseLayer);
+        for (int lit : leveledClauses) {
+            ipasir_add(solver, lit > 0 ? lit + shift : (lit < 0 ? lit - shift : 0));
+            clauseCount += (lit == 0);
+            literalCount += (lit != 0);
+            if (lit == 0 && clauseCount % TERMINATION_CHECK_INTERVAL == 0 && isTerminated()) break;
+        }
+    } else {
+        std::vector<int> clauses;
+        addLayerClauses(clauses, actionLayer);
+        for (int lit : clauses) {
+            ipasir_add(solver, lit);
+            clauseCount += (lit == 0);
+            literalCount += (lit != 0);
+            if (lit == 0 && clauseCount % TERMINATION_CHECK_INTERVAL == 0 && isTerminated()) break;
+        }
+    }
+    countMetric(METRIC_CLAUSES, clauseCount);
+    countLayerMetric(LAYER_METRIC_CLAUSES, actionLayer, clauseCount);
+    addSolverMemory(solver, clauseCount, literalCount);
 
+    log(0, "Done adding clauses\n");
+}
+
+/**
+ * Generates the clauses of one action layer, the proposition layer after it
+ * and its goal literals. Clauses are terminated by 0 like in ipasir_add.
+ */
+void PlannerWithSATExtraction::addLayerClauses(std::vector<int>& clauses, int actionLayer) {
     int prevPropLayer = problem->getPropLayerBeforeActionLayer(actionLayer);
     int nextPropLayer = problem->getPropLayerAfterActionLayer(actionLayer);
 
@@ -93,35 +181,35 @@ void PlannerWithSATExtraction::addClausesToSolver(void *solver, int actionLayer)
         // If an action is done in layer i, the precondition has to be true in layer i-1
         if (actionLayer != problem->getFirstActionLayer()) {
             for (Proposition prec : problem->getActionPreconditions(a)) {
-                ipasir_add(solver, -actionAtLayer(a, actionLayer));
-                ipasir_add(solver, propositionAtLayer(prec, prevPropLayer));
-                ipasir_add(solver, 0);
+                clauses.push_back(-actionAtLayer(a, actionLayer));
+                clauses.push_back(propositionAtLayer(prec, prevPropLayer));
+                clauses.push_back(0);
             }
         }
 
         // Add positive effect clauses to the SAT solver
         // If an action is done in layer i, the positive effect has to be true in layer i+1
         for (Proposition pos : problem->getActionPosEffects(a)) {
-            ipasir_add(solver, -actionAtLayer(a, actionLayer));
-            ipasir_add(solver, propositionAtLayer(pos, nextPropLayer));
-            ipasir_add(solver, 0);
+            clauses.push_back(-actionAtLayer(a, actionLayer));
+            clauses.push_back(propositionAtLayer(pos, nextPropLayer));
+            clauses.push_back(0);
         }
         
         // Add negative effect clauses to the SAT solver
         // If an action is done in layer i, the negative effect has to be false in layer i+1
         for (Proposition neg : problem->getActionNegEffects(a)) {
-            ipasir_add(solver, -actionAtLayer(a, actionLayer));
-            ipasir_add(solver, -propositionAtLayer(neg, nextPropLayer));
-            ipasir_add(solver, 0);
+            clauses.push_back(-actionAtLayer(a, actionLayer));
+            clauses.push_back(-propositionAtLayer(neg, nextPropLayer));
+            clauses.push_back(0);
         }
 
         // Action mutexes
-        for (Action b : problem->getLayerActions(problem->getLastActionLayer())) {
+        for (Action b : problem->getLayerActions(actionLayer)) {
             if (a == b) break;
             if (problem->isMutexAction(a, b, actionLayer)) {
-                ipasir_add(solver, -actionAtLayer(a, actionLayer));
-                ipasir_add(solver, -actionAtLayer(b, actionLayer));
-                ipasir_add(solver, 0);
+                clauses.push_back(-actionAtLayer(a, actionLayer));
+                clauses.push_back(-actionAtLayer(b, actionLayer));
+                clauses.push_back(0);
             }
         }
     }
@@ -130,16 +218,220 @@ void PlannerWithSATExtraction::addClausesToSolver(void *solver, int actionLayer)
     // by an action:
     // p -> a or b or c or ... in previous layer, where a,b,c.. are providers of p
     for (Proposition p: problem->getLayerPropositions(nextPropLayer)) {
-        ipasir_add(solver, -propositionAtLayer(p, nextPropLayer));
+        // Derived propositions are defined by their axioms instead
+        if (problem->hasAxioms() && problem->isDerivedProposition(p)) continue;
+
+        clauses.push_back(-propositionAtLayer(p, nextPropLayer));
         for (Action a: problem->getPropPosActions(p)) {
             if (problem->isActionEnabled(a, actionLayer)) {
-                ipasir_add(solver, actionAtLayer(a, actionLayer));
+                clauses.push_back(actionAtLayer(a, actionLayer));
             }   
         }
-        ipasir_add(solver, 0);
+        if (problem->hasConditionalEffects()) {
+            for (auto& provider : problem->getPropConditionalActions(p)) {
+                if (problem->isActionEnabled(provider.first, actionLayer)) {
+                    clauses.push_back(effectAtLayer(provider.first, provider.second, actionLayer));
+                }
+            }
+        }
+        clauses.push_back(0);
     }
 
-    log(0, "Done adding clauses\n");
+    if (problem->hasConditionalEffects()) {
+        addConditionalEffectClauses(clauses, actionLayer);
+    }
+    if (problem->hasAxioms()) {
+        addAxiomClauses(clauses, nextPropLayer);
+    }
+    if (problem->hasConditionalEffects() || problem->hasAxioms()) {
+        addVariableValueClauses(clauses, nextPropLayer);
+    }
+
+    // Goal activation: if the goal is activated in this layer, each goal
+    // proposition has to be true. A goal proposition that is not enabled yet
+    // can never be true, so the goal cannot be activated in this layer at all.
+    int goalLit = goalAtLayer(nextPropLayer);
+    for (Proposition g : problem->getGoal()) {
+        clauses.push_back(-goalLit);
+        if (problem->isPropEnabled(g, nextPropLayer)) {
+            clauses.push_back(propositionAtLayer(g, nextPropLayer));
+        }
+        clauses.push_back(0);
+    }
+
+    // Goal in some layer up to this one: U_l <-> G_l or U_l-1
+    int upToLit = goalUpToLayer(nextPropLayer);
+    clauses.push_back(-goalLit);
+    clauses.push_back(upToLit);
+    clauses.push_back(0);
+    clauses.push_back(-upToLit);
+    clauses.push_back(goalLit);
+    if (actionLayer != problem->getFirstActionLayer()) {
+        int prevUpToLit = goalUpToLayer(nextPropLayer - 1);
+        clauses.push_back(prevUpToLit);
+        clauses.push_back(0);
+        clauses.push_back(-prevUpToLit);
+        clauses.push_back(upToLit);
+    }
+    clauses.push_back(0);
+}
+
+/**
+ * Adds the clauses of the conditional effects of one action layer. An effect
+ * occurs iff its action is applied and its conditions hold; the conditions
+ * in the first layer are known from the initial state. Actions that may
+ * interfere through conditional effects are mutex already, but whether an
+ * effect replaces a proposition that a no-op keeps depends on the conditions
+ * and is encoded here.
+ */
+void PlannerWithSATExtraction::addConditionalEffectClauses(std::vector<int>& clauses, int actionLayer) {
+    int prevPropLayer = problem->getPropLayerBeforeActionLayer(actionLayer);
+    int nextPropLayer = problem->getPropLayerAfterActionLayer(actionLayer);
+    bool firstLayer = (actionLayer == problem->getFirstActionLayer());
+    LayerView<Proposition> keptProps = problem->getLayerPropositions(prevPropLayer);
+
+    for (Action a : problem->getLayerActions(actionLayer)) {
+        std::vector<ConditionalEffect>& effects = problem->getActionConditionalEffects(a);
+        for (int i = 0; i < (int) effects.size(); i++) {
+            ConditionalEffect& effect = effects[i];
+            int effectLit = effectAtLayer(a, i, actionLayer);
+            int actionLit = actionAtLayer(a, actionLayer);
+
+            // Conditions that are not enabled can't hold
+            bool possible = true;
+            for (Proposition c : effect.conditions) {
+                if (!problem->isPropEnabled(c, prevPropLayer)) possible = false;
+            }
+            if (!possible) {
+                clauses.push_back(-effectLit);
+                clauses.push_back(0);
+                continue;
+            }
+
+            // e -> a, e -> c for every condition, a and all c -> e
+            clauses.push_back(-effectLit);
+            clauses.push_back(actionLit);
+            clauses.push_back(0);
+            if (!firstLayer) {
+                for (Proposition c : effect.conditions) {
+                    clauses.push_back(-effectLit);
+                    clauses.push_back(propositionAtLayer(c, prevPropLayer));
+                    clauses.push_back(0);
+                }
+            }
+            clauses.push_back(-actionLit);
+            if (!firstLayer) {
+                for (Proposition c : effect.conditions) {
+                    clauses.push_back(-propositionAtLayer(c, prevPropLayer));
+                }
+            }
+            clauses.push_back(effectLit);
+            clauses.push_back(0);
+
+            // Effects
+            for (Proposition pos : effect.posEffects) {
+                clauses.push_back(-effectLit);
+                clauses.push_back(propositionAtLayer(pos, nextPropLayer));
+                clauses.push_back(0);
+            }
+            for (Proposition neg : effect.negEffects) {
+                clauses.push_back(-effectLit);
+                clauses.push_back(-propositionAtLayer(neg, nextPropLayer));
+                clauses.push_back(0);
+            }
+
+            // A proposition that is mutex with an added one can't be kept
+            for (Proposition pos : effect.posEffects) {
+                for (Proposition q : keptProps) {
+                    if (q == pos || !problem->isMutexProp(pos, q, INT_MAX)) continue;
+                    for (Action noop : problem->getPropPosActions(q)) {
+                        if (problem->isTrivialAction(noop) && problem->isActionEnabled(noop, actionLayer)) {
+                            clauses.push_back(-effectLit);
+                            clauses.push_back(-actionAtLayer(noop, actionLayer));
+                            clauses.push_back(0);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Adds the completion of the axioms for one proposition layer: an axiom fires
+ * iff its body holds, a derived value holds iff one of its axioms fires and
+ * the default value holds iff the derived value doesn't.
+ */
+void PlannerWithSATExtraction::addAxiomClauses(std::vector<int>& clauses, int propLayer) {
+    std::vector<Axiom>& axioms = problem->getAxioms();
+    for (int r = 0; r < (int) axioms.size(); r++) {
+        int axiomLit = axiomAtLayer(r, propLayer);
+
+        bool possible = true;
+        for (Proposition b : axioms[r].body) {
+            if (!problem->isPropEnabled(b, propLayer)) possible = false;
+        }
+        if (!possible) {
+            clauses.push_back(-axiomLit);
+            clauses.push_back(0);
+            continue;
+        }
+
+        for (Proposition b : axioms[r].body) {
+            clauses.push_back(-axiomLit);
+            clauses.push_back(propositionAtLayer(b, propLayer));
+            clauses.push_back(0);
+        }
+        for (Proposition b : axioms[r].body) {
+            clauses.push_back(-propositionAtLayer(b, propLayer));
+        }
+        clauses.push_back(axiomLit);
+        clauses.push_back(0);
+
+        clauses.push_back(-axiomLit);
+        clauses.push_back(propositionAtLayer(axioms[r].head, propLayer));
+        clauses.push_back(0);
+    }
+
+    for (Variable v : problem->getDerivedVariables()) {
+        int defaultLit = propositionAtLayer(Proposition(v, problem->getDerivedDefaultValue(v)), propLayer);
+        int derivedLit = propositionAtLayer(Proposition(v, 1 - problem->getDerivedDefaultValue(v)), propLayer);
+
+        clauses.push_back(-derivedLit);
+        for (int r : variableAxioms[v]) {
+            clauses.push_back(axiomAtLayer(r, propLayer));
+        }
+        clauses.push_back(0);
+
+        clauses.push_back(defaultLit);
+        clauses.push_back(derivedLit);
+        clauses.push_back(0);
+        clauses.push_back(-defaultLit);
+        clauses.push_back(-derivedLit);
+        clauses.push_back(0);
+    }
+}
+
+/**
+ * Adds a clause for each (non-derived) variable that requires one of its
+ * values to be true. Otherwise, a proposition could just disappear from one
+ * layer to the next, which would make conditions of effects and axiom bodies
+ * false without any action. Propositions that are mutex with each other can
+ * only be added by mutex actions, so there is at most one value as well.
+ */
+void PlannerWithSATExtraction::addVariableValueClauses(std::vector<int>& clauses, int propLayer) {
+    std::vector<std::list<int>> values(problem->getVariableCount());
+    for (Proposition p : problem->getLayerPropositions(propLayer)) {
+        values[p.first].push_back(propositionAtLayer(p, propLayer));
+    }
+
+    for (Variable v = 0; v < problem->getVariableCount(); v++) {
+        if (values[v].empty() || problem->isDerivedProposition(Proposition(v, 0))) continue;
+        for (int lit : values[v]) {
+            clauses.push_back(lit);
+        }
+        clauses.push_back(0);
+    }
 }
 
 void PlannerWithSATExtraction::expand() {
@@ -147,16 +439,43 @@ void PlannerWithSATExtraction::expand() {
     addClausesToSolver(solver, problem->getLastActionLayer());
 }
 
-int PlannerWithSATExtraction::extract(void *solver, std::list<Proposition> goal, int layer, Plan& plan) {
+int PlannerWithSATExtraction::extract(void *solver, int layer, Plan& plan, int assumption) {
     log(0, "Extracting in layer %d with SAT Extraction\n", layer);
 
-    // Assume that the goal is true in this layer
-    for (Proposition p : goal) {
-        ipasir_assume(solver, propositionAtLayer(p, layer));
+    // Assume that the goal is activated in this layer (or in some layer up to
+    // this one). All clauses stay valid for other layers, so the solver can be
+    // reused for any layer afterwards.
+    int activation = settings->getAnyGoalLayer() ? goalUpToLayer(layer) : goalAtLayer(layer);
+    ipasir_assume(solver, activation);
+    if (assumption) {
+        ipasir_assume(solver, assumption);
     }
 
-    if (ipasir_solve(solver) == IPASIR_IS_SAT) {
-        for (int i = problem->getFirstActionLayer(); i <= problem->getActionLayerBeforePropLayer(layer); i++) {
+    int result;
+    {
+        PhaseTimer timer(PHASE_SOLVE);
+        MetricTimer metricTimer(METRIC_SOLVE_MICROSECONDS);
+        TraceScope trace("solve", layer);
+        countMetric(METRIC_SOLVER_CALLS);
+        result = ipasir_solve(solver);
+    }
+    if (result != IPASIR_IS_SAT && result != IPASIR_IS_UNSAT) {
+        traceInstant("terminated", layer);
+    }
+    if (result == IPASIR_IS_SAT) {
+        // Find the earliest layer in which the goal has been reached
+        int goalLayer = layer;
+        if (settings->getAnyGoalLayer()) {
+            for (int l = problem->getPropLayerAfterActionLayer(problem->getFirstActionLayer()); l < layer; l++) {
+                int lit = goalAtLayer(l);
+                if (ipasir_val(solver, lit) == lit) {
+                    goalLayer = l;
+                    break;
+                }
+            }
+        }
+
+        for (int i = problem->getFirstActionLayer(); i <= problem->getActionLayerBeforePropLayer(goalLayer); i++) {
             std::list<Action> actions;
             for (Action a : problem->getLayerActions(i)) {
                 int lit = actionAtLayer(a, i);
@@ -166,19 +485,32 @@ int PlannerWithSATExtraction::extract(void *solver, std::list<Proposition> goal,
             }
             plan.addLayer(actions);
         }
-        log (0, "Done extracting: success\n");
+        log (0, "Done extracting: success in layer %d\n", goalLayer);
         return 1;
     } else {
+        // Clauses of later layers can not make this layer solvable, so the
+        // activation literal can be ruled out permanently (unless the
+        // additional assumption caused it)
+        if (result == IPASIR_IS_UNSAT && !assumption) {
+            ipasir_add(solver, -activation);
+            ipasir_add(solver, 0);
+        }
         log (0, "Done extracting: failure/terminated\n");
         return 0;
     }
 }
 
+/*
+ * Variables are numbered in blocks of one action layer followed by the next
+ * proposition layer, its two goal activation literals, the conditional
+ * effects of the action layer and the axioms of the proposition layer.
+ */
+
 /*
  * Returns the variable number for SAT solving of a proposition being true in a given layer
  */
 int PlannerWithSATExtraction::propositionAtLayer(Proposition p, int layer) {
-    int r = (countPropositions + countActions) * (layer - 2) + countActions + 1 + problem->getPropositionNumber(p);
+    int r = layerVariableCount * (layer - 2) + countActions + 1 + problem->getPropositionNumber(p);
     return r;
 }
 
@@ -186,10 +518,45 @@ int PlannerWithSATExtraction::propositionAtLayer(Proposition p, int layer) {
  * Returns the variable number for SAT solving of an action being used in a given layer
  */
 int PlannerWithSATExtraction::actionAtLayer(Action a, int layer) {
-    int r = (countPropositions + countActions) * (layer - 1) + 1 + a;
+    int r = layerVariableCount * (layer - 1) + 1 + a;
     return r;
 }
 
+/*
+ * Returns the variable number for SAT solving of the goal being activated in a
+ * given proposition layer
+ */
+int PlannerWithSATExtraction::goalAtLayer(int layer) {
+    int r = layerVariableCount * (layer - 2) + countActions + countPropositions + 1;
+    return r;
+}
+
+/*
+ * Returns the variable number for SAT solving of the goal being activated in
+ * some proposition layer up to a given one
+ */
+int PlannerWithSATExtraction::goalUpToLayer(int layer) {
+    return goalAtLayer(layer) + 1;
+}
+
+/*
+ * Returns the variable number for SAT solving of a conditional effect of an
+ * action occurring in a given action layer
+ */
+int PlannerWithSATExtraction::effectAtLayer(Action a, int effect, int layer) {
+    return layerVariableCount * (layer - 1) + countActions + countPropositions + 3
+        + conditionalEffectOffset[a] + effect;
+}
+
+/*
+ * Returns the variable number for SAT solving of an axiom firing in a given
+ * proposition layer
+ */
+int PlannerWithSATExtraction::axiomAtLayer(int axiom, int layer) {
+    return layerVariableCount * (layer - 2) + countActions + countPropositions + 3
+        + countConditionalEffects + axiom;
+}
+
 
 int PlannerWithSATExtraction::horizon(int n) {
     // Get parameters
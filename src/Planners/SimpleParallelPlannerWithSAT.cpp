@@ -3,36 +3,62 @@
 #include <algorithm>
 #include <assert.h>
 #include <map>
+#include <climits>
 
-#include <unistd.h>
+#include <chrono>
 #include <thread>
 
 #include "Planners/SimpleParallelPlannerWithSAT.h"
 #include "Logger.h"
+#include "Trace.h"
+#include "Memory.h"
+#include "PlanOutput.h"
+#include "PlanPostprocessor.h"
 #include "Settings.h"
 
 #include "ipasir_cpp.h"
 
 
 
-SimpleParallelPlannerWithSAT::SimpleParallelPlannerWithSAT(IPlanningProblem *problem) {
+SimpleParallelPlannerWithSAT::SimpleParallelPlannerWithSAT(IPlanningProblem *problem, SATSolverThreadPool *pool) {
     this->problem = problem;
     problemSolved = false;
+    bestLayer = INT_MAX;
+    bestActionCount = INT_MAX;
+    anytimeStopped = false;
+    minimizationDone = false;
+    outOfMemory = false;
     lastFailedLayer = 0;
     horizonOffset = 0;
+    deadlineTime = settings->getDeadline() > 0 ? getTime() + settings->getDeadline() : 0;
 
-    // Create thread pool with 1 tag (0)
-    int threadCount = settings->getThreadCount();
-    threadPool = new SATSolverThreadPool(1);
-    threadPool->addWorkers(0, threadCount, createSATSolver, this);
-
-    // Get action and proposition count from problem data
+    // Get action and proposition count from problem data. The layout may
+    // reject the problem, which has to happen before the workers are set up.
     countActions = problem->getActionCount();
     countPropositions = problem->getPropositionCount();
+    initVariableLayout();
+
+    // Create thread pool with 1 tag (0)
+    int threadCount = settings->getThreadCount();
+    if (pool) {
+        // Workers of a previous problem get fresh solvers
+        threadPool = pool;
+        ownsThreadPool = false;
+        threadPool->resetSolvers(0, createSATSolver, this);
+    } else {
+        threadPool = new SATSolverThreadPool(1);
+        ownsThreadPool = true;
+        threadPool->addWorkers(0, threadCount, createSATSolver, this);
+    }
 }
 
 SimpleParallelPlannerWithSAT::~SimpleParallelPlannerWithSAT() {
-    delete threadPool;
+    if (ownsThreadPool) {
+        delete threadPool;
+    } else {
+        // Remaining jobs refer to this planner
+        threadPool->waitIdle(0);
+    }
 }
 
 int SimpleParallelPlannerWithSAT::graphplan(Plan& plan) {
@@ -41,7 +67,7 @@ int SimpleParallelPlannerWithSAT::graphplan(Plan& plan) {
     // Expand the graph until we hit a fixed-point level or we find out that
     // the problem is unsolvable.
     while (!fixedPoint && checkGoalUnreachable()) {
-        expand();
+        Planner::expand();
         fixedPoint = fixedPoint || checkFixedPoint();
         horizonOffset++;
     }
@@ -54,14 +80,20 @@ int SimpleParallelPlannerWithSAT::graphplan(Plan& plan) {
 
     // Inverted horizon, used to determine how far to expand before "going idle"
     std::map<int, int> horizonInv;
+    // Layers that extraction jobs have been queued for
+    std::set<int> queuedLayers;
     int iteration = 0;
+    int seenFinishedJobs = 0;
+
+    while (!problemSolved && !outOfMemory && !isDeadlineReached()) {
+        enforceMemoryBudget();
 
-    while (!problemSolved) {
         // Determine if graph shall be expanded
         bool doExpand = false;
         {
             // Calculation depends on the layer of the last failed extraction
             std::unique_lock<std::mutex> lck(lastFailedLayerMutex);
+            seenFinishedJobs = finishedJobs;
             // Expand far enough (so that each thread has something to work with)
             if (iteration <= horizonInv[lastFailedLayer]+settings->getThreadCount()) {
                 doExpand = true;
@@ -74,33 +106,205 @@ int SimpleParallelPlannerWithSAT::graphplan(Plan& plan) {
             horizonInv[extractionLayer] = iteration;
 
             // Queue an extraction job to the pool
-            ThreadParameters *tp = new ThreadParameters();
-            tp->planner = this;
-            tp->layer = extractionLayer;
-            SATSolverThreadPool::Job j;
-            j.func = extractionThread;
-            j.arguments = (void*)tp;
-            threadPool->enqueueJob(0, j);
+            queueJob(extractionLayer, false);
+            queuedLayers.insert(extractionLayer);
 
             // Expand the graph to the horizon
             while (problem->getLastActionLayer() < horizon(iteration+1)) {
-                expand();
+                Planner::expand();
                 fixedPoint = fixedPoint || checkFixedPoint();
             }
 
             iteration++;
         } else {
-            sleep(1);
+            waitForJob(seenFinishedJobs);
         }
     }
 
+    // Use the remaining time to find better plans
+    if (problemSolved && settings->getAnytime()) {
+        improvePlan(queuedLayers);
+    }
+    // Stop the remaining jobs
+    anytimeStopped = true;
+
+    if (!problemSolved) {
+        if (outOfMemory) {
+            log(0, "Memory budget exceeded, giving up\n");
+        } else {
+            log(0, "Deadline reached, giving up\n");
+        }
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lck(solvedMutex);
     plan = solution;
 
     return true;
 }
 
+/**
+ * Anytime mode: after the first plan, the layers below the best plan that
+ * haven't been tried yet (because of the horizon) are queued, so the idle
+ * workers look for plans with fewer layers. The shortest plan found so far is
+ * then improved by minimizing its actions. Ends when the plan is optimal in
+ * both respects, or at the deadline.
+ */
+void SimpleParallelPlannerWithSAT::improvePlan(std::set<int>& queuedLayers) {
+    log(0, "Searching for better plans\n");
+
+    // Layer of the last queued minimization job
+    int minimizedLayer = 0;
+    int seenFinishedJobs = 0;
+
+    while (!outOfMemory && !isDeadlineReached()) {
+        enforceMemoryBudget();
+        {
+            std::unique_lock<std::mutex> lck(lastFailedLayerMutex);
+            seenFinishedJobs = finishedJobs;
+        }
+
+        // All shorter layers failed and the actions can't be reduced further
+        int best = bestLayer;
+        if (lastFailedLayer >= best-1 && minimizationDone) {
+            log(0, "Plan is optimal\n");
+            break;
+        }
+
+        for (int layer = lastFailedLayer+1; layer < best; layer++) {
+            if (queuedLayers.insert(layer).second) {
+                queueJob(layer, false);
+            }
+        }
+        // A shorter plan needs to be minimized again
+        if (minimizedLayer != best) {
+            queueJob(best, true);
+            minimizedLayer = best;
+        }
+
+        waitForJob(seenFinishedJobs);
+    }
+}
+
+/**
+ * Finds the plan with the fewest non-trivial actions in the given layer by
+ * adding a cardinality constraint on the action literals (sequential counter)
+ * and solving with decreasing bounds. Each plan found is better than the
+ * previous one and is reported as an improvement.
+ */
+void SimpleParallelPlannerWithSAT::minimizeActions(void *solver, int layer) {
+    TraceScope trace("minimize", layer);
+
+    // Literals of the actions that are counted
+    std::vector<int> literals;
+    for (int i = problem->getFirstActionLayer(); i <= layer; i++) {
+        for (Action a : problem->getLayerActions(i)) {
+            if (!problem->isTrivialAction(a)) {
+                literals.push_back(actionAtLayer(a, i));
+            }
+        }
+    }
+
+    int n = literals.size();
+    int k;
+    {
+        std::unique_lock<std::mutex> lck(solvedMutex);
+        k = bestActionCount;
+    }
+    if (n == 0 || k == 0 || (long long) n * k > MINIMIZATION_MAX_COUNTER_VARIABLES) {
+        log(1, "Not minimizing %d actions with %d possible actions\n", k, n);
+        std::unique_lock<std::mutex> lck(solvedMutex);
+        if (layer == bestLayer) minimizationDone = true;
+        return;
+    }
+
+    // Counter variables s(i, j) follow all variables of the solver. s(i, j)
+    // is true if at least j of the first i literals are true, for j <= k.
+    int base;
+    {
+        std::unique_lock<std::mutex> lck(solversLastLayerMutex);
+        if (solversFreeVariable.count(solver) == 0) {
+            solversFreeVariable[solver] = layerVariableCount * (problem->getLastLayer()+2) + 1;
+        }
+        base = solversFreeVariable[solver];
+        solversFreeVariable[solver] += n * k;
+    }
+    auto counter = [&](int i, int j) { return base + (i-1)*k + (j-1); };
+
+    long long clauseCount = 0;
+    for (int i = 1; i <= n; i++) {
+        int x = literals[i-1];
+        ipasir_add(solver, -x);
+        ipasir_add(solver, counter(i, 1));
+        ipasir_add(solver, 0);
+        clauseCount++;
+        if (i == 1) continue;
+        for (int j = 1; j <= k; j++) {
+            ipasir_add(solver, -counter(i-1, j));
+            ipasir_add(solver, counter(i, j));
+            ipasir_add(solver, 0);
+            if (j > 1) {
+                ipasir_add(solver, -x);
+                ipasir_add(solver, -counter(i-1, j-1));
+                ipasir_add(solver, counter(i, j));
+                ipasir_add(solver, 0);
+            }
+            clauseCount += 2;
+        }
+        if (isTerminated()) return;
+    }
+    addSolverMemory(solver, clauseCount, 3 * clauseCount);
+
+    // Solve with fewer actions than the best plan, until that is impossible
+    int bound = k-1;
+    while (bound >= 0 && layer == bestLayer) {
+        log(1, "Searching plan with at most %d actions in layer %d\n", bound, layer);
+        Plan plan;
+        int success = extract(solver, problem->getPropLayerAfterActionLayer(layer),
+                plan, -counter(n, bound+1));
+        if (!success) {
+            if (isTerminated()) return;
+            break;
+        }
+        markProblemSolved(plan, layer);
+        bound = std::min(bound, countPlanActions(plan)) - 1;
+    }
+
+    std::unique_lock<std::mutex> lck(solvedMutex);
+    if (layer == bestLayer) minimizationDone = true;
+}
+
+/**
+ * Reduces the amount of workers while the memory budget is exceeded, which
+ * releases their solvers. Gives up if a single worker is already too much.
+ */
+void SimpleParallelPlannerWithSAT::enforceMemoryBudget() {
+    if (!isOverMemoryBudget()) return;
+
+    // Fewer solvers can't help if the planning graph alone is too large
+    if (getGraphMemory() > getMemoryBudget()) {
+        if (!outOfMemory) {
+            log(0, "The planning graph alone needs %s, more than the memory budget of %s\n",
+                    formatMemory(getGraphMemory()).c_str(), formatMemory(getMemoryBudget()).c_str());
+        }
+        outOfMemory = true;
+        return;
+    }
+
+    // Wait until the last retired worker has released its solver
+    int workers = threadPool->getWorkerLimit(0);
+    if (threadPool->getRunningWorkerCount(0) > workers) return;
+
+    if (workers > 1) {
+        log(0, "Memory budget exceeded, reducing to %d workers\n", workers-1);
+        threadPool->setWorkerLimit(0, workers-1);
+    } else {
+        outOfMemory = true;
+    }
+}
+
 // Initializes one SAT solver for one thread
-void* SimpleParallelPlannerWithSAT::createSATSolver(void *args) {
+void* SimpleParallelPlannerWithSAT::createSATSolver(void* /* args */) {
 	void *solver = ipasir_init();
 
     #ifndef PGP_NOSETLEARN
@@ -119,67 +323,183 @@ void* SimpleParallelPlannerWithSAT::extractionThread(void* solver, void* args) {
     ThreadParameters *param = (ThreadParameters*) args;
     SimpleParallelPlannerWithSAT *planner = param->planner;
     int layer = param->layer;
+    TraceScope trace("extraction", layer);
 
     // If problem has been solved in the meantime, abort prematurely
-    if (planner->problemSolved) {
+    if (solverTerminator(args)) {
+        planner->notifyJobFinished();
         delete param;
         return NULL;
     }
 
-    // Get the last layer of clauses that have been added to the solver
-    int lastLayer = 1;
-    if (planner->solversLastLayer.count(solver) == 0) {
-        planner->solversLastLayer[solver] = 1;
-    } else {
-        lastLayer = planner->solversLastLayer[solver];
-    }
+    // Jobs are only created for layers that are already expanded, so the
+    // layer has to be committed. Committed layers are read without locking.
+    assert(layer <= planner->problem->getCommittedActionLayer());
 
     // Set termination callback for SAT solver, including information of the
     // current extraction run, e.g. which layer.
 	ipasir_set_terminate(solver, args, solverTerminator);
 
     // Add necessary clauses to this thread's SAT solver
-    for (int i = lastLayer; i <= layer; i++) {
-        planner->addClausesToSolver(solver, i);
-        // If problem has been solved in the meantime, abort prematurely
-        if (planner->problemSolved) {
-            delete param;
-            return NULL;
-        }
+    if (!planner->addLayersToSolver(solver, layer)) {
+        planner->notifyJobFinished();
+        delete param;
+        return NULL;
     }
-    // Update solver information
-    planner->solversLastLayer[solver] = layer;
-
-    // Extract plan
-    Plan plan;
-    int success = planner->extract(solver,
-            planner->problem->getGoal(),
-            planner->problem->getPropLayerAfterActionLayer(layer),
-            plan);
-
-    if (success) {
-        // Mark the problem as solved so planner can terminate
-        planner->markProblemSolved(plan);
+
+    if (param->minimize) {
+        planner->minimizeActions(solver, layer);
     } else {
-        // Update last failed layer so other threads can terminate that work
-        // on extraction from a lower layer
-        std::unique_lock<std::mutex> lck(planner->lastFailedLayerMutex);
-        if (planner->lastFailedLayer < layer) {
-            planner->lastFailedLayer = layer;
+        // Extract plan
+        Plan plan;
+        int success = planner->extract(solver,
+                planner->problem->getPropLayerAfterActionLayer(layer),
+                plan);
+
+        if (success) {
+            // Mark the problem as solved so planner can terminate
+            planner->markProblemSolved(plan, layer);
+        } else if (!solverTerminator(args)) {
+            // Update last failed layer so other threads can terminate that
+            // work on extraction from a lower layer
+            std::unique_lock<std::mutex> lck(planner->lastFailedLayerMutex);
+            if (planner->lastFailedLayer < layer) {
+                planner->lastFailedLayer = layer;
+            }
         }
     }
+    planner->notifyJobFinished();
 
     delete param;
 	return NULL;
 }
 
 
+// Adds the clauses of the layers that the solver doesn't have yet
+int SimpleParallelPlannerWithSAT::addLayersToSolver(void *solver, int layer) {
+    // Get the last layer of clauses that have been added to the solver
+    int lastLayer = 1;
+    {
+        std::unique_lock<std::mutex> lck(solversLastLayerMutex);
+        if (solversLastLayer.count(solver) == 0) {
+            solversLastLayer[solver] = 1;
+        } else {
+            lastLayer = solversLastLayer[solver];
+        }
+    }
+
+    for (int i = lastLayer; i <= layer; i++) {
+        addClausesToSolver(solver, i);
+        // If problem has been solved in the meantime, abort prematurely
+        if (isTerminated()) {
+            return false;
+        }
+    }
+    // Update solver information
+    {
+        std::unique_lock<std::mutex> lck(solversLastLayerMutex);
+        solversLastLayer[solver] = std::max(lastLayer, layer);
+    }
+    return true;
+}
+
+// Queues an extraction (or minimization) job for the given layer
+void SimpleParallelPlannerWithSAT::queueJob(int layer, bool minimize) {
+    ThreadParameters *tp = new ThreadParameters();
+    tp->planner = this;
+    tp->layer = layer;
+    tp->minimize = minimize;
+    SATSolverThreadPool::Job j;
+    j.func = extractionThread;
+    j.arguments = (void*)tp;
+    threadPool->enqueueJob(0, j);
+}
+
+// Waits until a job finished, at most a second (to check the memory budget
+// again) or until the deadline
+void SimpleParallelPlannerWithSAT::waitForJob(int seenFinishedJobs) {
+    std::chrono::milliseconds timeout(1000);
+    if (deadlineTime > 0) {
+        long remaining = (long) ((deadlineTime - getTime()) * 1000) + 1;
+        timeout = std::chrono::milliseconds(std::max(1L, std::min(1000L, remaining)));
+    }
+    std::unique_lock<std::mutex> lck(lastFailedLayerMutex);
+    jobFinished.wait_for(lck, timeout,
+            [&]() { return finishedJobs != seenFinishedJobs; });
+}
+
+bool SimpleParallelPlannerWithSAT::isDeadlineReached() {
+    return deadlineTime > 0 && getTime() >= deadlineTime;
+}
+
+bool SimpleParallelPlannerWithSAT::isTerminated() {
+    // In anytime mode, the jobs go on after the first plan
+    return (problemSolved && !settings->getAnytime()) || anytimeStopped || outOfMemory;
+}
+
+int SimpleParallelPlannerWithSAT::countPlanActions(Plan& plan) {
+    int count = 0;
+    for (int i = 0; i < plan.getLayerCount(); i++) {
+        for (Action a : plan.getLayerActions(i)) {
+            if (!problem->isTrivialAction(a)) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+// Wakes the main loop, which may queue a new job now
+void SimpleParallelPlannerWithSAT::notifyJobFinished() {
+    std::unique_lock<std::mutex> lck(lastFailedLayerMutex);
+    finishedJobs++;
+    jobFinished.notify_all();
+}
+
 // Can be called by a thread to provide a solution to the planning problem.
-void SimpleParallelPlannerWithSAT::markProblemSolved(Plan plan) {
+// In anytime mode, a plan is better than the current solution if it has fewer
+// layers, or as many layers and fewer actions.
+void SimpleParallelPlannerWithSAT::markProblemSolved(Plan plan, int layer) {
     std::unique_lock<std::mutex> lck(solvedMutex);
-    if (!problemSolved) {
-        problemSolved = true;
-        solution = plan;
+    bool first = !problemSolved;
+    if (!first && !settings->getAnytime()) return;
+
+    // With -anygoal the plan may end before the extraction layer
+    int planLayer = std::min(layer, problem->getFirstActionLayer() + plan.getLayerCount() - 1);
+    int actionCount = countPlanActions(plan);
+    if (!first && (planLayer > bestLayer
+                || (planLayer == bestLayer && actionCount >= bestActionCount))) {
+        return;
+    }
+
+    // Invalid plans are never output or returned, so findPlan can't reject
+    // a plan that was already output
+    PlanPostprocessor postprocessor(problem);
+    if (!postprocessor.isValid(plan)) {
+        log(0, "Discarding invalid plan of layer %d\n", layer);
+        return;
+    }
+
+    if (planLayer < bestLayer) {
+        minimizationDone = false;
+    }
+    // Plans that are output right away are improved here
+    bool emit = settings->getAnytime() || settings->getEarlyPlan();
+    if (emit && settings->getPostprocessing()) {
+        plan = postprocessor.improve(plan);
+    }
+    solution = plan;
+    bestLayer = planLayer;
+    bestActionCount = actionCount;
+    problemSolved = true;
+
+    if (settings->getAnytime()) {
+        log(0, "%s plan: %d layers, %d actions\n", first ? "First" : "Improved",
+                planLayer, actionCount);
+        emitImprovedPlan(problem, plan);
+    } else if (settings->getEarlyPlan()) {
+        // Output the plan before the other workers are stopped
+        emitPlan(problem, plan);
     }
 }
 
@@ -192,20 +512,13 @@ int SimpleParallelPlannerWithSAT::solverTerminator(void* state) {
     auto *p = (SimpleParallelPlannerWithSAT::ThreadParameters*) state;
     int layer = p->layer;
     auto *planner = p->planner;
+    // Minimization goes on until a plan with fewer layers is found
+    if (p->minimize) {
+        return planner->isTerminated() || planner->bestLayer < layer;
+    }
     // If problem was solved, or extraction failed at a higher layer, terminate
-    int t = planner->problemSolved || planner->lastFailedLayer >= layer;
+    int t = planner->isTerminated() || planner->lastFailedLayer >= layer
+            || (planner->problemSolved && planner->bestLayer <= layer);
 	return t;
 }
 
-void SimpleParallelPlannerWithSAT::expand() {
-    // Get lock and then expand graph
-    std::unique_lock<std::mutex> lck(graphMutex);
-    Planner::expand();
-}
-
-void SimpleParallelPlannerWithSAT::addClausesToSolver(void *solver, int actionLayer) {
-    // Get lock and then add clauses
-    std::unique_lock<std::mutex> lck(graphMutex);
-    PlannerWithSATExtraction::addClausesToSolver(solver, actionLayer);
-}
-
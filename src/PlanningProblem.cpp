@@ -1,68 +1,192 @@
 #include <climits>
 #include <assert.h>
 #include <iostream>
+#include <algorithm>
+#include <functional>
 
 #include "Logger.h"
+#include "Memory.h"
 
 #include "PlanningProblem.h"
 #include "IPlanningProblem.h"
 
 
 
+PlanningProblem::~PlanningProblem() {
+    delete[] propMutexes;
+    delete[] actionMutexes;
+    delete[] propFirstLayer;
+    delete[] actionFirstLayer;
+}
+
 int PlanningProblem::getVariableCount() {
     return countVariables;
 }
 
-int PlanningProblem::getActionCount() {
-    return countActions;
+std::list<Proposition> PlanningProblem::getGoal() {
+    return std::list<Proposition>(goalPropositions);
 }
 
-int PlanningProblem::getPropositionCount() {
-    return totalPropositionCount;
+std::vector<ConditionalEffect>& PlanningProblem::getActionConditionalEffects(Action a) {
+    return actionCondEffs[a];
 }
 
-int PlanningProblem::getPropositionNumber(Proposition p) {
-    return variableMutexIndex[p.first] + p.second;
+std::list<std::pair<Action, int>>& PlanningProblem::getPropConditionalActions(Proposition p) {
+    return propCondActions[getPropositionNumber(p)];
 }
 
-std::list<Proposition> PlanningProblem::getGoal() {
-    return std::list<Proposition>(goalPropositions);
+std::vector<Axiom>& PlanningProblem::getAxioms() {
+    return axioms;
 }
 
-std::list<Proposition>& PlanningProblem::getActionPreconditions(Action a) {
-    return actionPrecs[a];
+std::vector<Variable>& PlanningProblem::getDerivedVariables() {
+    return derivedVariables;
 }
 
-std::list<Proposition>& PlanningProblem::getActionPosEffects(Action a) {
-    return actionPosEffs[a];
+VariableValue PlanningProblem::getDerivedDefaultValue(Variable v) {
+    return derivedDefaultValue[v];
 }
 
-std::list<Proposition>& PlanningProblem::getActionNegEffects(Action a) {
-    return actionNegEffs[a];
+int PlanningProblem::hasRecursiveAxioms() {
+    return recursiveAxioms;
 }
 
-std::list<Action>& PlanningProblem::getPropPosActions(Proposition p) {
-    return propPosActions[p];
-}
+/**
+ * Evaluates the axioms in a state that holds the default value for every
+ * derived variable and returns the resulting derived propositions. Axioms are
+ * ordered by layer, so each layer reaches its fixed point before a higher
+ * layer reads the default values of its variables.
+ */
+std::list<Proposition> PlanningProblem::evaluateAxioms(std::vector<VariableValue> state) {
+    size_t begin = 0;
+    while (begin < axioms.size()) {
+        int layer = variableAxiomLayer[axioms[begin].head.first];
+        size_t end = begin;
+        while (end < axioms.size() && variableAxiomLayer[axioms[end].head.first] == layer) end++;
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t i = begin; i < end; i++) {
+                Axiom& axiom = axioms[i];
+                if (state[axiom.head.first] == axiom.head.second) continue;
+                bool holds = std::all_of(axiom.body.begin(), axiom.body.end(),
+                    [&state](Proposition b) { return state[b.first] == b.second; });
+                if (holds) {
+                    state[axiom.head.first] = axiom.head.second;
+                    changed = true;
+                }
+            }
+        }
+        begin = end;
+    }
 
-int PlanningProblem::getFirstLayer() {
-    return 1;
+    std::list<Proposition> derived;
+    for (Variable v : derivedVariables) {
+        derived.push_back(Proposition(v, state[v]));
+    }
+    return derived;
 }
 
-int PlanningProblem::getLastLayer() {
-    return lastPropLayer;
-}
+/**
+ * Checks if some derived proposition can be derived from itself (through
+ * derived propositions in the bodies that are not default values).
+ */
+int PlanningProblem::checkRecursiveAxioms() {
+    // Dependencies between derived propositions, indexed by proposition number
+    std::vector<std::list<int>> dependents(totalPropositionCount);
+    for (Axiom& axiom : axioms) {
+        for (Proposition b : axiom.body) {
+            if (isDerivedProposition(b) && b.second != derivedDefaultValue[b.first]) {
+                dependents[getPropositionNumber(b)].push_back(getPropositionNumber(axiom.head));
+            }
+        }
+    }
 
-int PlanningProblem::getFirstActionLayer() {
-    return 1;
+    // Depth-first search for a cycle (0: unvisited, 1: on stack, 2: done)
+    std::vector<int> state(totalPropositionCount, 0);
+    std::function<bool(int)> cyclic = [&](int p) {
+        state[p] = 1;
+        for (int q : dependents[p]) {
+            if (state[q] == 1 || (state[q] == 0 && cyclic(q))) return true;
+        }
+        state[p] = 2;
+        return false;
+    };
+    for (int p = 0; p < totalPropositionCount; p++) {
+        if (state[p] == 0 && cyclic(p)) return true;
+    }
+    return false;
 }
 
-int PlanningProblem::getLastActionLayer() {
-    return lastActionLayer;
+/**
+ * Backward relevance analysis. Goal propositions have distance 0, an action
+ * has the distance of its closest positive effect plus one and its
+ * preconditions (and the conditions of that effect) have the distance of the
+ * action. Nodes that are never reached this way keep the distance INT_MAX and
+ * can never contribute to the goal.
+ */
+void PlanningProblem::computeGoalDistances() {
+    // Whether a default value of a derived variable holds depends on which
+    // actions delete the bodies of its axioms, which the backward search can't
+    // follow. With axioms, every node is therefore relevant.
+    if (hasAxioms()) {
+        actionGoalDistance.assign(countActions, 1);
+        propGoalDistance.assign(totalPropositionCount, 0);
+        return;
+    }
+
+    actionGoalDistance.assign(countActions, INT_MAX);
+    propGoalDistance.assign(totalPropositionCount, INT_MAX);
+
+    // Breadth-first search from the goal, so every distance is minimal
+    std::list<Proposition> queue;
+    auto reach = [this, &queue](Proposition p, int distance) {
+        if (propGoalDistance[getPropositionNumber(p)] == INT_MAX) {
+            propGoalDistance[getPropositionNumber(p)] = distance;
+            queue.push_back(p);
+        }
+    };
+    for (Proposition g : goalPropositions) {
+        reach(g, 0);
+    }
+
+    while (!queue.empty()) {
+        Proposition p = queue.front();
+        queue.pop_front();
+        int distance = propGoalDistance[getPropositionNumber(p)] + 1;
+
+        for (Action a : getPropPosActions(p)) {
+            if (actionGoalDistance[a] != INT_MAX) continue;
+            actionGoalDistance[a] = distance;
+
+            for (Proposition prec : actionPrecs[a]) {
+                reach(prec, distance);
+            }
+        }
+
+        for (auto& provider : getPropConditionalActions(p)) {
+            Action a = provider.first;
+            for (Proposition c : actionCondEffs[a][provider.second].conditions) {
+                reach(c, distance);
+            }
+            if (actionGoalDistance[a] != INT_MAX) continue;
+            actionGoalDistance[a] = distance;
+
+            for (Proposition prec : actionPrecs[a]) {
+                reach(prec, distance);
+            }
+        }
+    }
 }
 
 int PlanningProblem::addPropositionLayer() {
     log(4, "addPropositionLayer. lastPropLayer=%d\n", lastPropLayer);
+    // Layers beyond the fixed point are equal to it and aren't stored
+    if (fixedPointLayer) {
+        return ++lastPropLayer;
+    }
+
     // No mutexes in this layer yet
     layerPropMutexCount.push_back(0);
 
@@ -80,38 +204,54 @@ int PlanningProblem::addPropositionLayer() {
 }
 
 int PlanningProblem::addActionLayer() {
+    if (fixedPointLayer) {
+        return ++lastActionLayer;
+    }
+
     // At least same actions as previous layer are available
     if (lastActionIndices.empty()) {
         lastActionIndices.push_back(-1);
     } else {
         lastActionIndices.push_back(lastActionIndices.back());
-        // Update lists representations of layerActions
-        auto end = layerActions.begin() + lastActionIndices[lastActionLayer] + 1;
-        std::list<Action> acts(layerActions.begin(), end);
-        layerActionsLists.push_back(acts);
     }
     lastActionLayer++;
 
     return lastActionLayer;
 }
 
-int PlanningProblem::isPropEnabled(Proposition p, int layer) {
-    return (propFirstLayer[p] <= layer && propFirstLayer[p] > 0);
+/**
+ * Publishes all layers built so far. The release store pairs with the acquire
+ * load in getCommittedActionLayer(), so a reader that sees a committed layer
+ * also sees all of its contents.
+ */
+void PlanningProblem::commitLayers() {
+    committedActionLayer.store(lastActionLayer, std::memory_order_release);
+}
+
+int PlanningProblem::getCommittedActionLayer() {
+    return committedActionLayer.load(std::memory_order_acquire);
 }
 
-int PlanningProblem::isActionEnabled(Action a, int layer) {
-    return (actionFirstLayer[a] <= layer && actionFirstLayer[a] > 0);
+/**
+ * The graph stays as it is up to the given proposition layer and the action
+ * layer before it. Accesses to later layers are redirected to these, so the
+ * graph can be extended to any length in constant time and memory.
+ */
+void PlanningProblem::setFixedPointLayer(int layer) {
+    assert(layer == lastPropLayer && !fixedPointLayer);
+    storedPropLayerLimit.store(layer, std::memory_order_relaxed);
+    storedActionLayerLimit.store(getActionLayerBeforePropLayer(layer), std::memory_order_relaxed);
+    fixedPointLayer.store(layer, std::memory_order_release);
 }
 
-int PlanningProblem::getActionFirstLayer(Action a) {
-    return actionFirstLayer[a];
+int PlanningProblem::getFixedPointLayer() {
+    return fixedPointLayer.load(std::memory_order_acquire);
 }
 
 void PlanningProblem::activateAction(Action a, int layer) {
     lastActionIndices[layer]++;
     layerActions[lastActionIndices[layer]] = a;
-    layerActionsLists[layer-1].push_back(a);
-    actionFirstLayer[a] = layer;
+    actionFirstLayer[a].store(layer, std::memory_order_relaxed);
 
     // Add positive effects of action to next proposition layer
     for (auto& p : getActionPosEffects(a)) {
@@ -121,33 +261,15 @@ void PlanningProblem::activateAction(Action a, int layer) {
 
 void PlanningProblem::activateProposition(Proposition p, int layer) {
     if (!isPropEnabled(p, layer)) {
-        propFirstLayer[p] = layer;
-        layerProps.push_back(p);
+        propFirstLayer[getPropositionNumber(p)].store(layer, std::memory_order_relaxed);
         lastPropIndices[layer]++;
+        layerProps[lastPropIndices[layer]] = p;
     }
 }
 
-std::list<Proposition> PlanningProblem::getLayerPropositions(int layer) {
-    // + 1 because the last proposition needs to be included here
-    auto end = layerProps.begin() + lastPropIndices[layer] + 1;
-    return std::list<Proposition>(layerProps.begin(), end);
-}
-
-std::list<Action>& PlanningProblem::getLayerActions(int layer) {
-    return layerActionsLists[layer-1];
-}
-
-int PlanningProblem::isMutexProp(Proposition p, Proposition q, int layer) {
-    int pMutexNumber = variableMutexIndex[p.first]+p.second;
-    int qMutexNumber = variableMutexIndex[q.first]+q.second;
-    if (p == q) return false;
-    return (propMutexes[pMutexNumber*totalPropositionCount + qMutexNumber] >= layer ||
-        p.first == q.first);
-}
-
-int PlanningProblem::isMutexAction(Action a, Action b, int layer) {
-    if (a == b) return false;
-    return actionMutexes[a*countActions + b] >= layer;
+int PlanningProblem::getActionMutexLastLayer(Action a, Action b) {
+    if (a == b) return 0;
+    return actionMutexes[a*countActions + b].load(std::memory_order_relaxed);
 }
 
 void PlanningProblem::setMutexProp(Proposition p, Proposition q, int layer) {
@@ -158,19 +280,13 @@ void PlanningProblem::setMutexProp(Proposition p, Proposition q, int layer) {
     if (!isMutexProp(p, q, layer)) {
         int pMutexNumber = variableMutexIndex[p.first]+p.second;
         int qMutexNumber = variableMutexIndex[q.first]+q.second;
-        propMutexes[pMutexNumber*totalPropositionCount + qMutexNumber] = layer;
-        propMutexes[qMutexNumber*totalPropositionCount + pMutexNumber] = layer;
+        propMutexes[pMutexNumber*totalPropositionCount + qMutexNumber].store(layer, std::memory_order_relaxed);
+        propMutexes[qMutexNumber*totalPropositionCount + pMutexNumber].store(layer, std::memory_order_relaxed);
     }
 }
 
-void PlanningProblem::setMutexAction(Action a, Action b, int layer) {
-    if (a == b) return;
-    actionMutexes[a*countActions + b] = layer;
-    actionMutexes[b*countActions + a] = layer;
-}
-
 int PlanningProblem::getPropMutexCount(int layer) {
-    return layerPropMutexCount[layer];
+    return layerPropMutexCount[storedPropLayer(layer)];
 }
 
 std::string PlanningProblem::getPropositionName(Proposition p) {
@@ -181,22 +297,63 @@ std::string PlanningProblem::getActionName(Action a) {
     return actionNames[a];
 }
 
-int PlanningProblem::isTrivialAction(Action a) {
-    return (a < totalPropositionCount);
-}
 
-int PlanningProblem::getPropLayerAfterActionLayer(int actionLayer) {
-    return actionLayer + 1;
+// Memory of a list without allocator overhead: each node holds the element
+// and two pointers
+template<typename T>
+static long long listMemory(const std::list<T>& list) {
+    return list.size() * (sizeof(T) + 2 * sizeof(void*));
 }
 
-int PlanningProblem::getActionLayerBeforePropLayer(int propLayer) {
-    return propLayer - 1;
+std::vector<std::pair<std::string, long long>> PlanningProblem::getMemoryParts() {
+    std::vector<std::pair<std::string, long long>> parts;
+    long long propositions = totalPropositionCount;
+    long long actions = countActions;
+
+    parts.push_back(std::make_pair("proposition mutexes", propositions * propositions * (long long) sizeof(std::atomic<int>)));
+    parts.push_back(std::make_pair("action mutexes", actions * actions * (long long) sizeof(std::atomic<int>)));
+
+    long long layers = (propositions + actions) * sizeof(std::atomic<int>)
+        + layerProps.capacity() * sizeof(Proposition) + layerActions.capacity() * sizeof(Action)
+        + (lastPropIndices.size() + lastActionIndices.size() + layerPropMutexCount.size()) * sizeof(int);
+    parts.push_back(std::make_pair("layers", layers));
+
+    long long structure = 0;
+    for (Action a = 0; a < countActions; a++) {
+        structure += listMemory(actionPrecs[a]) + listMemory(actionPosEffs[a]) + listMemory(actionNegEffs[a])
+            + actionCondEffs[a].capacity() * sizeof(ConditionalEffect);
+    }
+    for (int p = 0; p < totalPropositionCount; p++) {
+        structure += listMemory(propPosActions[p]) + listMemory(propCondActions[p]);
+    }
+    structure += (actionGoalDistance.size() + propGoalDistance.size()) * sizeof(int);
+    parts.push_back(std::make_pair("actions", structure));
+
+    long long names = 0;
+    for (const std::string& name : actionNames) {
+        names += sizeof(std::string) + name.capacity();
+    }
+    for (auto& entry : propNames) {
+        names += sizeof(entry) + 4 * sizeof(void*) + entry.second.capacity();
+    }
+    parts.push_back(std::make_pair("names", names));
+
+    return parts;
 }
 
-int PlanningProblem::getPropLayerBeforeActionLayer(int actionLayer) {
-    return actionLayer;
+long long PlanningProblem::getMemoryUsage() {
+    long long total = 0;
+    for (auto& part : getMemoryParts()) {
+        total += part.second;
+    }
+    return total;
 }
 
+void PlanningProblem::printMemoryUsage() {
+    for (auto& part : getMemoryParts()) {
+        log(1, "Memory of %s: %s\n", part.first.c_str(), formatMemory(part.second).c_str());
+    }
+}
 
 void PlanningProblem::dumpPlanningGraph() {
     // Output format:
@@ -220,6 +377,7 @@ void PlanningProblem::dumpPlanningGraph() {
     //          PROPNODE 1
     //          ACTIONNODE 4
     
+    flushLog();
     std::cout << "PLANNING GRAPH" << std::endl;
 
     int labelcounter = 0;
@@ -254,7 +412,7 @@ void PlanningProblem::dumpPlanningGraph() {
 
 
     for (int i = getFirstLayer(); i <= getLastLayer(); i++) {
-        std::list<Proposition> props = getLayerPropositions(i);
+        LayerView<Proposition> props = getLayerPropositions(i);
         std::cout << "PROPLAYER " << i << " " << props.size() << std::endl;
         for (Proposition p : props) {
             int propNumber = variableMutexIndex[p.first]+p.second;
@@ -263,7 +421,7 @@ void PlanningProblem::dumpPlanningGraph() {
         
         
         if (i <= getLastActionLayer()) {
-            std::list<Action> actions = getLayerActions(i);
+            LayerView<Action> actions = getLayerActions(i);
             std::cout << "ACTIONLAYER " << i << " " << actions.size() << std::endl;
             for (Action a : actions) {
                 std::cout << "ACTIONNODE " << a << std::endl;
@@ -289,6 +447,7 @@ PlanningProblem::Builder::Builder() {
     problem->layerPropMutexCount.push_back(0);
     problem->lastPropIndices.push_back(-1);
     problem->lastActionIndices.push_back(-1);
+    problem->committedActionLayer = 0;
 }
 
 /**
@@ -304,6 +463,16 @@ PlanningProblem* PlanningProblem::Builder::build() {
         problem->actionNegEffs[a].sort();
     }
 
+    finalizeAxioms();
+
+    problem->computeGoalDistances();
+    int relevantActions = 0;
+    for (Action a = problem->totalPropositionCount; a < problem->countActions; a++) {
+        if (problem->actionGoalDistance[a] != INT_MAX) relevantActions++;
+    }
+    log(1, "Relevance analysis: %d of %d actions relevant\n",
+        relevantActions, problem->countActions - problem->totalPropositionCount);
+
     // Experimental output of structure so far
     log(4, "Dumping problem data\n");
     log(4, "Variables and propositions:\n");
@@ -328,6 +497,17 @@ PlanningProblem* PlanningProblem::Builder::build() {
         for (Proposition neg : problem->getActionNegEffects(a)) {
             log(4, "\t- Eff: %s\n", problem->getPropositionName(neg).c_str());
         }
+        for (ConditionalEffect& effect : problem->actionCondEffs[a]) {
+            for (Proposition c : effect.conditions) {
+                log(4, "\tIf: %s\n", problem->getPropositionName(c).c_str());
+            }
+            for (Proposition pos : effect.posEffects) {
+                log(4, "\t\t+ Eff: %s\n", problem->getPropositionName(pos).c_str());
+            }
+            for (Proposition neg : effect.negEffects) {
+                log(4, "\t\t- Eff: %s\n", problem->getPropositionName(neg).c_str());
+            }
+        }
     }
 
     log(4, "Layers:\n");
@@ -339,7 +519,10 @@ PlanningProblem* PlanningProblem::Builder::build() {
     }
     // End experimental output
 
-    return problem;
+    // The problem belongs to the caller now
+    PlanningProblem *result = problem;
+    problem = nullptr;
+    return result;
 }
 
 /**
@@ -353,6 +536,8 @@ void PlanningProblem::Builder::setVariableCount(int count) {
 
     problem->countVariables = count;
     problem->variableDomainSize.resize(count);
+    problem->variableAxiomLayer.assign(count, -1);
+    problem->derivedDefaultValue.assign(count, -1);
 }
 
 Variable PlanningProblem::Builder::addVariable() {
@@ -387,6 +572,13 @@ void PlanningProblem::Builder::setGlobalPropMutex(Proposition p, Proposition q)
 void PlanningProblem::Builder::addIntialProposition(Proposition p) {
     assert(variablesFinalized);
 
+    // Derived variables get their initial values when the axioms are known
+    if (problem->isDerivedProposition(p)) {
+        problem->derivedDefaultValue[p.first] = p.second;
+        derivedInitialValues.push_back(p);
+        return;
+    }
+
     problem->activateProposition(p, problem->getFirstLayer());
 }
 
@@ -408,11 +600,23 @@ void PlanningProblem::Builder::setActionCount(int count) {
     problem->actionPrecs.resize(count);
     problem->actionPosEffs.resize(count);
     problem->actionNegEffs.resize(count);
+    problem->actionCondEffs.resize(count);
 
-    problem->actionFirstLayer.resize(count);
+    problem->actionFirstLayer = new std::atomic<int>[count];
+    for (int i = 0; i < count; i++) {
+        problem->actionFirstLayer[i] = 0;
+    }
     problem->layerActions.resize(count);
     problem->actionNames.resize(count);
-    problem->actionMutexes = new int[count*count];
+    // Both mutex matrices have to fit into the memory budget
+    long long matrixBytes = ((long long) totalPropositionCount * totalPropositionCount
+            + (long long) count * count) * sizeof(std::atomic<int>);
+    checkMemoryBudget(matrixBytes, "mutex matrices");
+    size_t matrixSize = (size_t) count * count;
+    problem->actionMutexes = new std::atomic<int>[matrixSize];
+    for (size_t i = 0; i < matrixSize; i++) {
+        problem->actionMutexes[i] = 0;
+    }
 
     // Create trivial actions
     for (int var = 0; var < problem->getVariableCount(); var++) {
@@ -441,7 +645,7 @@ void PlanningProblem::Builder::addActionPrecondition(Action a, Proposition p) {
 void PlanningProblem::Builder::addActionPosEffect(Action a, Proposition p) {
     assert(a == nextAction-1);
     problem->actionPosEffs[a].push_back(p);
-    problem->propPosActions[p].push_back(a);
+    problem->propPosActions[problem->getPropositionNumber(p)].push_back(a);
 }
 
 void PlanningProblem::Builder::addActionNegEffect(Action a, Proposition p) {
@@ -449,11 +653,88 @@ void PlanningProblem::Builder::addActionNegEffect(Action a, Proposition p) {
     problem->actionNegEffs[a].push_back(p);
 }
 
+void PlanningProblem::Builder::addActionConditionalEffect(Action a, const std::list<Proposition>& conditions,
+        const std::list<Proposition>& posEffects, const std::list<Proposition>& negEffects) {
+    assert(a == nextAction-1);
+
+    ConditionalEffect effect;
+    effect.conditions = conditions;
+    effect.posEffects = posEffects;
+    effect.negEffects = negEffects;
+    effect.conditions.sort();
+    effect.posEffects.sort();
+    effect.negEffects.sort();
+
+    int index = problem->actionCondEffs[a].size();
+    for (Proposition p : effect.posEffects) {
+        problem->propCondActions[problem->getPropositionNumber(p)].push_back(std::make_pair(a, index));
+    }
+    problem->actionCondEffs[a].push_back(effect);
+    problem->countConditionalEffects++;
+}
+
+void PlanningProblem::Builder::setVariableAxiomLayer(Variable v, int layer) {
+    if (layer == -1 || problem->variableAxiomLayer[v] != -1) return;
+    problem->variableAxiomLayer[v] = layer;
+    problem->derivedVariables.push_back(v);
+}
+
+void PlanningProblem::Builder::addAxiom(const std::list<Proposition>& body, Proposition head) {
+    Axiom axiom;
+    axiom.body = body;
+    axiom.body.sort();
+    axiom.head = head;
+    problem->axioms.push_back(axiom);
+}
+
+/**
+ * Checks the axioms, orders them by layer and adds the derived propositions
+ * of the initial state to the first layer.
+ */
+void PlanningProblem::Builder::finalizeAxioms() {
+    if (!problem->hasAxioms()) return;
+
+    for (Variable v : problem->derivedVariables) {
+        if (problem->variableDomainSize[v] != 2) {
+            throw ProblemError("Derived variable " + std::to_string(v) + " is not binary");
+        }
+    }
+    for (Axiom& axiom : problem->axioms) {
+        if (!problem->isDerivedProposition(axiom.head)
+                || axiom.head.second == problem->derivedDefaultValue[axiom.head.first]) {
+            throw ProblemError("Axiom for " + problem->getPropositionName(axiom.head)
+                + " does not derive a non-default value of a derived variable");
+        }
+    }
+
+    std::vector<int>& layers = problem->variableAxiomLayer;
+    std::stable_sort(problem->axioms.begin(), problem->axioms.end(), [&layers](const Axiom& x, const Axiom& y) {
+        return layers[x.head.first] < layers[y.head.first];
+    });
+
+    // The initial layer so far holds exactly the non-derived part of the
+    // initial state
+    std::vector<VariableValue> state(problem->countVariables, -1);
+    for (Proposition p : problem->getLayerPropositions(problem->getFirstLayer())) {
+        state[p.first] = p.second;
+    }
+    for (Proposition p : derivedInitialValues) {
+        state[p.first] = p.second;
+    }
+    for (Proposition p : problem->evaluateAxioms(state)) {
+        problem->activateProposition(p, problem->getFirstLayer());
+    }
+
+    problem->recursiveAxioms = problem->checkRecursiveAxioms();
+    log(1, "%d axioms for %d derived variables%s\n", (int) problem->axioms.size(),
+        (int) problem->derivedVariables.size(), problem->recursiveAxioms ? " (recursive)" : "");
+}
+
 /**
  * "Finalizes" the creation of any variables.
  *
  *  - Initializes mutex matrix
- *  - Initializes layerProps vector
+ *  - Initializes layerProps vector and other arrays indexed by proposition
  */
 void PlanningProblem::Builder::finalizeVariables() {
     assert(!variablesFinalized);
@@ -469,7 +750,21 @@ void PlanningProblem::Builder::finalizeVariables() {
     problem->totalPropositionCount = totalPropositionCount;
 
     // Allocate matrix for mutexes
-    problem->propMutexes = new int[totalPropositionCount*totalPropositionCount];
+    size_t matrixSize = (size_t) totalPropositionCount * totalPropositionCount;
+    checkMemoryBudget(matrixSize * sizeof(std::atomic<int>), "proposition mutexes");
+    problem->propMutexes = new std::atomic<int>[matrixSize];
+    for (size_t i = 0; i < matrixSize; i++) {
+        problem->propMutexes[i] = 0;
+    }
+
+    // Allocate arrays indexed by proposition number
+    problem->propFirstLayer = new std::atomic<int>[totalPropositionCount];
+    for (int i = 0; i < totalPropositionCount; i++) {
+        problem->propFirstLayer[i] = 0;
+    }
+    problem->layerProps.resize(totalPropositionCount);
+    problem->propPosActions.resize(totalPropositionCount);
+    problem->propCondActions.resize(totalPropositionCount);
 
     problem->addPropositionLayer();
 
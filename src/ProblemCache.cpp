@@ -0,0 +1,482 @@
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ProblemCache.h"
+#include "Logger.h"
+
+
+// Has to be increased whenever the layout of the cache file changes
+#define CACHE_VERSION 2
+#define CACHE_MAGIC "PGPCACHE"
+
+
+// Header at the beginning of every cache file, followed by 32 bit words
+struct CacheHeader {
+    char magic[8];
+    int32_t version;
+    int32_t wordSize;
+    int64_t sourceSize;
+    int64_t sourceModificationTime;
+    int64_t fileSize;
+};
+
+
+/**
+ * Sequential writer of 32 bit words
+ */
+class CacheWriter {
+    public:
+        std::vector<int32_t> words;
+
+        void put(int value) {
+            words.push_back(value);
+        }
+
+        void put(Proposition p) {
+            words.push_back(p.first);
+            words.push_back(p.second);
+        }
+
+        // Strings are stored as their length followed by the characters,
+        // padded to whole words
+        void put(const std::string& s) {
+            words.push_back(s.size());
+            size_t start = words.size();
+            words.resize(start + (s.size() + 3) / 4, 0);
+            memcpy(&words[start], s.data(), s.size());
+        }
+
+        void put(const std::vector<Proposition>& props) {
+            put((int) props.size());
+            for (Proposition p : props) put(p);
+        }
+
+        void put(const std::list<Proposition>& props) {
+            put((int) props.size());
+            for (Proposition p : props) put(p);
+        }
+};
+
+/**
+ * Sequential reader of 32 bit words from a mapped cache file
+ */
+class CacheReader {
+    public:
+        CacheReader(const int32_t *begin, const int32_t *end) : position(begin), end(end) {}
+
+        int getInt() {
+            check(1);
+            return *position++;
+        }
+
+        Proposition getProposition() {
+            check(2);
+            Proposition p(position[0], position[1]);
+            position += 2;
+            return p;
+        }
+
+        // Returns a pointer to the next words and skips them
+        const int32_t* getArray(int words) {
+            check(words);
+            const int32_t *array = position;
+            position += words;
+            return array;
+        }
+
+        std::list<Proposition> getPropositionList() {
+            int count = getInt();
+            check(2 * count);
+            std::list<Proposition> props;
+            for (int i = 0; i < count; i++) {
+                props.push_back(getProposition());
+            }
+            return props;
+        }
+
+        std::string getString() {
+            int length = getInt();
+            check((length + 3) / 4);
+            std::string s((const char*) position, length);
+            position += (length + 3) / 4;
+            return s;
+        }
+
+    private:
+        const int32_t *position;
+        const int32_t *end;
+
+        void check(int words) {
+            if (words < 0 || end - position < words) {
+                exitError("Problem cache is corrupt\n");
+            }
+        }
+};
+
+
+// ----------------------------------------------------------------------------
+
+ProblemCache::ProblemCache(std::string cacheFile, std::string sourceFile) {
+    this->cacheFile = cacheFile;
+    this->sourceFile = sourceFile;
+    recorder = nullptr;
+    readSourceStat();
+}
+
+ProblemCache::~ProblemCache() {
+    delete recorder;
+}
+
+/**
+ * Reads size and modification time of the source file, which identify the
+ * source file a cache was written for.
+ */
+void ProblemCache::readSourceStat() {
+    struct stat fileStat;
+    if (stat(sourceFile.c_str(), &fileStat) == 0) {
+        sourceSize = fileStat.st_size;
+        sourceModificationTime = (long long) fileStat.st_mtim.tv_sec * 1000000000LL + fileStat.st_mtim.tv_nsec;
+    } else {
+        sourceSize = -1;
+        sourceModificationTime = -1;
+    }
+}
+
+/**
+ * Replays the cached problem through the given builder.
+ */
+IPlanningProblem* ProblemCache::load(IPlanningProblem::Builder *builder) {
+    // Without a regular source file, a cache can't be identified
+    if (sourceSize < 0) {
+        return nullptr;
+    }
+
+    int fd = open(cacheFile.c_str(), O_RDONLY);
+    if (fd < 0) {
+        log(1, "No problem cache at %s\n", cacheFile.c_str());
+        return nullptr;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0 || (size_t) fileStat.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        log(1, "Problem cache %s is invalid, ignoring it\n", cacheFile.c_str());
+        return nullptr;
+    }
+    size_t size = fileStat.st_size;
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        log(1, "Problem cache %s could not be mapped, ignoring it\n", cacheFile.c_str());
+        return nullptr;
+    }
+
+    // Only use the cache if it belongs to the source file as it is now
+    const CacheHeader *header = (const CacheHeader*) mapped;
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0
+            || header->version != CACHE_VERSION
+            || header->wordSize != sizeof(int32_t)
+            || header->fileSize != (int64_t) size
+            || header->sourceSize != sourceSize
+            || header->sourceModificationTime != sourceModificationTime) {
+        munmap(mapped, size);
+        log(1, "Problem cache %s is outdated, ignoring it\n", cacheFile.c_str());
+        return nullptr;
+    }
+
+    const int32_t *words = (const int32_t*) ((const char*) mapped + sizeof(CacheHeader));
+    CacheReader in(words, words + (size - sizeof(CacheHeader)) / sizeof(int32_t));
+
+    // Variables
+    int countVariables = in.getInt();
+    builder->setVariableCount(countVariables);
+    for (int i = 0; i < countVariables; i++) {
+        Variable v = builder->addVariable();
+        builder->setVariableDomainSize(v, in.getInt());
+        builder->setVariableAxiomLayer(v, in.getInt());
+    }
+    int countNames = in.getInt();
+    for (int i = 0; i < countNames; i++) {
+        Proposition p = in.getProposition();
+        builder->setPropositionName(p, in.getString());
+    }
+    builder->finalizeVariables();
+
+    // Global mutexes
+    int countMutexes = in.getInt();
+    for (int i = 0; i < countMutexes; i++) {
+        Proposition p = in.getProposition();
+        Proposition q = in.getProposition();
+        builder->setGlobalPropMutex(p, q);
+    }
+
+    // Initial state and goal
+    int countInitial = in.getInt();
+    for (int i = 0; i < countInitial; i++) {
+        builder->addIntialProposition(in.getProposition());
+    }
+    int countGoal = in.getInt();
+    for (int i = 0; i < countGoal; i++) {
+        builder->addGoalProposition(in.getProposition());
+    }
+
+    // Actions: names, then offsets and propositions of preconditions,
+    // positive and negative effects. The CSR arrays are used in place.
+    int countActions = in.getInt();
+    std::vector<std::string> names(countActions);
+    for (int i = 0; i < countActions; i++) {
+        names[i] = in.getString();
+    }
+    const int32_t *csr[3][2];
+    for (int k = 0; k < 3; k++) {
+        csr[k][0] = in.getArray(countActions + 1);
+        csr[k][1] = in.getArray(2 * csr[k][0][countActions]);
+    }
+
+    // Conditional effects, ordered by action
+    int countCondEffs = in.getInt();
+    std::vector<Action> condEffActions(countCondEffs);
+    std::vector<ConditionalEffect> condEffs(countCondEffs);
+    for (int i = 0; i < countCondEffs; i++) {
+        condEffActions[i] = in.getInt();
+        condEffs[i].conditions = in.getPropositionList();
+        condEffs[i].posEffects = in.getPropositionList();
+        condEffs[i].negEffects = in.getPropositionList();
+    }
+
+    builder->setActionCount(countActions);
+    int nextCondEff = 0;
+    for (int i = 0; i < countActions; i++) {
+        Action a = builder->addAction();
+        builder->setActionName(a, names[i]);
+
+        for (int k = 0; k < 3; k++) {
+            const int32_t *offsets = csr[k][0];
+            if (offsets[i] < 0 || offsets[i] > offsets[i+1] || offsets[i+1] > offsets[countActions]) {
+                exitError("Problem cache is corrupt\n");
+            }
+            for (int j = offsets[i]; j < offsets[i+1]; j++) {
+                Proposition p(csr[k][1][2*j], csr[k][1][2*j+1]);
+                if (k == 0) builder->addActionPrecondition(a, p);
+                else if (k == 1) builder->addActionPosEffect(a, p);
+                else builder->addActionNegEffect(a, p);
+            }
+        }
+        while (nextCondEff < countCondEffs && condEffActions[nextCondEff] == a) {
+            const ConditionalEffect& effect = condEffs[nextCondEff++];
+            builder->addActionConditionalEffect(a, effect.conditions, effect.posEffects, effect.negEffects);
+        }
+    }
+    if (nextCondEff != countCondEffs) {
+        exitError("Problem cache is corrupt\n");
+    }
+
+    // Axioms
+    int countAxioms = in.getInt();
+    for (int i = 0; i < countAxioms; i++) {
+        std::list<Proposition> body = in.getPropositionList();
+        builder->addAxiom(body, in.getProposition());
+    }
+
+    munmap(mapped, size);
+
+    log(0, "Loaded problem from cache %s\n", cacheFile.c_str());
+    return builder->build();
+}
+
+IPlanningProblem::Builder* ProblemCache::record(IPlanningProblem::Builder *builder) {
+    delete recorder;
+    recorder = new Recorder(builder);
+    return recorder;
+}
+
+/**
+ * Writes the recorded problem to a temporary file that is renamed to the
+ * cache file afterwards, so concurrent runs never see a partial cache.
+ */
+void ProblemCache::write() {
+    if (recorder == nullptr || sourceSize < 0) return;
+    Recorder& r = *recorder;
+
+    CacheWriter out;
+    out.put((int) r.domainSizes.size());
+    for (size_t i = 0; i < r.domainSizes.size(); i++) {
+        out.put(r.domainSizes[i]);
+        out.put(r.axiomLayers[i]);
+    }
+    out.put((int) r.propositions.size());
+    for (size_t i = 0; i < r.propositions.size(); i++) {
+        out.put(r.propositions[i]);
+        out.put(r.propositionNames[i]);
+    }
+    out.put((int) r.mutexes.size() / 2);
+    for (Proposition p : r.mutexes) out.put(p);
+    out.put(r.initialState);
+    out.put(r.goal);
+
+    // Action names, then one CSR block (offsets including the end, followed
+    // by the propositions) for preconditions, positive and negative effects
+    out.put((int) r.actionNames.size());
+    for (const std::string& name : r.actionNames) out.put(name);
+    for (int k = 0; k < 3; k++) {
+        std::vector<int>& offsets = (k == 0) ? r.precOffsets : (k == 1) ? r.posOffsets : r.negOffsets;
+        std::vector<Proposition>& props = (k == 0) ? r.precs : (k == 1) ? r.posEffs : r.negEffs;
+        for (int offset : offsets) out.put(offset);
+        out.put((int) props.size());
+        for (Proposition p : props) out.put(p);
+    }
+
+    // Conditional effects with their actions, then the axioms
+    out.put((int) r.condEffs.size());
+    for (size_t i = 0; i < r.condEffs.size(); i++) {
+        out.put(r.condEffActions[i]);
+        out.put(r.condEffs[i].conditions);
+        out.put(r.condEffs[i].posEffects);
+        out.put(r.condEffs[i].negEffects);
+    }
+    out.put((int) r.axioms.size());
+    for (const Axiom& axiom : r.axioms) {
+        out.put(axiom.body);
+        out.put(axiom.head);
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.wordSize = sizeof(int32_t);
+    header.sourceSize = sourceSize;
+    header.sourceModificationTime = sourceModificationTime;
+    header.fileSize = sizeof(CacheHeader) + out.words.size() * sizeof(int32_t);
+
+    std::string tempFile = cacheFile + ".tmp" + std::to_string(getpid());
+    FILE *f = fopen(tempFile.c_str(), "wb");
+    if (f == nullptr) {
+        log(0, "WARNING: Problem cache %s could not be written\n", cacheFile.c_str());
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok && fwrite(out.words.data(), sizeof(int32_t), out.words.size(), f) == out.words.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tempFile.c_str(), cacheFile.c_str()) != 0) {
+        unlink(tempFile.c_str());
+        log(0, "WARNING: Problem cache %s could not be written\n", cacheFile.c_str());
+        return;
+    }
+    log(0, "Wrote problem cache %s\n", cacheFile.c_str());
+}
+
+
+// ----------------------------------------------------------------------------
+
+ProblemCache::Recorder::Recorder(IPlanningProblem::Builder *builder) {
+    this->builder = builder;
+}
+
+IPlanningProblem* ProblemCache::Recorder::build() {
+    return builder->build();
+}
+
+void ProblemCache::Recorder::setVariableCount(int count) {
+    builder->setVariableCount(count);
+}
+
+Variable ProblemCache::Recorder::addVariable() {
+    domainSizes.push_back(0);
+    axiomLayers.push_back(-1);
+    return builder->addVariable();
+}
+
+void ProblemCache::Recorder::setVariableDomainSize(Variable v, int size) {
+    domainSizes[v] = size;
+    builder->setVariableDomainSize(v, size);
+}
+
+void ProblemCache::Recorder::setPropositionName(Proposition p, std::string name) {
+    propositions.push_back(p);
+    propositionNames.push_back(name);
+    builder->setPropositionName(p, name);
+}
+
+void ProblemCache::Recorder::finalizeVariables() {
+    builder->finalizeVariables();
+}
+
+void ProblemCache::Recorder::setGlobalPropMutex(Proposition p, Proposition q) {
+    mutexes.push_back(p);
+    mutexes.push_back(q);
+    builder->setGlobalPropMutex(p, q);
+}
+
+void ProblemCache::Recorder::addIntialProposition(Proposition p) {
+    initialState.push_back(p);
+    builder->addIntialProposition(p);
+}
+
+void ProblemCache::Recorder::addGoalProposition(Proposition p) {
+    goal.push_back(p);
+    builder->addGoalProposition(p);
+}
+
+void ProblemCache::Recorder::setActionCount(int count) {
+    actionNames.reserve(count);
+    builder->setActionCount(count);
+}
+
+Action ProblemCache::Recorder::addAction() {
+    // Calls for an action always come in one block, so its propositions
+    // start at the current end of the arrays
+    actionNames.push_back("");
+    precOffsets.push_back(precs.size());
+    posOffsets.push_back(posEffs.size());
+    negOffsets.push_back(negEffs.size());
+    return builder->addAction();
+}
+
+void ProblemCache::Recorder::setActionName(Action a, std::string name) {
+    actionNames.back() = name;
+    builder->setActionName(a, name);
+}
+
+void ProblemCache::Recorder::addActionPrecondition(Action a, Proposition p) {
+    precs.push_back(p);
+    builder->addActionPrecondition(a, p);
+}
+
+void ProblemCache::Recorder::addActionPosEffect(Action a, Proposition p) {
+    posEffs.push_back(p);
+    builder->addActionPosEffect(a, p);
+}
+
+void ProblemCache::Recorder::addActionNegEffect(Action a, Proposition p) {
+    negEffs.push_back(p);
+    builder->addActionNegEffect(a, p);
+}
+
+void ProblemCache::Recorder::addActionConditionalEffect(Action a, const std::list<Proposition>& conditions,
+        const std::list<Proposition>& posEffects, const std::list<Proposition>& negEffects) {
+    ConditionalEffect effect;
+    effect.conditions = conditions;
+    effect.posEffects = posEffects;
+    effect.negEffects = negEffects;
+    condEffActions.push_back(a);
+    condEffs.push_back(effect);
+    builder->addActionConditionalEffect(a, conditions, posEffects, negEffects);
+}
+
+void ProblemCache::Recorder::setVariableAxiomLayer(Variable v, int layer) {
+    axiomLayers[v] = layer;
+    builder->setVariableAxiomLayer(v, layer);
+}
+
+void ProblemCache::Recorder::addAxiom(const std::list<Proposition>& body, Proposition head) {
+    Axiom axiom;
+    axiom.body = body;
+    axiom.head = head;
+    axioms.push_back(axiom);
+    builder->addAxiom(body, head);
+}
@@ -0,0 +1,501 @@
+#include <set>
+#include <algorithm>
+
+#include "ProblemSimplifier.h"
+#include "Logger.h"
+
+
+// The h^2 analysis keeps a matrix over all pairs of propositions, so it is
+// left out for problems with more propositions than this
+#define H2_MAX_PROPOSITIONS 8192
+
+
+ProblemSimplifier::ProblemSimplifier(IPlanningProblem::Builder *builder) {
+    this->builder = builder;
+}
+
+/**
+ * Reduces the collected problem and builds it with the actual builder.
+ */
+IPlanningProblem* ProblemSimplifier::build() {
+    keepAll();
+
+    std::vector<char> reachable;
+    if (!computeReachability(reachable)) {
+        unsolvable = true;
+    }
+
+    if (unsolvable || !condEffs.empty() || !axioms.empty()) {
+        log(1, "Simplification skipped (%s)\n", unsolvable ? "goal unreachable" : "conditional effects or axioms");
+        keepAll();
+        replay();
+        return builder->build();
+    }
+
+    removeStaticVariables(reachable);
+    int duplicates = removeUselessActions();
+    if (!computeH2Mutexes(reachable)) {
+        log(1, "Goal is not reachable under h^2\n");
+        unsolvable = true;
+    }
+
+    int keptVariables = 0;
+    int keptPropositions = 0;
+    int keptActions = 0;
+    for (Variable v = 0; v < (int) variableMap.size(); v++) {
+        if (variableMap[v] < 0) continue;
+        keptVariables++;
+        for (VariableValue value : valueMap[v]) {
+            if (value >= 0) keptPropositions++;
+        }
+    }
+    for (char keep : keepAction) {
+        if (keep) keptActions++;
+    }
+    log(1, "Simplification: %d of %d variables, %d of %d propositions, %d of %d actions left "
+            "(%d duplicates), %d h^2 mutexes\n",
+            keptVariables, (int) variableMap.size(), keptPropositions, propositionCount,
+            keptActions, (int) keepAction.size(), duplicates, (int) h2Mutexes.size());
+
+    replay();
+    return builder->build();
+}
+
+void ProblemSimplifier::keepAll() {
+    variableMap.resize(propositionNames.size());
+    valueMap.resize(propositionNames.size());
+    for (Variable v = 0; v < (int) propositionNames.size(); v++) {
+        variableMap[v] = v;
+        valueMap[v].resize(propositionNames[v].size());
+        for (VariableValue value = 0; value < (int) valueMap[v].size(); value++) {
+            valueMap[v][value] = value;
+        }
+    }
+    keepAction.assign(actionNames.size(), true);
+    h2Mutexes.clear();
+}
+
+/**
+ * Relaxed reachability: propositions and actions are reachable once all
+ * preconditions of an action are reachable, ignoring delete effects.
+ * Unreachable actions are removed.
+ */
+bool ProblemSimplifier::computeReachability(std::vector<char>& reachable) {
+    reachable.assign(propositionCount, false);
+    for (Proposition p : initialState) {
+        reachable[getPropositionNumber(p)] = true;
+    }
+    for (Variable v = 0; v < (int) axiomLayers.size(); v++) {
+        if (axiomLayers[v] < 0) continue;
+        for (VariableValue value = 0; value < (int) propositionNames[v].size(); value++) {
+            reachable[getPropositionNumber(Proposition(v, value))] = true;
+        }
+    }
+
+    std::vector<char> actionReachable(actionNames.size(), false);
+    std::vector<char> condEffReachable(condEffs.size(), false);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (Action a = 0; a < (int) actionNames.size(); a++) {
+            if (actionReachable[a]) continue;
+
+            bool applicable = true;
+            for (Proposition p : actionPrecs[a]) {
+                if (!reachable[getPropositionNumber(p)]) {
+                    applicable = false;
+                    break;
+                }
+            }
+            if (!applicable) continue;
+
+            actionReachable[a] = true;
+            changed = true;
+            for (Proposition p : actionPosEffs[a]) {
+                reachable[getPropositionNumber(p)] = true;
+            }
+        }
+
+        for (unsigned int i = 0; i < condEffs.size(); i++) {
+            ConditionalEffect& effect = condEffs[i].second;
+            if (condEffReachable[i] || !actionReachable[condEffs[i].first]) continue;
+
+            bool triggered = true;
+            for (Proposition p : effect.conditions) {
+                if (!reachable[getPropositionNumber(p)]) {
+                    triggered = false;
+                    break;
+                }
+            }
+            if (!triggered) continue;
+
+            condEffReachable[i] = true;
+            changed = true;
+            for (Proposition p : effect.posEffects) {
+                reachable[getPropositionNumber(p)] = true;
+            }
+        }
+    }
+    keepAction = actionReachable;
+
+    for (Proposition p : goal) {
+        if (!reachable[getPropositionNumber(p)]) return false;
+    }
+    return true;
+}
+
+/**
+ * Renumbers the reachable values of every variable and removes variables
+ * that can't change their initial value. Variables in the goal are always
+ * kept, so the goal never becomes empty.
+ */
+void ProblemSimplifier::removeStaticVariables(const std::vector<char>& reachable) {
+    std::vector<char> inGoal(propositionNames.size(), false);
+    for (Proposition p : goal) {
+        inGoal[p.first] = true;
+    }
+
+    Variable nextVariable = 0;
+    for (Variable v = 0; v < (int) propositionNames.size(); v++) {
+        int reachableValues = 0;
+        for (VariableValue value = 0; value < (int) valueMap[v].size(); value++) {
+            if (reachable[getPropositionNumber(Proposition(v, value))]) {
+                valueMap[v][value] = reachableValues++;
+            } else {
+                valueMap[v][value] = -1;
+            }
+        }
+
+        // The only reachable value has to be the initial one
+        if (reachableValues == 1 && !inGoal[v]) {
+            variableMap[v] = -1;
+        } else {
+            variableMap[v] = nextVariable++;
+        }
+    }
+}
+
+/**
+ * Drops all conditions and effects on removed propositions from the kept
+ * actions, then removes actions that don't change anything and actions that
+ * are equal to an earlier one. Returns the amount of duplicates.
+ */
+int ProblemSimplifier::removeUselessActions() {
+    auto filter = [this](std::vector<Proposition>& props) {
+        props.erase(std::remove_if(props.begin(), props.end(),
+                [this](Proposition p) { return !isKept(p); }), props.end());
+        std::sort(props.begin(), props.end());
+    };
+
+    std::set<std::vector<int>> signatures;
+    int duplicates = 0;
+    for (Action a = 0; a < (int) actionNames.size(); a++) {
+        if (!keepAction[a]) continue;
+
+        filter(actionPrecs[a]);
+        filter(actionPosEffs[a]);
+        filter(actionNegEffs[a]);
+
+        // Positive effects that already hold (e.g. prevail conditions) don't change anything
+        bool changesState = !actionNegEffs[a].empty();
+        for (Proposition p : actionPosEffs[a]) {
+            if (!std::binary_search(actionPrecs[a].begin(), actionPrecs[a].end(), p)) {
+                changesState = true;
+            }
+        }
+        if (!changesState) {
+            keepAction[a] = false;
+            continue;
+        }
+
+        std::vector<int> signature;
+        for (auto props : {&actionPrecs[a], &actionPosEffs[a], &actionNegEffs[a]}) {
+            for (Proposition p : *props) {
+                signature.push_back(getPropositionNumber(p));
+            }
+            signature.push_back(-1);
+        }
+        if (!signatures.insert(signature).second) {
+            keepAction[a] = false;
+            duplicates++;
+        }
+    }
+    return duplicates;
+}
+
+/**
+ * Computes the pairs of propositions that are reachable together under h^2
+ * (Haslum and Geffner): a pair is reachable if it holds initially, or if an
+ * action with pairwise reachable preconditions adds both propositions, or adds
+ * one of them and leaves the other one untouched while it is reachable
+ * together with all preconditions. All other pairs are mutex in every
+ * reachable state. Actions with mutex preconditions are removed.
+ */
+bool ProblemSimplifier::computeH2Mutexes(const std::vector<char>& reachable) {
+    int n = propositionCount;
+    if (n > H2_MAX_PROPOSITIONS) {
+        log(1, "Too many propositions for h^2 mutexes\n");
+        return true;
+    }
+
+    std::vector<int> keptProps;
+    std::vector<Variable> propVariable(n);
+    for (Variable v = 0; v < (int) propositionNames.size(); v++) {
+        for (VariableValue value = 0; value < (int) valueMap[v].size(); value++) {
+            int number = getPropositionNumber(Proposition(v, value));
+            propVariable[number] = v;
+            if (variableMap[v] >= 0 && reachable[number]) keptProps.push_back(number);
+        }
+    }
+
+    std::vector<char> pairs(n * n, false);
+    bool changed = false;
+    auto mark = [&pairs, &changed, n](int p, int q) {
+        if (!pairs[p*n + q]) {
+            pairs[p*n + q] = pairs[q*n + p] = true;
+            changed = true;
+        }
+    };
+    auto applicable = [&pairs, n](const std::vector<int>& precs) {
+        for (int p : precs) {
+            for (int q : precs) {
+                if (!pairs[p*n + q]) return false;
+            }
+        }
+        return true;
+    };
+
+    std::vector<int> initial;
+    for (Proposition p : initialState) {
+        if (isKept(p)) initial.push_back(getPropositionNumber(p));
+    }
+    for (int p : initial) {
+        for (int q : initial) mark(p, q);
+    }
+
+    // Proposition numbers of the kept actions' preconditions and positive
+    // effects, and the variables they touch
+    std::vector<std::vector<int>> precs(actionNames.size());
+    std::vector<std::vector<int>> adds(actionNames.size());
+    std::vector<std::set<Variable>> touched(actionNames.size());
+    for (Action a = 0; a < (int) actionNames.size(); a++) {
+        if (!keepAction[a]) continue;
+        for (Proposition p : actionPrecs[a]) precs[a].push_back(getPropositionNumber(p));
+        for (Proposition p : actionPosEffs[a]) {
+            adds[a].push_back(getPropositionNumber(p));
+            touched[a].insert(p.first);
+        }
+        for (Proposition p : actionNegEffs[a]) touched[a].insert(p.first);
+    }
+
+    changed = true;
+    while (changed) {
+        changed = false;
+        for (Action a = 0; a < (int) actionNames.size(); a++) {
+            if (!keepAction[a] || !applicable(precs[a])) continue;
+
+            for (int p : adds[a]) {
+                for (int q : adds[a]) mark(p, q);
+            }
+
+            // Propositions that persist through the action
+            for (int q : keptProps) {
+                if (!pairs[q*n + q] || touched[a].count(propVariable[q])) continue;
+                bool persists = true;
+                for (int r : precs[a]) {
+                    if (!pairs[q*n + r]) {
+                        persists = false;
+                        break;
+                    }
+                }
+                if (!persists) continue;
+                for (int p : adds[a]) mark(p, q);
+            }
+        }
+    }
+
+    for (Action a = 0; a < (int) actionNames.size(); a++) {
+        if (keepAction[a] && !applicable(precs[a])) keepAction[a] = false;
+    }
+
+    for (unsigned int i = 0; i < keptProps.size(); i++) {
+        for (unsigned int j = 0; j < i; j++) {
+            int p = keptProps[i];
+            int q = keptProps[j];
+            if (propVariable[p] != propVariable[q] && !pairs[p*n + q]) {
+                h2Mutexes.push_back(std::make_pair(p, q));
+            }
+        }
+    }
+
+    std::vector<int> goalProps;
+    for (Proposition p : goal) goalProps.push_back(getPropositionNumber(p));
+    return applicable(goalProps);
+}
+
+void ProblemSimplifier::replay() {
+    int keptVariables = 0;
+    for (Variable v : variableMap) {
+        if (v >= 0) keptVariables++;
+    }
+
+    // Variables and their reachable values
+    std::vector<Proposition> propositions(propositionCount);
+    builder->setVariableCount(keptVariables);
+    for (Variable v = 0; v < (int) propositionNames.size(); v++) {
+        if (variableMap[v] < 0) continue;
+        Variable newVariable = builder->addVariable();
+        builder->setVariableAxiomLayer(newVariable, axiomLayers[v]);
+
+        int domainSize = 0;
+        for (VariableValue value : valueMap[v]) {
+            if (value >= 0) domainSize++;
+        }
+        builder->setVariableDomainSize(newVariable, domainSize);
+        for (VariableValue value = 0; value < (int) valueMap[v].size(); value++) {
+            Proposition p(v, value);
+            propositions[getPropositionNumber(p)] = p;
+            if (isKept(p)) {
+                builder->setPropositionName(map(p), propositionNames[v][value]);
+            }
+        }
+    }
+    builder->finalizeVariables();
+
+    for (auto& mutex : mutexes) {
+        if (isKept(mutex.first) && isKept(mutex.second)) {
+            builder->setGlobalPropMutex(map(mutex.first), map(mutex.second));
+        }
+    }
+    for (auto& mutex : h2Mutexes) {
+        builder->setGlobalPropMutex(map(propositions[mutex.first]), map(propositions[mutex.second]));
+    }
+
+    for (Proposition p : initialState) {
+        if (isKept(p)) builder->addIntialProposition(map(p));
+    }
+    for (Proposition p : goal) {
+        builder->addGoalProposition(map(p));
+    }
+
+    // Actions (conditional effects are ordered by action)
+    int keptActions = 0;
+    for (char keep : keepAction) {
+        if (keep) keptActions++;
+    }
+    builder->setActionCount(keptActions);
+    auto condEff = condEffs.begin();
+    for (Action a = 0; a < (int) actionNames.size(); a++) {
+        if (!keepAction[a]) continue;
+        Action newAction = builder->addAction();
+        builder->setActionName(newAction, actionNames[a]);
+        for (Proposition p : actionPrecs[a]) {
+            if (isKept(p)) builder->addActionPrecondition(newAction, map(p));
+        }
+        for (Proposition p : actionPosEffs[a]) {
+            if (isKept(p)) builder->addActionPosEffect(newAction, map(p));
+        }
+        for (Proposition p : actionNegEffs[a]) {
+            if (isKept(p)) builder->addActionNegEffect(newAction, map(p));
+        }
+        for (; condEff != condEffs.end() && condEff->first == a; condEff++) {
+            builder->addActionConditionalEffect(newAction, condEff->second.conditions,
+                    condEff->second.posEffects, condEff->second.negEffects);
+        }
+    }
+
+    for (Axiom& axiom : axioms) {
+        builder->addAxiom(axiom.body, axiom.head);
+    }
+}
+
+
+void ProblemSimplifier::setVariableCount(int count) {
+    axiomLayers.reserve(count);
+    propositionNames.reserve(count);
+}
+
+Variable ProblemSimplifier::addVariable() {
+    axiomLayers.push_back(-1);
+    propositionNames.emplace_back();
+    return propositionNames.size() - 1;
+}
+
+void ProblemSimplifier::setVariableDomainSize(Variable v, int size) {
+    propositionNames[v].resize(size);
+}
+
+void ProblemSimplifier::setPropositionName(Proposition p, std::string name) {
+    propositionNames[p.first][p.second] = name;
+}
+
+void ProblemSimplifier::finalizeVariables() {
+    propositionCount = 0;
+    for (auto& names : propositionNames) {
+        propositionOffsets.push_back(propositionCount);
+        propositionCount += names.size();
+    }
+}
+
+void ProblemSimplifier::setGlobalPropMutex(Proposition p, Proposition q) {
+    mutexes.push_back(std::make_pair(p, q));
+}
+
+void ProblemSimplifier::addIntialProposition(Proposition p) {
+    initialState.push_back(p);
+}
+
+void ProblemSimplifier::addGoalProposition(Proposition p) {
+    goal.push_back(p);
+}
+
+void ProblemSimplifier::setActionCount(int count) {
+    actionNames.reserve(count);
+    actionPrecs.reserve(count);
+    actionPosEffs.reserve(count);
+    actionNegEffs.reserve(count);
+}
+
+Action ProblemSimplifier::addAction() {
+    actionNames.emplace_back();
+    actionPrecs.emplace_back();
+    actionPosEffs.emplace_back();
+    actionNegEffs.emplace_back();
+    return actionNames.size() - 1;
+}
+
+void ProblemSimplifier::setActionName(Action a, std::string name) {
+    actionNames[a] = name;
+}
+
+void ProblemSimplifier::addActionPrecondition(Action a, Proposition p) {
+    actionPrecs[a].push_back(p);
+}
+
+void ProblemSimplifier::addActionPosEffect(Action a, Proposition p) {
+    actionPosEffs[a].push_back(p);
+}
+
+void ProblemSimplifier::addActionNegEffect(Action a, Proposition p) {
+    actionNegEffs[a].push_back(p);
+}
+
+void ProblemSimplifier::addActionConditionalEffect(Action a, const std::list<Proposition>& conditions,
+        const std::list<Proposition>& posEffects, const std::list<Proposition>& negEffects) {
+    ConditionalEffect effect;
+    effect.conditions = conditions;
+    effect.posEffects = posEffects;
+    effect.negEffects = negEffects;
+    condEffs.push_back(std::make_pair(a, effect));
+}
+
+void ProblemSimplifier::setVariableAxiomLayer(Variable v, int layer) {
+    axiomLayers[v] = layer;
+}
+
+void ProblemSimplifier::addAxiom(const std::list<Proposition>& body, Proposition head) {
+    Axiom axiom;
+    axiom.body = body;
+    axiom.head = head;
+    axioms.push_back(axiom);
+}
@@ -1,5 +1,8 @@
 #include "SATSolverThreadPool.h"
 #include "Logger.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Memory.h"
 
 #include "ipasir_cpp.h"
 
@@ -15,14 +18,21 @@ SATSolverThreadPool::SATSolverThreadPool(int tagCount) {
     queueMutexes = (std::mutex**) malloc(tagCount * sizeof(std::mutex*));
     queueConditions = (std::condition_variable**)
         malloc(tagCount * sizeof(std::condition_variable*));
+    idleConditions = (std::condition_variable**)
+        malloc(tagCount * sizeof(std::condition_variable*));
 
     for (int i = 0; i < tagCount; i++) {
         queueMutexes[i] = new std::mutex();
         queueConditions[i] = new std::condition_variable();
+        idleConditions[i] = new std::condition_variable();
     }
 
     // Resize worker and job vectors
     workers.resize(tagCount);
+    workerArgs.resize(tagCount);
+    workerLimits.resize(tagCount, 0);
+    busyWorkers.resize(tagCount, 0);
+    releasedWorkers.resize(tagCount, 0);
     jobs.resize(tagCount);
 }
 
@@ -41,6 +51,7 @@ SATSolverThreadPool::~SATSolverThreadPool() {
     // Notify workers from all queues
     for (int i = 0; i < tagCount; i++) {
         queueConditions[i]->notify_all();
+        idleConditions[i]->notify_all();
     }
     // Unlock all the mutexes
     for (int i = 0; i < tagCount; i++) {
@@ -53,13 +64,20 @@ SATSolverThreadPool::~SATSolverThreadPool() {
             thr.join();
         }
     }
+    for (auto& args : workerArgs) {
+        for (WorkerThreadArguments *wargs : args) {
+            delete wargs;
+        }
+    }
 
     for (int i = 0; i < tagCount; i++) {
         delete queueMutexes[i];
         delete queueConditions[i];
+        delete idleConditions[i];
     }
     free(queueMutexes);
     free(queueConditions);
+    free(idleConditions);
 }
 
 /**
@@ -75,6 +93,11 @@ void SATSolverThreadPool::addWorkers(int tag, int amount,
         workerArgs->pool = this;
         workerArgs->tag = tag;
         workerArgs->solver = solverInit(initArgs);  // Initialize the solver
+        {
+            std::unique_lock<std::mutex> lck(*(queueMutexes[tag]));
+            workerArgs->index = workerLimits[tag]++;
+            this->workerArgs[tag].push_back(workerArgs);
+        }
 
         // Spawn and add the worker
         workers[tag].push_back(std::thread(workerThread, workerArgs));
@@ -89,6 +112,10 @@ void SATSolverThreadPool::enqueueJob(int tag, Job job) {
     std::unique_lock<std::mutex> lck(*(queueMutexes[tag]));
     
     if (!stopped) {
+        #ifndef PGP_NOMETRICS
+        job.enqueueTime = getTime();
+        #endif
+        traceInstant("enqueue", -1);
         jobs[tag].push(job);
         queueConditions[tag]->notify_one();
     }
@@ -111,11 +138,58 @@ bool SATSolverThreadPool::isDone() {
     return true;
 }
 
+/**
+ * Sets the amount of workers of the given tag that take jobs.
+ */
+void SATSolverThreadPool::setWorkerLimit(int tag, int limit) {
+    std::unique_lock<std::mutex> lck(*(queueMutexes[tag]));
+    workerLimits[tag] = limit;
+    // Workers beyond the limit have to wake up to stop
+    queueConditions[tag]->notify_all();
+}
+
+int SATSolverThreadPool::getWorkerLimit(int tag) {
+    std::unique_lock<std::mutex> lck(*(queueMutexes[tag]));
+    return workerLimits[tag];
+}
+
+int SATSolverThreadPool::getRunningWorkerCount(int tag) {
+    std::unique_lock<std::mutex> lck(*(queueMutexes[tag]));
+    return workerArgs[tag].size() - releasedWorkers[tag];
+}
 
 /**
- * Gets the next job out of the tag's queue
+ * Waits until the queue of the given tag is empty and no worker of the tag is
+ * running a job.
  */
-SATSolverThreadPool::Job* SATSolverThreadPool::getNextJob(int tag) {
+void SATSolverThreadPool::waitIdle(int tag) {
+    std::unique_lock<std::mutex> lck(*(queueMutexes[tag]));
+    while ((!jobs[tag].empty() || busyWorkers[tag] > 0) && !stopped) {
+        idleConditions[tag]->wait(lck);
+    }
+}
+
+/**
+ * Replaces the SAT solvers of the given tag's workers with new ones from the
+ * given function. Must only be called while the tag is idle.
+ */
+void SATSolverThreadPool::resetSolvers(int tag, void*(*solverInit)(void*), void *initArgs) {
+    std::unique_lock<std::mutex> lck(*(queueMutexes[tag]));
+    for (WorkerThreadArguments *wargs : workerArgs[tag]) {
+        // Retired workers release their solvers themselves
+        if (wargs->index >= workerLimits[tag]) continue;
+        releaseSolverMemory(wargs->solver);
+        ipasir_release(wargs->solver);
+        wargs->solver = solverInit(initArgs);
+    }
+}
+
+
+/**
+ * Gets the next job out of the tag's queue for the worker with the given
+ * index. Returns 0 if the pool was stopped or the worker is beyond the limit.
+ */
+SATSolverThreadPool::Job* SATSolverThreadPool::getNextJob(int tag, int index) {
     // Acquire queue mutex
     std::unique_lock<std::mutex> lck(*(queueMutexes[tag]));
 
@@ -124,17 +198,19 @@ SATSolverThreadPool::Job* SATSolverThreadPool::getNextJob(int tag) {
 
     if (!stopped) {
         // Wait for wakeup if there is no job currently
-        while (jobs[tag].empty() && !stopped) {
+        while (jobs[tag].empty() && !stopped && index < workerLimits[tag]) {
             queueConditions[tag]->wait(lck);
         }
 
-        // Check if pool stopped in the meantime
-        if (!stopped) {
+        // Check if pool stopped or the worker was retired in the meantime
+        if (!stopped && index < workerLimits[tag]) {
             // Get the next job from the queue
             job = new SATSolverThreadPool::Job();
             job->func = jobs[tag].front().func;
             job->arguments = jobs[tag].front().arguments;
+            job->enqueueTime = jobs[tag].front().enqueueTime;
             jobs[tag].pop();
+            busyWorkers[tag]++;
         }
     }
 
@@ -142,6 +218,17 @@ SATSolverThreadPool::Job* SATSolverThreadPool::getNextJob(int tag) {
     return job;
 }
 
+/**
+ * Marks the job of a worker as done, waking waitIdle if it was the last one.
+ */
+void SATSolverThreadPool::finishJob(int tag) {
+    std::unique_lock<std::mutex> lck(*(queueMutexes[tag]));
+    busyWorkers[tag]--;
+    if (busyWorkers[tag] == 0 && jobs[tag].empty()) {
+        idleConditions[tag]->notify_all();
+    }
+}
+
 /**
  * The main function for each worker thread.
  * Waits for and then executes jobs with its tag.
@@ -151,18 +238,34 @@ void* SATSolverThreadPool::workerThread(void *args) {
     WorkerThreadArguments *wargs = (WorkerThreadArguments*) args;
     SATSolverThreadPool *pool = wargs->pool;
     int tag = wargs->tag;
-    void *solver = wargs->solver;
+    int index = wargs->index;
+
+    setTraceThreadName("SAT worker");
 
     SATSolverThreadPool::Job *job;
-    while ((job = pool->getNextJob(tag))) {
-        job->func(solver, job->arguments);
+    double waitStart = getTime();
+    while ((job = pool->getNextJob(tag, index))) {
+        traceSpan("wait for job", waitStart, -1);
+        #ifndef PGP_NOMETRICS
+        countMetric(METRIC_QUEUED_JOBS);
+        countMetric(METRIC_QUEUE_WAIT_MICROSECONDS, (long long) ((getTime() - job->enqueueTime) * 1e6));
+        #endif
+        // The solver may have been replaced while the worker was idle
+        job->func(wargs->solver, job->arguments);
         delete job;
+        pool->finishJob(tag);
+        waitStart = getTime();
     }
 
     log(1, "calling ipasir release now\n");
     // TODO: Make this generic
-    ipasir_release(solver);
-    
+    releaseSolverMemory(wargs->solver);
+    ipasir_release(wargs->solver);
+    {
+        std::unique_lock<std::mutex> lck(*(pool->queueMutexes[tag]));
+        pool->releasedWorkers[tag]++;
+    }
+
     return 0;
 }
 
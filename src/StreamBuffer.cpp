@@ -0,0 +1,134 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "StreamBuffer.h"
+#include "Logger.h"
+
+
+// Address space that is reserved for the input (nothing is allocated up front)
+#define STREAM_RESERVED_SIZE (((size_t) 1) << 40)
+// Smallest reservation that is tried before reading into the heap instead
+#define STREAM_MIN_RESERVED_SIZE (((size_t) 1) << 26)
+// Amount of bytes that is made usable and read at once
+#define STREAM_CHUNK_SIZE (((size_t) 1) << 20)
+
+
+StreamBuffer::StreamBuffer(int fd) : available(0), complete(false) {
+    this->fd = fd;
+    committedSize = 0;
+
+    // The reservation counts towards the address space limit, so only a part
+    // of the limit is reserved
+    reservedSize = STREAM_RESERVED_SIZE;
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_AS, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        reservedSize = std::min(reservedSize, (size_t) limit.rlim_cur / 4);
+    }
+    buffer = nullptr;
+    while (reservedSize >= STREAM_MIN_RESERVED_SIZE) {
+        void *reserved = mmap(nullptr, reservedSize, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (reserved != MAP_FAILED) {
+            buffer = (char*) reserved;
+            break;
+        }
+        reservedSize /= 2;
+    }
+
+    if (buffer == nullptr) {
+        log(1, "Could not reserve address space, reading the whole input stream first\n");
+        reservedSize = 0;
+        committedSize = STREAM_CHUNK_SIZE;
+        buffer = (char*) malloc(committedSize);
+        if (buffer == nullptr) {
+            exitError("Could not allocate memory for the input stream\n");
+        }
+    }
+
+    reader = std::thread(&StreamBuffer::readInput, this);
+}
+
+StreamBuffer::~StreamBuffer() {
+    reader.join();
+    if (reservedSize) {
+        munmap(buffer, reservedSize);
+    } else {
+        free(buffer);
+    }
+}
+
+const char* StreamBuffer::data() {
+    // A heap buffer moves while it grows, so it is only used when complete
+    if (!reservedSize) {
+        waitFor(SIZE_MAX);
+    }
+    return buffer;
+}
+
+size_t StreamBuffer::waitFor(size_t size) {
+    size_t current = available.load(std::memory_order_acquire);
+    if (current > size || complete.load(std::memory_order_acquire)) {
+        return current;
+    }
+
+    std::unique_lock<std::mutex> lck(mutex);
+    dataArrived.wait(lck, [this, size] {
+        return available.load(std::memory_order_acquire) > size || complete.load(std::memory_order_acquire);
+    });
+    return available.load(std::memory_order_acquire);
+}
+
+/**
+ * Reads the input chunk by chunk and publishes every chunk as soon as it has
+ * been read. A heap buffer is only published once the input has ended.
+ */
+void StreamBuffer::readInput() {
+    size_t size = 0;
+    while (true) {
+        if (size == committedSize && !reservedSize) {
+            // Grow the heap buffer
+            char *grown = (char*) realloc(buffer, committedSize * 2);
+            if (grown == nullptr) {
+                exitError("Input stream is too large\n");
+            }
+            buffer = grown;
+            committedSize *= 2;
+        } else if (size == committedSize) {
+            // Make the next part of the reserved range usable
+            if (committedSize + STREAM_CHUNK_SIZE > reservedSize
+                    || mprotect(buffer + committedSize, STREAM_CHUNK_SIZE, PROT_READ | PROT_WRITE) != 0) {
+                exitError("Input stream is too large\n");
+            }
+            committedSize += STREAM_CHUNK_SIZE;
+        }
+
+        ssize_t count = read(fd, buffer + size, committedSize - size);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0) {
+            exitError("Could not read input stream\n");
+        }
+        if (count == 0) break;
+
+        size += count;
+        if (!reservedSize) continue;
+        {
+            std::unique_lock<std::mutex> lck(mutex);
+            available.store(size, std::memory_order_release);
+        }
+        dataArrived.notify_all();
+    }
+
+    {
+        std::unique_lock<std::mutex> lck(mutex);
+        available.store(size, std::memory_order_release);
+        complete.store(true, std::memory_order_release);
+    }
+    dataArrived.notify_all();
+    log(2, "Input stream complete (%lu bytes)\n", (unsigned long) size);
+}
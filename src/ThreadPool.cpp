@@ -1,27 +1,119 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <pthread.h>
+#include <sched.h>
+
 #include "ThreadPool.h"
+#include "Logger.h"
+
+
+// Index of the current worker thread and the pool it belongs to
+static thread_local ThreadPool *currentPool = nullptr;
+static thread_local int currentWorker = -1;
 
 
 /**
- * Initializes the thread pool with the given amount of worker threads
+ * Parses a cpu list as found in sysfs, e.g. "0-3,8,10-11"
  */
-ThreadPool::ThreadPool(int workerCount) {
+static std::vector<int> parseCPUList(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty()) continue;
+        size_t dash = range.find('-');
+        int first = atoi(range.substr(0, dash).c_str());
+        int last = (dash == std::string::npos) ? first : atoi(range.substr(dash+1).c_str());
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+
+/**
+ * Initializes the thread pool with the given amount of worker threads.
+ * If pinWorkers is set, each worker is pinned to one CPU. CPUs are handed out
+ * node by node, so that neighbouring workers share a NUMA node.
+ */
+ThreadPool::ThreadPool(int workerCount, bool pinWorkers) {
     stopped = false;
+    pendingTasks = 0;
+    nextQueue = 0;
+
+    for (int i = 0; i < workerCount; i++) {
+        queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+    }
+
+    std::vector<int> cpuOfWorker(workerCount, -1);
+    if (pinWorkers) {
+        // CPUs this process may run on
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        sched_getaffinity(0, sizeof(allowed), &allowed);
+
+        // Group the allowed CPUs by NUMA node
+        std::vector<std::pair<int, int>> cpus;  // (cpu, node)
+        for (int node = 0; ; node++) {
+            std::ifstream f("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!f.is_open()) break;
+            std::string list;
+            std::getline(f, list);
+            for (int cpu : parseCPUList(list)) {
+                if (CPU_ISSET(cpu, &allowed)) cpus.push_back(std::make_pair(cpu, node));
+            }
+        }
+        // No NUMA information available: treat everything as one node
+        if (cpus.empty()) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &allowed)) cpus.push_back(std::make_pair(cpu, 0));
+            }
+        }
+
+        for (int i = 0; i < workerCount && !cpus.empty(); i++) {
+            cpuOfWorker[i] = cpus[i % cpus.size()].first;
+            queues[i]->node = cpus[i % cpus.size()].second;
+        }
+    }
+
+    // Workers steal from workers on their own node first, then from the rest
+    for (int i = 0; i < workerCount; i++) {
+        for (int k = 1; k < workerCount; k++) {
+            queues[i]->victims.push_back((i + k) % workerCount);
+        }
+        int node = queues[i]->node;
+        std::stable_partition(queues[i]->victims.begin(), queues[i]->victims.end(),
+            [this, node](int v) { return queues[v]->node == node; });
+    }
 
     // Spawn the specified number of threads
     for (int i = 0; i < workerCount; i++) {
-        workers.push_back(std::thread(workerThread, this));
+        workers.push_back(std::thread(workerThread, this, i));
+        if (cpuOfWorker[i] >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpuOfWorker[i], &set);
+            if (pthread_setaffinity_np(workers.back().native_handle(), sizeof(set), &set) != 0) {
+                log(1, "Could not pin worker %d to CPU %d\n", i, cpuOfWorker[i]);
+            }
+        }
     }
 }
 
 /**
  * Stops all worker threads and joins them. This doesn't kill the threads,
- * but rather let's them finish their current jobs.
+ * but rather let's them finish their current jobs. Tasks that have not been
+ * started yet are discarded (their futures report a broken promise).
  */
 ThreadPool::~ThreadPool() {
     // Wake and join all worker threads
-    std::unique_lock<std::mutex> lck(queueMutex);
+    std::unique_lock<std::mutex> lck(idleMutex);
     stopped = true;
-    queueCondition.notify_all();
+    idleCondition.notify_all();
     lck.unlock();
 
     for (std::thread& t : workers) {
@@ -30,72 +122,118 @@ ThreadPool::~ThreadPool() {
 }
 
 /**
- * Enqueue a new job.
+ * Enqueue a new C-style job.
  */
 void ThreadPool::enqueueJob(Job job) {
-    // Acquire queue mutex and add job if possible
-    std::unique_lock<std::mutex> lck(queueMutex);
-    
-    if (!stopped) {
-        jobs.push(job);
-        queueCondition.notify_one();
+    enqueue(Task([job]() { job.func(job.arguments); }));
+}
+
+/**
+ * Enqueue a new task. Tasks enqueued by a worker of this pool go to that
+ * worker's own queue, other tasks are distributed round-robin.
+ */
+void ThreadPool::enqueue(Task task) {
+    if (queues.empty()) return;
+
+    int index = getCurrentWorker();
+    if (index < 0) {
+        index = nextQueue++ % queues.size();
+    }
+
+    // The task is queued and counted at once, so isDone() never misses it
+    std::unique_lock<std::mutex> lck(idleMutex);
+    if (stopped) return;
+    {
+        std::unique_lock<std::mutex> queueLock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
     }
+    pendingTasks++;
+    // Wake up a sleeping worker
+    idleCondition.notify_one();
 }
 
 /**
- * Checks whether there are no more jobs in the queue.
+ * Checks whether there are no more tasks waiting in the queues.
  */
 bool ThreadPool::isDone() {
-    std::unique_lock<std::mutex> lck(queueMutex);
-    bool done = jobs.empty();
-    return done;
+    return pendingTasks <= 0;
+}
+
+int ThreadPool::getWorkerCount() {
+    return workers.size();
+}
+
+int ThreadPool::getCurrentWorker() {
+    return (currentPool == this) ? currentWorker : -1;
 }
 
 
 /**
- * Gets the next job out of the queue
+ * Takes a task from the back of the worker's own queue.
  */
-ThreadPool::Job* ThreadPool::getNextJob() {
-    // Acquire queue mutex
-    std::unique_lock<std::mutex> lck(queueMutex);
+bool ThreadPool::popTask(int index, Task& task) {
+    WorkerQueue& q = *queues[index];
+    std::unique_lock<std::mutex> lck(q.mutex);
+    if (q.tasks.empty()) return false;
+    task = std::move(q.tasks.back());
+    q.tasks.pop_back();
+    return true;
+}
 
-    // Return 0 if pool was stopped meanwhile
-    ThreadPool::Job *job = 0;
+/**
+ * Takes a task from the front of another worker's queue.
+ */
+bool ThreadPool::stealTask(int victim, Task& task) {
+    WorkerQueue& q = *queues[victim];
+    std::unique_lock<std::mutex> lck(q.mutex, std::try_to_lock);
+    if (!lck.owns_lock() || q.tasks.empty()) return false;
+    task = std::move(q.tasks.front());
+    q.tasks.pop_front();
+    return true;
+}
 
-    if (!stopped) {
-        // Wait for wakeup if there is no job currently
-        while (jobs.empty() && !stopped) {
-            queueCondition.wait(lck);
+/**
+ * Gets the next task for the given worker, waiting for one if necessary.
+ * Returns false if the pool was stopped.
+ */
+bool ThreadPool::getNextTask(int index, Task& task) {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lck(idleMutex);
+            // Wait for wakeup if there is no task currently
+            while (pendingTasks <= 0 && !stopped) {
+                idleCondition.wait(lck);
+            }
+            if (stopped) return false;
         }
 
-        // Check if pool stopped in the meantime
-        if (!stopped) {
-            // Get the next job from the queue
-            job = new ThreadPool::Job();
-            job->func = jobs.front().func;
-            job->arguments = jobs.front().arguments;
-            jobs.pop();
+        // Own queue first, then steal from the others
+        bool found = popTask(index, task);
+        for (unsigned int i = 0; !found && i < queues[index]->victims.size(); i++) {
+            found = stealTask(queues[index]->victims[i], task);
         }
-    }
 
-    // Unlock the queue mutex and return the job
-    lck.unlock();
-    return job;
+        if (found) {
+            pendingTasks--;
+            return true;
+        }
+
+        // Another worker was faster (or a victim's queue was locked), retry
+        std::this_thread::yield();
+    }
 }
 
 /**
  * The main function for each worker thread.
- * Waits for and then executes jobs.
+ * Waits for and then executes tasks.
  */
-void* ThreadPool::workerThread(void *args) {
-    ThreadPool *pool = (ThreadPool*) args;
-    ThreadPool::Job *job;
-
-    while ((job = pool->getNextJob())) {
-        job->func(job->arguments);
-        delete job;
+void ThreadPool::workerThread(ThreadPool *pool, int index) {
+    currentPool = pool;
+    currentWorker = index;
+
+    Task task;
+    while (pool->getNextTask(index, task)) {
+        task();
+        task = Task();
     }
-
-    return 0;
 }
-
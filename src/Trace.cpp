@@ -0,0 +1,116 @@
+#include <vector>
+#include <mutex>
+#include <cstdio>
+
+#include "Trace.h"
+
+
+bool traceEnabled = false;
+
+// One event: a span if duration >= 0, otherwise a point in time
+struct TraceEvent {
+    const char *name;
+    double start;
+    double duration;
+    int layer;
+};
+
+// Events of one thread. The lock is only contended while the trace is
+// written.
+struct TraceBuffer {
+    int id;
+    std::string name;
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+};
+
+static thread_local TraceBuffer *threadBuffer = nullptr;
+
+// Buffers of all threads that recorded anything. They are never freed, since
+// the trace is written at exit.
+static std::mutex registryMutex;
+static std::vector<TraceBuffer*> registry;
+
+
+static TraceBuffer* getThreadBuffer() {
+    if (!threadBuffer) {
+        threadBuffer = new TraceBuffer();
+        std::unique_lock<std::mutex> lck(registryMutex);
+        threadBuffer->id = registry.size();
+        threadBuffer->name = "thread " + std::to_string(threadBuffer->id);
+        registry.push_back(threadBuffer);
+    }
+    return threadBuffer;
+}
+
+static void record(const char *name, double start, double duration, int layer) {
+    TraceBuffer *buffer = getThreadBuffer();
+    std::unique_lock<std::mutex> lck(buffer->mutex);
+    buffer->events.push_back({name, start, duration, layer});
+}
+
+void startTrace() {
+    traceEnabled = true;
+    setTraceThreadName("main");
+}
+
+void setTraceThreadName(const char *name) {
+    if (!traceEnabled) return;
+    TraceBuffer *buffer = getThreadBuffer();
+    std::unique_lock<std::mutex> lck(buffer->mutex);
+    buffer->name = name + std::string(" ") + std::to_string(buffer->id);
+}
+
+void traceSpan(const char *name, double start, int layer) {
+    if (!traceEnabled) return;
+    record(name, start, getTime() - start, layer);
+}
+
+void traceInstant(const char *name, int layer) {
+    if (!traceEnabled) return;
+    record(name, getTime(), -1, layer);
+}
+
+void resetTrace() {
+    std::unique_lock<std::mutex> registryLock(registryMutex);
+    for (TraceBuffer *buffer : registry) {
+        std::unique_lock<std::mutex> lck(buffer->mutex);
+        std::vector<TraceEvent>().swap(buffer->events);
+    }
+}
+
+void writeTrace(std::string file) {
+    FILE *out = fopen(file.c_str(), "w");
+    if (out == nullptr) {
+        log(0, "Could not write trace to %s\n", file.c_str());
+        return;
+    }
+
+    // Times are given in microseconds
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    std::unique_lock<std::mutex> registryLock(registryMutex);
+    for (TraceBuffer *buffer : registry) {
+        std::unique_lock<std::mutex> lck(buffer->mutex);
+        fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                "\"args\": {\"name\": \"%s\"}}", first ? "" : ",\n", buffer->id, buffer->name.c_str());
+        first = false;
+
+        for (const TraceEvent& event : buffer->events) {
+            fprintf(out, ",\n{\"name\": \"%s\", \"pid\": 1, \"tid\": %d, \"ts\": %.1f",
+                    event.name, buffer->id, event.start * 1e6);
+            if (event.duration >= 0) {
+                fprintf(out, ", \"ph\": \"X\", \"dur\": %.1f", event.duration * 1e6);
+            } else {
+                fprintf(out, ", \"ph\": \"i\", \"s\": \"t\"");
+            }
+            if (event.layer >= 0) {
+                fprintf(out, ", \"args\": {\"layer\": %d}", event.layer);
+            }
+            fprintf(out, "}");
+        }
+    }
+    fprintf(out, "\n]}\n");
+
+    fclose(out);
+}